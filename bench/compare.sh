@@ -0,0 +1,47 @@
+#!/bin/bash -e
+#
+# Compare two outputs of bench/suite.sh, for example from two commits:
+#
+#   make bench >before.txt
+#   (change, rebuild)
+#   make bench >after.txt
+#   bench/compare.sh before.txt after.txt
+#
+# For each measurement present in both files, the numeric results are printed
+# side by side with the relative change.
+
+if [ $# -ne 2 ]; then
+    echo "Usage: $0 OLD NEW" >&2
+    exit 1
+fi
+
+awk '
+    function is_id(name) {
+        return name == "dataset" || name == "test" || name == "threads"
+    }
+    /^dataset=/ {
+        n = split($0, kv, " ")
+        id = ""
+        for (i = 1; i <= n; ++i) {
+            eq = index(kv[i], "=")
+            name[i] = substr(kv[i], 1, eq - 1)
+            value[i] = substr(kv[i], eq + 1)
+            if (is_id(name[i])) {
+                id = id " " kv[i]
+            }
+        }
+        for (i = 1; i <= n; ++i) {
+            if (is_id(name[i]) || name[i] == "keys" || name[i] == "found") {
+                continue
+            }
+            key = id SUBSEP name[i]
+            if (FNR == NR) {
+                old[key] = value[i]
+            } else if (key in old) {
+                change = old[key] == 0 ? 0 : (value[i] - old[key]) / old[key] * 100
+                printf "%-45s %-18s %12s %12s %+7.1f%%\n", substr(id, 2), name[i],
+                       old[key], value[i], change
+            }
+        }
+    }
+' "$1" "$2"
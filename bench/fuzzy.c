@@ -0,0 +1,271 @@
+#include <config.h>
+#include "trie.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Compare `trie_fuzzy_search()` with generating every string within the edit
+ * distance of a key and looking each of them up. The candidates are built
+ * from the bytes that occur anywhere in the keys file, and with `-n` only
+ * the first keys of the file are searched. Both approaches must find the
+ * same number of keys.
+ *
+ * The output is a single line of `name=value` pairs.
+ */
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char **
+read_keys(FILE *fh, size_t *count)
+{
+    size_t len = 1024;
+    char **keys = malloc(len * sizeof *keys);
+    char *line = NULL;
+    size_t line_len = 0;
+
+    *count = 0;
+    while (getline(&line, &line_len, fh) > 0) {
+        line[strcspn(line, "\n")] = 0;
+        if (*count >= len) {
+            len *= 2;
+            keys = realloc(keys, len * sizeof *keys);
+        }
+        keys[(*count)++] = strdup(line);
+    }
+    free(line);
+    return keys;
+}
+
+typedef struct {
+    char **items;
+    size_t len;
+    size_t cap;
+} Strings;
+
+static void strings_add(Strings *s, const char *data, size_t len)
+{
+    if (s->len == s->cap) {
+        s->cap = s->cap ? 2 * s->cap : 1024;
+        s->items = realloc(s->items, s->cap * sizeof *s->items);
+    }
+    char *copy = malloc(len + 1);
+    memcpy(copy, data, len);
+    copy[len] = 0;
+    s->items[s->len++] = copy;
+}
+
+static void strings_clear(Strings *s)
+{
+    for (size_t i = 0; i < s->len; ++i) {
+        free(s->items[i]);
+    }
+    s->len = 0;
+}
+
+static int compare_strings(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/**
+ * Add all strings one edit away from `key` to `out`.
+ */
+static void
+add_edits(Strings *out, const char *key, const char *alphabet, size_t letters)
+{
+    size_t len = strlen(key);
+    char buf[len + 2];
+    for (size_t i = 0; i <= len; ++i) {
+        if (i < len) {
+            /* Deletion. */
+            memcpy(buf, key, i);
+            memcpy(buf + i, key + i + 1, len - i - 1);
+            strings_add(out, buf, len - 1);
+        }
+        for (size_t a = 0; a < letters; ++a) {
+            /* Insertion. */
+            memcpy(buf, key, i);
+            buf[i] = alphabet[a];
+            memcpy(buf + i + 1, key + i, len - i);
+            strings_add(out, buf, len + 1);
+            /* Replacement. */
+            if (i < len && key[i] != alphabet[a]) {
+                memcpy(buf, key, len);
+                buf[i] = alphabet[a];
+                strings_add(out, buf, len);
+            }
+        }
+    }
+}
+
+/**
+ * Generate every string within `edits` edits of the key, without duplicates.
+ */
+static void
+generate(Strings *out, const char *key, unsigned edits, const char *alphabet,
+         size_t letters)
+{
+    strings_clear(out);
+    strings_add(out, key, strlen(key));
+    size_t level_start = 0;
+    for (unsigned e = 0; e < edits; ++e) {
+        size_t level_end = out->len;
+        for (size_t i = level_start; i < level_end; ++i) {
+            add_edits(out, out->items[i], alphabet, letters);
+        }
+        level_start = level_end;
+    }
+    qsort(out->items, out->len, sizeof *out->items, compare_strings);
+    size_t unique = 0;
+    for (size_t i = 0; i < out->len; ++i) {
+        if (unique > 0 && strcmp(out->items[unique - 1], out->items[i]) == 0) {
+            free(out->items[i]);
+        } else {
+            out->items[unique++] = out->items[i];
+        }
+    }
+    out->len = unique;
+}
+
+static int count_match(const char *key, size_t key_len, unsigned edits,
+                       const TrieValue *values, size_t num_values, void *arg)
+{
+    (void) key;
+    (void) key_len;
+    (void) edits;
+    (void) values;
+    (void) num_values;
+    ++*(size_t *) arg;
+    return 0;
+}
+
+static void usage(FILE *fh, const char *prog)
+{
+    fprintf(fh, "Usage: %s [-k EDITS] [-n COUNT] TRIE KEYS [ROUNDS]\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned edits = 1;
+    size_t limit = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "k:n:h")) != -1) {
+        switch (opt) {
+        case 'k':
+            edits = atoi(optarg);
+            break;
+        case 'n':
+            limit = atol(optarg);
+            break;
+        case 'h':
+            usage(stdout, argv[0]);
+            return 0;
+        default:
+            usage(stderr, argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind < 2 || argc - optind > 3) {
+        usage(stderr, argv[0]);
+        return 1;
+    }
+    int rounds = argc - optind > 2 ? atoi(argv[optind + 2]) : 3;
+
+    Trie *trie = trie_load(argv[optind]);
+    if (!trie) {
+        fprintf(stderr, "Failed to load trie: %s\n", trie_get_last_error());
+        return 2;
+    }
+    FILE *fh = fopen(argv[optind + 1], "r");
+    if (!fh) {
+        perror("Failed to open keys");
+        return 2;
+    }
+    size_t total;
+    char **keys = read_keys(fh, &total);
+    fclose(fh);
+    size_t count = limit > 0 && limit < total ? limit : total;
+    if (count == 0) {
+        fprintf(stderr, "No keys to look up\n");
+        return 2;
+    }
+
+    bool seen[256] = { false };
+    char alphabet[256];
+    size_t letters = 0;
+    for (size_t i = 0; i < total; ++i) {
+        for (const unsigned char *c = (unsigned char *) keys[i]; *c; ++c) {
+            if (!seen[*c]) {
+                seen[*c] = true;
+                alphabet[letters++] = *c;
+            }
+        }
+    }
+
+    double fuzzy_best = -1, probe_best = -1;
+    size_t fuzzy_found = 0, probe_found = 0, probes = 0;
+    Strings candidates = { NULL, 0, 0 };
+    TrieValue values[16];
+    char buf[256];
+    for (int round = 0; round < rounds; ++round) {
+        fuzzy_found = 0;
+        double start = now();
+        for (size_t i = 0; i < count; ++i) {
+            trie_fuzzy_search(trie, keys[i], strlen(keys[i]), edits,
+                              count_match, &fuzzy_found);
+        }
+        double elapsed = now() - start;
+        if (fuzzy_best < 0 || elapsed < fuzzy_best) {
+            fuzzy_best = elapsed;
+        }
+
+        probe_found = probes = 0;
+        start = now();
+        for (size_t i = 0; i < count; ++i) {
+            generate(&candidates, keys[i], edits, alphabet, letters);
+            probes += candidates.len;
+            for (size_t j = 0; j < candidates.len; ++j) {
+                const char *c = candidates.items[j];
+                if (trie_lookup_values(trie, c, strlen(c), values, 16,
+                                       buf, sizeof buf) >= 0) {
+                    ++probe_found;
+                }
+            }
+        }
+        elapsed = now() - start;
+        if (probe_best < 0 || elapsed < probe_best) {
+            probe_best = elapsed;
+        }
+    }
+
+    printf("keys=%zu edits=%u matches=%zu fuzzy_us_per_key=%.2f"
+           " probe_us_per_key=%.2f probes_per_key=%.0f speedup=%.1f\n",
+           count, edits, fuzzy_found, fuzzy_best / count * 1e6,
+           probe_best / count * 1e6, (double) probes / count,
+           probe_best / fuzzy_best);
+
+    strings_clear(&candidates);
+    free(candidates.items);
+    for (size_t i = 0; i < total; ++i) {
+        free(keys[i]);
+    }
+    free(keys);
+    trie_free(trie);
+    if (fuzzy_found != probe_found) {
+        fprintf(stderr, "Fuzzy search found %zu keys, probing found %zu\n",
+                fuzzy_found, probe_found);
+        return 3;
+    }
+    return 0;
+}
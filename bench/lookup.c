@@ -0,0 +1,221 @@
+#include <config.h>
+#include "trie.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Measure the cost of looking up keys in a compiled trie. The keys are read
+ * from a file (one per line) into memory first and then looked up repeatedly,
+ * so that only the lookup itself is timed.
+ *
+ * With `-p`, each lookup is timed separately and latency percentiles are
+ * printed too. With `-C`, the file is dropped from the page cache before it is
+ * loaded and only the first pass is measured, which shows the cost of page
+ * faults. With `-j N`, N threads look up all keys at the same time and the
+ * total throughput is printed.
+ *
+ * The output is a single line of `name=value` pairs.
+ */
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char **
+read_keys(FILE *fh, size_t *count, size_t *chars)
+{
+    size_t len = 1024;
+    char **keys = malloc(len * sizeof *keys);
+    char *line = NULL;
+    size_t line_len = 0;
+
+    *count = *chars = 0;
+    while (getline(&line, &line_len, fh) > 0) {
+        line[strcspn(line, "\n")] = 0;
+        if (*count >= len) {
+            len *= 2;
+            keys = realloc(keys, len * sizeof *keys);
+        }
+        keys[(*count)++] = strdup(line);
+        *chars += strlen(line);
+    }
+    free(line);
+    return keys;
+}
+
+typedef struct {
+    Trie *trie;
+    char **keys;
+    size_t count;
+    int rounds;
+    double *latencies;  /**< Time of each lookup of the last round or NULL. */
+    double best;        /**< Duration of the fastest round. */
+    size_t found;
+} Job;
+
+static void * run_job(void *arg)
+{
+    Job *job = arg;
+    job->best = -1;
+    for (int round = 0; round < job->rounds; ++round) {
+        job->found = 0;
+        double start = now();
+        for (size_t i = 0; i < job->count; ++i) {
+            double key_start = job->latencies ? now() : 0;
+            const char *data = trie_lookup(job->trie, job->keys[i]);
+            if (data) {
+                ++job->found;
+                trie_result_free(job->trie, data);
+            }
+            if (job->latencies) {
+                job->latencies[i] = now() - key_start;
+            }
+        }
+        double elapsed = now() - start;
+        if (job->best < 0 || elapsed < job->best) {
+            job->best = elapsed;
+        }
+    }
+    return NULL;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Remove the file from the page cache, so that the next access has to read
+ * it from disk.
+ */
+static void drop_cache(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0 || posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) != 0) {
+        fprintf(stderr, "Failed to drop %s from page cache\n", filename);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+static void usage(FILE *fh, const char *prog)
+{
+    fprintf(fh, "Usage: %s [-p] [-C] [-j THREADS] TRIE KEYS [ROUNDS]\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    bool percentiles = false;
+    bool cold = false;
+    int threads = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "pCj:h")) != -1) {
+        switch (opt) {
+        case 'p':
+            percentiles = true;
+            break;
+        case 'C':
+            cold = true;
+            percentiles = true;
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'h':
+            usage(stdout, argv[0]);
+            return 0;
+        default:
+            usage(stderr, argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind < 2 || argc - optind > 3 || threads < 1) {
+        usage(stderr, argv[0]);
+        return 1;
+    }
+    const char *trie_file = argv[optind];
+    const char *keys_file = argv[optind + 1];
+    int rounds = argc - optind > 2 ? atoi(argv[optind + 2]) : 5;
+    if (cold) {
+        rounds = 1;
+        drop_cache(trie_file);
+    }
+
+    Trie *trie = trie_load(trie_file);
+    if (!trie) {
+        fprintf(stderr, "Failed to load trie: %s\n", trie_get_last_error());
+        return 2;
+    }
+    FILE *fh = fopen(keys_file, "r");
+    if (!fh) {
+        perror("Failed to open keys");
+        return 2;
+    }
+    size_t count, chars;
+    char **keys = read_keys(fh, &count, &chars);
+    fclose(fh);
+    if (count == 0) {
+        fprintf(stderr, "No keys to look up\n");
+        return 2;
+    }
+
+    Job jobs[threads];
+    pthread_t ids[threads];
+    for (int i = 0; i < threads; ++i) {
+        jobs[i] = (Job) {
+            .trie = trie,
+            .keys = keys,
+            .count = count,
+            .rounds = rounds,
+            .latencies = percentiles ? malloc(count * sizeof(double)) : NULL,
+        };
+    }
+    double start = now();
+    for (int i = 1; i < threads; ++i) {
+        pthread_create(ids + i, NULL, run_job, jobs + i);
+    }
+    run_job(jobs);
+    for (int i = 1; i < threads; ++i) {
+        pthread_join(ids[i], NULL);
+    }
+    double total = now() - start;
+
+    double best = jobs[0].best;
+    printf("keys=%zu found=%zu ns_per_key=%.1f ns_per_char=%.2f",
+           count, jobs[0].found, best / count * 1e9, best / chars * 1e9);
+    printf(" threads=%d keys_per_sec=%.0f", threads,
+           threads * count * rounds / total);
+    if (percentiles) {
+        double *lat = jobs[0].latencies;
+        qsort(lat, count, sizeof *lat, compare_double);
+        printf(" p50_ns=%.0f p90_ns=%.0f p99_ns=%.0f p999_ns=%.0f max_ns=%.0f",
+               lat[count / 2] * 1e9, lat[count * 9 / 10] * 1e9,
+               lat[count * 99 / 100] * 1e9, lat[count * 999 / 1000] * 1e9,
+               lat[count - 1] * 1e9);
+    }
+    putchar('\n');
+
+    for (int i = 0; i < threads; ++i) {
+        free(jobs[i].latencies);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        free(keys[i]);
+    }
+    free(keys);
+    trie_free(trie);
+    return 0;
+}
@@ -0,0 +1,37 @@
+#!/bin/bash -e
+#
+# Compile the datasets used by the integration tests (only much bigger) and
+# report the cost of looking up all their keys. Run from the build directory.
+#
+# With the default size the trie fits into cache and the numbers show the CPU
+# cost of the search. Set COUNT to a few million to measure memory stalls.
+
+COUNT=${COUNT:-20000}
+ROUNDS=${ROUNDS:-50}
+
+WORKDIR=$(mktemp -d)
+trap 'rm -rf $WORKDIR' EXIT
+
+make -s bench/lookup
+
+run()
+{
+    NAME=$1
+    ARGS=$2
+    ./list-compile $ARGS $WORKDIR/$NAME.txt $WORKDIR/$NAME.trie >/dev/null
+    if [ -n "$ARGS" ]; then
+        shuf $WORKDIR/$NAME.txt >$WORKDIR/$NAME.keys
+    else
+        cut -d: -f1 $WORKDIR/$NAME.txt | shuf >$WORKDIR/$NAME.keys
+    fi
+    echo -n "$NAME: "
+    ./bench/lookup $WORKDIR/$NAME.trie $WORKDIR/$NAME.keys $ROUNDS
+}
+
+for n in $(seq 1 $COUNT); do
+    echo "my-key-$n:my-data-$n"
+done >$WORKDIR/very-many-keys.txt
+run very-many-keys ""
+
+strings </dev/urandom | head -n $COUNT >$WORKDIR/random-keys.txt
+run random-keys "-e"
@@ -0,0 +1,220 @@
+#include <config.h>
+#include "trie-client.h"
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Load generator for list-serve. Each connection runs in its own thread and
+ * keeps a number of requests in flight. The time from sending a request to
+ * receiving its response is recorded, and the throughput and latency
+ * percentiles over all connections are reported at the end.
+ */
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char **
+read_keys(FILE *fh, size_t *count)
+{
+    size_t len = 1024;
+    char **keys = malloc(len * sizeof *keys);
+    char *line = NULL;
+    size_t line_len = 0;
+
+    *count = 0;
+    while (getline(&line, &line_len, fh) > 0) {
+        line[strcspn(line, "\n")] = 0;
+        if (*count >= len) {
+            len *= 2;
+            keys = realloc(keys, len * sizeof *keys);
+        }
+        keys[(*count)++] = strdup(line);
+    }
+    free(line);
+    return keys;
+}
+
+typedef struct {
+    const char *socket;
+    char **keys;
+    size_t num_keys;
+    unsigned trie;
+    unsigned batch;         /**< Keys per request. */
+    unsigned depth;         /**< Requests in flight per connection. */
+    size_t requests;        /**< Requests sent by each connection. */
+    size_t first_key;       /**< Where in the keys this connection starts. */
+    double *latencies;      /**< Latency of each request in seconds. */
+    size_t found;           /**< Keys that were found. */
+} Connection;
+
+static void * run_connection(void *arg)
+{
+    Connection *c = arg;
+    TrieClient *client = trie_client_connect(c->socket);
+    if (!client) {
+        perror(c->socket);
+        exit(2);
+    }
+    const char *keys[c->batch];
+    size_t lens[c->batch];
+    double sent_at[c->depth];
+    size_t next_key = c->first_key;
+    size_t sent = 0, received = 0;
+
+    while (received < c->requests) {
+        if (sent < c->requests && sent - received < c->depth) {
+            for (unsigned i = 0; i < c->batch; ++i) {
+                keys[i] = c->keys[next_key];
+                lens[i] = strlen(keys[i]);
+                next_key = (next_key + 1) % c->num_keys;
+            }
+            sent_at[sent % c->depth] = now();
+            if (trie_client_send(client, c->trie, keys, lens, c->batch) < 0) {
+                perror("send");
+                exit(2);
+            }
+            ++sent;
+            continue;
+        }
+        TrieClientResponse res;
+        if (trie_client_recv(client, &res) < 0) {
+            perror("recv");
+            exit(2);
+        }
+        c->latencies[received] = now() - sent_at[received % c->depth];
+        for (size_t i = 0; i < res.num_keys; ++i) {
+            c->found += res.counts[i] >= 0;
+        }
+        ++received;
+    }
+    trie_client_close(client);
+    return NULL;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void usage(FILE *fh, const char *prog)
+{
+    fprintf(fh, "Usage: %s [-c CONNECTIONS] [-b BATCH] [-d DEPTH] [-n REQUESTS] "
+            "[-t TRIE] SOCKET KEYS\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned connections = 4;
+    unsigned batch = 32;
+    unsigned depth = 8;
+    size_t requests = 10000;
+    unsigned trie = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:b:d:n:t:h")) != -1) {
+        switch (opt) {
+        case 'c':
+            connections = atoi(optarg);
+            break;
+        case 'b':
+            batch = atoi(optarg);
+            break;
+        case 'd':
+            depth = atoi(optarg);
+            break;
+        case 'n':
+            requests = strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            trie = atoi(optarg);
+            break;
+        case 'h':
+            usage(stdout, argv[0]);
+            return 0;
+        default:
+            usage(stderr, argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 2 || connections == 0 || batch == 0 || depth == 0
+            || batch > 65535) {
+        usage(stderr, argv[0]);
+        return 1;
+    }
+
+    FILE *fh = fopen(argv[optind + 1], "r");
+    if (!fh) {
+        perror(argv[optind + 1]);
+        return 1;
+    }
+    size_t num_keys;
+    char **keys = read_keys(fh, &num_keys);
+    fclose(fh);
+    if (num_keys == 0) {
+        fprintf(stderr, "No keys\n");
+        return 1;
+    }
+
+    Connection conns[connections];
+    pthread_t ids[connections];
+    for (unsigned i = 0; i < connections; ++i) {
+        conns[i] = (Connection) {
+            .socket = argv[optind],
+            .keys = keys,
+            .num_keys = num_keys,
+            .trie = trie,
+            .batch = batch,
+            .depth = depth,
+            .requests = requests,
+            .first_key = num_keys * i / connections,
+            .latencies = malloc(requests * sizeof(double)),
+        };
+    }
+
+    double start = now();
+    for (unsigned i = 0; i < connections; ++i) {
+        pthread_create(ids + i, NULL, run_connection, conns + i);
+    }
+    for (unsigned i = 0; i < connections; ++i) {
+        pthread_join(ids[i], NULL);
+    }
+    double elapsed = now() - start;
+
+    size_t total = requests * connections;
+    double *all = malloc(total * sizeof *all);
+    size_t found = 0;
+    for (unsigned i = 0; i < connections; ++i) {
+        memcpy(all + i * requests, conns[i].latencies, requests * sizeof *all);
+        found += conns[i].found;
+        free(conns[i].latencies);
+    }
+    qsort(all, total, sizeof *all, compare_double);
+
+    printf("%u connections, %u keys per request, %u requests in flight\n",
+           connections, batch, depth);
+    printf("%zu requests in %.2f s: %.0f requests/s, %.0f keys/s, %.1f%% found\n",
+           total, elapsed, total / elapsed, total * batch / elapsed,
+           100.0 * found / (total * batch));
+    printf("latency us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+           all[total / 2] * 1e6, all[total * 9 / 10] * 1e6,
+           all[total * 99 / 100] * 1e6, all[total * 999 / 1000] * 1e6,
+           all[total - 1] * 1e6);
+
+    free(all);
+    for (size_t i = 0; i < num_keys; ++i) {
+        free(keys[i]);
+    }
+    free(keys);
+    return 0;
+}
@@ -0,0 +1,150 @@
+#!/bin/bash -e
+#
+# Benchmark suite run by `make bench` from the build directory. It generates
+# synthetic corpora, compiles them and measures the lookups. Every result is
+# printed as a line of `name=value` pairs. The fields with text values
+# (dataset, test, threads) identify the measurement, the numeric fields are
+# the results. Save the output of two commits and compare them with
+# `bench/compare.sh OLD NEW`.
+#
+# COUNT sets the number of keys of each corpus, ROUNDS the number of passes
+# over the keys (the fastest is reported) and THREADS the thread counts used
+# to measure scaling.
+
+COUNT=${COUNT:-200000}
+ROUNDS=${ROUNDS:-5}
+THREADS=${THREADS:-"1 2 4"}
+
+SRCDIR=$(dirname $0)
+WORKDIR=$(mktemp -d ${TMPDIR:-/tmp}/libtrie-bench.XXXXXX)
+trap 'rm -rf $WORKDIR' EXIT
+
+now()
+{
+    date +%s.%N
+}
+
+# Keys that are not in the trie: every key with an extra character.
+miss_keys()
+{
+    sed 's/$/~/' "$1"
+}
+
+corpus_very_many_keys()
+{
+    seq 1 $COUNT | awk '{ print "my-key-" $1 ":my-data-" $1 }'
+}
+
+# Lines of random printable characters, like `strings` finds in random data.
+# The same seed gives the same corpus on every run.
+corpus_random_keys()
+{
+    awk -v count=$COUNT 'BEGIN {
+        srand(13)
+        for (i = 0; i < count; ++i) {
+            n = 4 + int(rand() * 20)
+            line = ""
+            for (j = 0; j < n; ++j) {
+                line = line sprintf("%c", 32 + int(rand() * 95))
+            }
+            print line
+        }
+    }'
+}
+
+# Few keys with a hundred values each.
+corpus_very_long_data()
+{
+    seq 1 $COUNT | awk '{ print "long-key-" int($1 / 100) ":some data " $1 % 100 }'
+}
+
+# Word-like keys made of syllables. Their values are tags, and the query keys
+# follow Zipf's law like words in a text.
+corpus_zipf_words()
+{
+    awk -v count=$COUNT 'BEGIN {
+        srand(42)
+        split("ka ri to na me su lo vi de pa ho ne mu si ta ro be lu", syl)
+        split("NOUN VERB ADJ ADV", tags)
+        for (i = 1; i <= count; ++i) {
+            n = 2 + int(rand() * 3)
+            word = ""
+            for (j = 0; j < n; ++j) {
+                word = word syl[1 + int(rand() * 18)]
+            }
+            print word ":" tags[1 + int(rand() * 4)]
+        }
+    }'
+}
+
+zipf_queries()
+{
+    awk -v count=$COUNT 'BEGIN { srand(7) }
+        { words[NR] = $0 }
+        END {
+            # Cumulative weights of 1/rank.
+            total = 0
+            for (i = 1; i <= NR; ++i) {
+                total += 1 / i
+                cum[i] = total
+            }
+            for (q = 0; q < count; ++q) {
+                r = rand() * total
+                lo = 1; hi = NR
+                while (lo < hi) {
+                    mid = int((lo + hi) / 2)
+                    if (cum[mid] < r) lo = mid + 1; else hi = mid
+                }
+                print words[lo]
+            }
+        }' "$1"
+}
+
+run_dataset()
+{
+    NAME=$1
+    ARGS=$2
+    INPUT=$WORKDIR/$NAME.txt
+    TRIE=$WORKDIR/$NAME.trie
+
+    corpus_${NAME//-/_} >$INPUT
+    if [ "$ARGS" = "-e" ]; then
+        cp $INPUT $WORKDIR/$NAME.hit
+    else
+        cut -d: -f1 $INPUT | sort -u | shuf >$WORKDIR/$NAME.hit
+    fi
+    miss_keys $WORKDIR/$NAME.hit >$WORKDIR/$NAME.miss
+    if [ "$NAME" = zipf-words ]; then
+        zipf_queries $WORKDIR/$NAME.hit >$WORKDIR/$NAME.zipf
+    fi
+
+    START=$(now)
+    RSS=$(./list-compile -v $ARGS $INPUT $TRIE | sed -n 's/^Peak memory usage: \([0-9]*\) kB/\1/p')
+    END=$(now)
+    awk -v name=$NAME -v start=$START -v end=$END -v bytes=$(wc -c <$INPUT) \
+        -v rss=$RSS -v size=$(wc -c <$TRIE) 'BEGIN {
+        printf "dataset=%s test=compile seconds=%.3f input_mb_per_sec=%.2f peak_rss_kb=%d file_bytes=%d\n",
+               name, end - start, bytes / (end - start) / 1e6, rss, size
+    }'
+
+    for test in hit miss zipf; do
+        [ -f $WORKDIR/$NAME.$test ] || continue
+        echo "dataset=$NAME test=$test-warm $(./bench/lookup -p $TRIE $WORKDIR/$NAME.$test $ROUNDS)"
+    done
+    echo "dataset=$NAME test=hit-cold $(./bench/lookup -C $TRIE $WORKDIR/$NAME.hit)"
+    for threads in $THREADS; do
+        [ $threads -gt 1 ] || continue
+        echo "dataset=$NAME test=hit-warm $(./bench/lookup -j $threads $TRIE $WORKDIR/$NAME.hit $ROUNDS)"
+    done
+    # Misspelled words, against generating the candidates and probing them.
+    if [ "$NAME" = zipf-words ]; then
+        for edits in 1 2; do
+            echo "dataset=$NAME test=fuzzy-$edits $(./bench/fuzzy -k $edits -n 200 $TRIE $WORKDIR/$NAME.hit $ROUNDS)"
+        done
+    fi
+}
+
+run_dataset very-many-keys ""
+run_dataset random-keys "-e"
+run_dataset very-long-data ""
+run_dataset zipf-words ""
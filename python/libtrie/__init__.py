@@ -7,45 +7,225 @@ than spawning a process and communicating with it.
 
 This Python interface only allows for querying the trie. It is not possible to
 create new tries via Python.
+
+The `Trie` class comes from the compiled `_libtrie` extension when it is
+available. Otherwise a slower implementation using ctypes is used, and only
+then is the shared library loaded through ctypes.
 """
 
-from ctypes import cdll, c_char_p, c_void_p, cast
+from ctypes import (cdll, c_char_p, c_int, c_void_p, c_size_t, c_ssize_t,
+                    c_uint, c_uint64, cast, create_string_buffer, string_at,
+                    byref, CFUNCTYPE, POINTER, Structure)
 import ctypes.util
 import os
+import sys
+import threading
 
 from libtrie.config import LIB_PATH
 
-LIBTRIE = cdll.LoadLibrary(LIB_PATH)
-LIBTRIE.trie_load.argtypes = [c_char_p]
-LIBTRIE.trie_load.restype = c_void_p
-LIBTRIE.trie_lookup.argtypes = [c_void_p, c_char_p]
-LIBTRIE.trie_lookup.restype = c_void_p
-LIBTRIE.trie_get_last_error.restype = c_char_p
-LIBTRIE.trie_result_free.argtypes = [c_void_p, c_void_p]
 
 
-class Trie(object):
+class TrieValue(Structure):
+    """One value stored under a key, see `TrieValue` in trie.h."""
+    _fields_ = [('data', c_void_p), ('len', c_size_t)]
+
+# Number of buckets of the latency histogram, TRIE_LATENCY_BUCKETS in trie.h.
+LATENCY_BUCKETS = 32
+
+_COUNTER_NAMES = ['lookups', 'hits', 'misses', 'nodes', 'chunks',
+                  'decoded_bytes', 'allocations']
+
+
+class TrieCounters(Structure):
+    """Lookup counters, see `TrieCounters` in trie.h."""
+    _fields_ = ([(name, c_uint64) for name in _COUNTER_NAMES]
+                + [('latency', c_uint64 * LATENCY_BUCKETS)])
+
+MATCH_CALLBACK = CFUNCTYPE(c_int, c_size_t, c_size_t, POINTER(TrieValue),
+                           c_ssize_t, c_void_p)
+
+LIBTRIE = None
+_LIBTRIE_LOCK = threading.Lock()
+
+
+def _load_library():
+    """
+    Load the shared library used by `CtypesTrie`. The compiled extension does
+    not need it, so it is only loaded when the first `CtypesTrie` is created.
+    """
+    global LIBTRIE
+    with _LIBTRIE_LOCK:
+        if LIBTRIE is not None:
+            return LIBTRIE
+        lib = cdll.LoadLibrary(LIB_PATH)
+        lib.trie_load.argtypes = [c_char_p]
+        lib.trie_load.restype = c_void_p
+        lib.trie_load_ex.argtypes = [c_char_p, c_uint]
+        lib.trie_load_ex.restype = c_void_p
+        lib.trie_prewarm.argtypes = [c_void_p, c_uint]
+        lib.trie_prewarm.restype = c_size_t
+        lib.trie_lookup.argtypes = [c_void_p, c_char_p]
+        lib.trie_lookup.restype = c_void_p
+        lib.trie_get_last_error.restype = c_char_p
+        lib.trie_free.argtypes = [c_void_p]
+        lib.trie_result_free.argtypes = [c_void_p, c_void_p]
+        lib.trie_lookup_into.argtypes = [c_void_p, c_char_p, c_size_t,
+                                         c_char_p, c_size_t]
+        lib.trie_lookup_into.restype = c_ssize_t
+        lib.trie_lookup_values.argtypes = [c_void_p, c_char_p, c_size_t,
+                                           POINTER(TrieValue), c_size_t,
+                                           c_char_p, c_size_t]
+        lib.trie_lookup_values.restype = c_ssize_t
+        lib.trie_lookup_batch.argtypes = [c_void_p, c_void_p, c_size_t,
+                                          c_void_p]
+        lib.trie_lookup_batch.restype = None
+        lib.trie_set_counters.argtypes = [c_void_p, c_int]
+        lib.trie_set_counters.restype = c_int
+        lib.trie_get_counters.argtypes = [c_void_p, POINTER(TrieCounters)]
+        lib.trie_get_counters.restype = None
+        lib.trie_reset_counters.argtypes = [c_void_p]
+        lib.trie_reset_counters.restype = None
+        lib.trie_handle_open.argtypes = [c_char_p, c_uint, c_uint]
+        lib.trie_handle_open.restype = c_void_p
+        lib.trie_handle_acquire.argtypes = [c_void_p]
+        lib.trie_handle_acquire.restype = c_void_p
+        lib.trie_handle_release.argtypes = [c_void_p]
+        lib.trie_handle_release.restype = None
+        lib.trie_handle_reload.argtypes = [c_void_p, c_char_p]
+        lib.trie_handle_reload.restype = c_int
+        lib.trie_handle_close.argtypes = [c_void_p]
+        lib.trie_handle_close.restype = None
+        lib.trie_iter_prefix.argtypes = [c_void_p, c_char_p, c_size_t,
+                                         c_char_p, c_size_t]
+        lib.trie_iter_prefix.restype = c_void_p
+        lib.trie_iter_next.argtypes = [c_void_p, POINTER(c_char_p),
+                                       POINTER(c_size_t),
+                                       POINTER(POINTER(TrieValue)),
+                                       POINTER(c_size_t)]
+        lib.trie_iter_next.restype = c_int
+        lib.trie_iter_free.argtypes = [c_void_p]
+        lib.trie_iter_free.restype = None
+        lib.trie_common_prefix_search.argtypes = [c_void_p, c_char_p, c_size_t,
+                                                  MATCH_CALLBACK, c_void_p]
+        lib.trie_common_prefix_search.restype = c_ssize_t
+        lib.trie_longest_prefix.argtypes = [c_void_p, c_char_p, c_size_t,
+                                            POINTER(c_size_t),
+                                            POINTER(TrieValue), c_size_t,
+                                            c_char_p, c_size_t]
+        lib.trie_longest_prefix.restype = c_ssize_t
+        lib.trie_segment.argtypes = [c_void_p, c_char_p, c_size_t,
+                                     MATCH_CALLBACK, c_void_p]
+        lib.trie_segment.restype = c_ssize_t
+        lib.trie_lookup_id.argtypes = [c_void_p, c_char_p, c_size_t]
+        lib.trie_lookup_id.restype = c_ssize_t
+        lib.trie_key_by_id.argtypes = [c_void_p, c_size_t, c_char_p, c_size_t]
+        lib.trie_key_by_id.restype = c_ssize_t
+        lib.trie_count_prefix.argtypes = [c_void_p, c_char_p, c_size_t]
+        lib.trie_count_prefix.restype = c_ssize_t
+        LIBTRIE = lib
+    return LIBTRIE
+
+
+# Flags for loading the trie, see TRIE_LOAD_* in trie.h.
+LOAD_POPULATE = 1 << 0
+LOAD_LOCK = 1 << 1
+LOAD_RANDOM = 1 << 2
+LOAD_WILLNEED = 1 << 3
+LOAD_HUGEPAGES = 1 << 4
+
+
+class CtypesTrie(object):
     """
     Trie class encapsulates the underlying trie structure. It is created from
     file and only provides means to query a key. There are no modifications
     possible.
+
+    The file is loaded into a `TrieHandle`, because the library functions run
+    without the GIL and `reload` may replace the trie while other threads are
+    looking up keys. Each method acquires the trie for as long as it uses it.
     """
 
-    def __init__(self, filename, encoding='utf8'):
+    def __init__(self, filename, encoding='utf8', flags=0, prewarm=0):
         """
         Create new trie from given file. The optional `encoding` parameter
         specifies how to encode keys before looking them pu.
+
+        The `flags` are a combination of `LOAD_*` constants that control how
+        the file is brought into memory. If `prewarm` is positive, that many
+        top levels of the trie are read right away.
         """
+        _load_library()
         self.encoding = encoding
-        self.free_func = LIBTRIE.trie_free
-        self.ptr = LIBTRIE.trie_load(filename)
-        if not self.ptr:
+        self.scratch = threading.local()
+        self.close_func = LIBTRIE.trie_handle_close
+        if not isinstance(filename, bytes):
+            filename = filename.encode(sys.getfilesystemencoding())
+        self.handle = LIBTRIE.trie_handle_open(filename, flags, prewarm)
+        if not self.handle:
             err = LIBTRIE.trie_get_last_error()
-            raise IOError(str(err))
+            raise IOError(err.decode('utf8'))
 
     def __del__(self):
-        if self and self.ptr:
-            self.free_func(self.ptr)
+        if self and getattr(self, 'handle', None):
+            self.close_func(self.handle)
+
+    def _acquire(self):
+        ptr = LIBTRIE.trie_handle_acquire(self.handle)
+        if not ptr:
+            raise MemoryError()
+        return ptr
+
+    def _release(self):
+        LIBTRIE.trie_handle_release(self.handle)
+
+    def _scratch(self):
+        """
+        Return the buffers of the calling thread for values and decoded
+        bytes. The library fills them without the GIL, so each thread needs
+        its own.
+        """
+        scratch = self.scratch
+        if not hasattr(scratch, 'buffer'):
+            scratch.buffer = create_string_buffer(1024)
+            scratch.values = (TrieValue * 16)()
+        return scratch
+
+    def _lookup_bytes(self, key, prefix_len=None):
+        """
+        Return list of raw values of `key`, or None if it is missing. With
+        `prefix_len`, the longest key that is a prefix of `key` is looked up
+        and its length is stored in it.
+        """
+        if not isinstance(key, bytes):
+            key = key.encode(self.encoding)
+        scratch = self._scratch()
+        ptr = self._acquire()
+        try:
+            while True:
+                if prefix_len is None:
+                    res = LIBTRIE.trie_lookup_values(
+                        ptr, key, len(key), scratch.values,
+                        len(scratch.values), scratch.buffer,
+                        len(scratch.buffer))
+                else:
+                    res = LIBTRIE.trie_longest_prefix(
+                        ptr, key, len(key), byref(prefix_len), scratch.values,
+                        len(scratch.values), scratch.buffer,
+                        len(scratch.buffer))
+                if res < 0:
+                    return None
+                if res > len(scratch.values):
+                    scratch.values = (TrieValue * res)()
+                    continue
+                values = scratch.values[:res]
+                missing = sum(v.len for v in values if v.data is None and v.len)
+                if not missing:
+                    break
+                scratch.buffer = create_string_buffer(len(scratch.buffer)
+                                                      + missing)
+            return [string_at(v.data, v.len) if v.len else b'' for v in values]
+        finally:
+            self._release()
 
     def lookup(self, key):
         """
@@ -54,13 +234,260 @@ class Trie(object):
 
         The key should be a unicode object.
         """
-        res = LIBTRIE.trie_lookup(self.ptr, key.encode(self.encoding))
-        if res:
-            result = cast(res, c_char_p).value.decode(self.encoding)
-            LIBTRIE.trie_result_free(self.ptr, res)
-            return [s for s in result.split('\n')]
-        else:
-            return []
+        return [v.decode(self.encoding) for v in self._lookup_bytes(key) or []]
+
+    def lookup_views(self, key):
+        """
+        Return values of `key` as a list of memoryviews. This implementation
+        always copies the values.
+        """
+        return [memoryview(v) for v in self._lookup_bytes(key) or []]
+
+    def _decode_result(self, ptr, res):
+        result = cast(res, c_char_p).value.decode(self.encoding)
+        LIBTRIE.trie_result_free(ptr, res)
+        return result.split('\n')
+
+    def lookup_many(self, keys):
+        """
+        Look up all keys from the `keys` list at once. This is faster than
+        calling `lookup` in a loop, as the lookups can overlap. Returns a list
+        with one result (as returned by `lookup`) for each key.
+
+        The values are joined by newlines in the library, so unlike with
+        `lookup`, values containing a newline are split.
+        """
+        encoded = [key if isinstance(key, bytes) else key.encode(self.encoding)
+                   for key in keys]
+        num = len(encoded)
+        c_keys = (c_char_p * num)(*encoded)
+        c_results = (c_void_p * num)()
+        ptr = self._acquire()
+        try:
+            LIBTRIE.trie_lookup_batch(ptr, c_keys, num, c_results)
+            return [self._decode_result(ptr, res) if res else []
+                    for res in c_results]
+        finally:
+            self._release()
+
+    # Number of keys read from the library while the trie is acquired.
+    ITER_BATCH = 64
+
+    def _iter_batch(self, prefix, after, count):
+        """Return up to `count` raw keys and values after the key `after`."""
+        ptr = self._acquire()
+        try:
+            it = LIBTRIE.trie_iter_prefix(ptr, prefix, len(prefix), after,
+                                          len(after or b''))
+            if not it:
+                raise MemoryError()
+            key, key_len = c_char_p(), c_size_t()
+            values, num_values = POINTER(TrieValue)(), c_size_t()
+            batch = []
+            try:
+                while len(batch) < count:
+                    res = LIBTRIE.trie_iter_next(it, byref(key), byref(key_len),
+                                                 byref(values),
+                                                 byref(num_values))
+                    if res < 0:
+                        raise MemoryError()
+                    if res == 0:
+                        break
+                    raw = [string_at(v.data, v.len) if v.len else b''
+                           for v in values[:num_values.value]]
+                    batch.append((string_at(key, key_len.value), raw))
+            finally:
+                LIBTRIE.trie_iter_free(it)
+            return batch
+        finally:
+            self._release()
+
+    def iter_prefix(self, prefix, limit=None, after=None):
+        """
+        Iterate over the keys starting with `prefix` in sorted order. Each
+        item is a `(key, values)` tuple, with values as returned by `lookup`.
+        At most `limit` keys are returned. To continue later, pass the last
+        returned key as `after`.
+
+        The keys are read in batches, each one continuing after the last key
+        of the previous one, so a `reload` may happen between them.
+        """
+        if limit is not None and limit < 0:
+            raise ValueError('limit must not be negative')
+        if not isinstance(prefix, bytes):
+            prefix = prefix.encode(self.encoding)
+        if after is not None and not isinstance(after, bytes):
+            after = after.encode(self.encoding)
+        left = limit
+        while left is None or left > 0:
+            count = self.ITER_BATCH if left is None else min(left,
+                                                             self.ITER_BATCH)
+            batch = self._iter_batch(prefix, after, count)
+            for key, values in batch:
+                yield (key.decode(self.encoding),
+                       [v.decode(self.encoding) for v in values])
+            if len(batch) < count:
+                break
+            after = batch[-1][0]
+            if left is not None:
+                left -= len(batch)
+
+    def _find_matches(self, search, key):
+        """
+        Call `search` (`trie_common_prefix_search` or `trie_segment`) and
+        return the list of parts with their values.
+        """
+        if not isinstance(key, bytes):
+            key = key.encode(self.encoding)
+        parts = []
+
+        def append(offset, length, values, num_values, arg):
+            found = None
+            if num_values >= 0:
+                found = [string_at(v.data, v.len) if v.len else b''
+                         for v in values[:num_values]]
+                found = [v.decode(self.encoding) for v in found]
+            parts.append((key[offset:offset + length].decode(self.encoding),
+                          found))
+            return 0
+
+        ptr = self._acquire()
+        try:
+            if search(ptr, key, len(key), MATCH_CALLBACK(append), None) < 0:
+                raise MemoryError()
+        finally:
+            self._release()
+        return parts
+
+    def common_prefixes(self, key):
+        """
+        Return a list of `(prefix, values)` tuples for all keys that `key`
+        starts with, shortest first, with values as returned by `lookup`.
+        """
+        return self._find_matches(LIBTRIE.trie_common_prefix_search, key)
+
+    def longest_prefix(self, key):
+        """
+        Return a `(prefix, values)` tuple for the longest key that `key`
+        starts with, or None if there is no such key.
+        """
+        if not isinstance(key, bytes):
+            key = key.encode(self.encoding)
+        prefix_len = c_size_t()
+        values = self._lookup_bytes(key, prefix_len)
+        if values is None:
+            return None
+        return (key[:prefix_len.value].decode(self.encoding),
+                [v.decode(self.encoding) for v in values])
+
+    def segment(self, text):
+        """
+        Split `text` into keys, always taking the longest key at the current
+        position. Returns a list of `(part, values)` tuples. Parts of the text
+        where no key starts have None as values.
+        """
+        return self._find_matches(LIBTRIE.trie_segment, text)
+
+    def _numbered(self):
+        """Acquire the trie and check that its keys are numbered."""
+        ptr = self._acquire()
+        if LIBTRIE.trie_count_prefix(ptr, b'', 0) < 0:
+            self._release()
+            raise ValueError('trie has no key counts, compile it with -k')
+        return ptr
+
+    def lookup_id(self, key):
+        """
+        Return the number of `key` in sorted order of all keys, or None if it
+        is missing. The trie must be compiled with `-k`.
+        """
+        if not isinstance(key, bytes):
+            key = key.encode(self.encoding)
+        ptr = self._numbered()
+        try:
+            res = LIBTRIE.trie_lookup_id(ptr, key, len(key))
+        finally:
+            self._release()
+        return res if res >= 0 else None
+
+    def key_by_id(self, number):
+        """
+        Return the key with a number returned by `lookup_id`. Raises
+        IndexError if there is no such key.
+        """
+        scratch = self._scratch()
+        ptr = self._numbered()
+        try:
+            res = -1
+            if number >= 0:
+                res = LIBTRIE.trie_key_by_id(ptr, number, scratch.buffer,
+                                             len(scratch.buffer))
+            if res >= len(scratch.buffer):
+                scratch.buffer = create_string_buffer(res + 1)
+                LIBTRIE.trie_key_by_id(ptr, number, scratch.buffer,
+                                       len(scratch.buffer))
+        finally:
+            self._release()
+        if res < 0:
+            raise IndexError('key number out of range')
+        return scratch.buffer.raw[:res].decode(self.encoding)
+
+    def count_prefix(self, prefix):
+        """Return the number of keys starting with `prefix`."""
+        if not isinstance(prefix, bytes):
+            prefix = prefix.encode(self.encoding)
+        ptr = self._numbered()
+        try:
+            return LIBTRIE.trie_count_prefix(ptr, prefix, len(prefix))
+        finally:
+            self._release()
+
+    def set_counters(self, enabled=True):
+        """Start or stop counting what the lookups do."""
+        ptr = self._acquire()
+        try:
+            if LIBTRIE.trie_set_counters(ptr, int(enabled)) < 0:
+                raise MemoryError()
+        finally:
+            self._release()
+
+    def counters(self):
+        """
+        Return a dict with the lookup counters summed over all threads. The
+        'latency' item is a list, item i is the number of lookups that took
+        at least 2**i and less than 2**(i+1) nanoseconds.
+        """
+        res = TrieCounters()
+        ptr = self._acquire()
+        LIBTRIE.trie_get_counters(ptr, byref(res))
+        self._release()
+        counters = dict((name, getattr(res, name)) for name in _COUNTER_NAMES)
+        counters['latency'] = list(res.latency)
+        return counters
+
+    def reset_counters(self):
+        """Set all counters back to zero."""
+        ptr = self._acquire()
+        LIBTRIE.trie_reset_counters(ptr)
+        self._release()
+
+    def reload(self, filename=None):
+        """
+        Load the file again, or another file, and use it for all following
+        lookups. Other threads keep using the old trie until their lookups
+        finish, then it is unmapped.
+        """
+        if filename is not None and not isinstance(filename, bytes):
+            filename = filename.encode(sys.getfilesystemencoding())
+        if LIBTRIE.trie_handle_reload(self.handle, filename) < 0:
+            err = LIBTRIE.trie_get_last_error()
+            raise IOError(err.decode('utf8'))
+
+
+try:
+    from libtrie._libtrie import Trie
+except ImportError:
+    Trie = CtypesTrie
 
 
 def test_main():
@@ -68,19 +495,20 @@ def test_main():
     This function creates a storage backed by a file and tests it by retrieving
     a couple of records.
     """
-    import sys
     if len(sys.argv) != 2:
         sys.stderr.write('Need one command line argument - trie file\n')
         sys.exit(1)
     t = Trie(sys.argv[1])
 
-    for name in sys.stdin:
+    stdin = getattr(sys.stdin, 'buffer', sys.stdin)
+    stdout = getattr(sys.stdout, 'buffer', sys.stdout)
+    for name in stdin:
         name = name.strip().decode('utf8')
         res = t.lookup(name)
         if res:
-            print '\n'.join(res).encode('utf8')
+            stdout.write('\n'.join(res).encode('utf8') + b'\n')
         else:
-            print 'Not found'
+            stdout.write(b'Not found\n')
 
 if __name__ == '__main__':
     test_main()
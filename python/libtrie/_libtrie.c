@@ -0,0 +1,1030 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "trie.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Compiled implementation of the `libtrie.Trie` class. It has the same
+ * interface as the ctypes version in `__init__.py`, which is used when this
+ * module is not available.
+ */
+
+#if PY_MAJOR_VERSION < 3
+# define BUFFER_FLAGS (Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER)
+#else
+# define BUFFER_FLAGS Py_TPFLAGS_DEFAULT
+#endif
+
+/**
+ * Space for values of a single lookup. It grows until all values fit.
+ */
+typedef struct {
+    TrieValue *values;
+    size_t max_values;
+    char *buf;
+    size_t buf_len;
+} Scratch;
+
+/**
+ * One loaded version of the file. `Trie.reload()` replaces the mapping of the
+ * object, and the old one is freed when the last lookup or memoryview using
+ * it drops its reference.
+ */
+typedef struct {
+    PyObject_HEAD
+    Trie *trie;
+} MappingObject;
+
+typedef struct {
+    PyObject_HEAD
+    MappingObject *mapping;
+    char *encoding;
+    char *filename;     /**< File loaded last, for `reload()`. */
+    unsigned flags;
+    unsigned prewarm;
+    bool counting;      /**< Whether counters were enabled. */
+    Scratch scratch;    /**< Used by lookups holding the GIL. */
+} TrieObject;
+
+/**
+ * Read only buffer pointing to a value in the mapped file. It keeps the
+ * mapping alive while a memoryview of it exists.
+ */
+typedef struct {
+    PyObject_HEAD
+    PyObject *owner;
+    const char *data;
+    Py_ssize_t len;
+} ValueObject;
+
+/**
+ * Generator returned by `Trie.iter_prefix()`. It keeps the mapping it started
+ * with, so a reload does not disturb it.
+ */
+typedef struct {
+    PyObject_HEAD
+    TrieObject *owner;          /**< For the encoding. */
+    MappingObject *mapping;
+    TrieIter *iter;
+    Py_ssize_t left;            /**< Keys left to return, -1 for all. */
+} PrefixIterObject;
+
+static void scratch_free(Scratch *s)
+{
+    free(s->values);
+    free(s->buf);
+    memset(s, 0, sizeof *s);
+}
+
+/**
+ * Look up all values of a key, growing the scratch space as needed. Does not
+ * touch any Python objects, so it can run without the GIL.
+ *
+ * @param prefix_len    if not NULL, the longest key that is a prefix of `key`
+ *                      is looked up instead and its length is stored here
+ * @return  number of values, -1 if the key is missing, -2 on allocation failure
+ */
+static ssize_t
+find_values(Trie *trie, const char *key, size_t key_len, size_t *prefix_len,
+            Scratch *s)
+{
+    for (;;) {
+        ssize_t n = prefix_len
+            ? trie_longest_prefix(trie, key, key_len, prefix_len, s->values,
+                                  s->max_values, s->buf, s->buf_len)
+            : trie_lookup_values(trie, key, key_len, s->values,
+                                 s->max_values, s->buf, s->buf_len);
+        if (n < 0) {
+            return -1;
+        }
+        if ((size_t) n > s->max_values) {
+            TrieValue *values = realloc(s->values, n * sizeof *values);
+            if (!values) {
+                return -2;
+            }
+            s->values = values;
+            s->max_values = n;
+            continue;
+        }
+        size_t total = 0;
+        bool missing = false;
+        for (ssize_t i = 0; i < n; ++i) {
+            total += s->values[i].len;
+            missing = missing || (s->values[i].data == NULL && s->values[i].len > 0);
+        }
+        if (!missing) {
+            return n;
+        }
+        /* Everything fits when the buffer is as long as all values. */
+        char *buf = realloc(s->buf, total);
+        if (!buf) {
+            return -2;
+        }
+        s->buf = buf;
+        s->buf_len = total;
+    }
+}
+
+/**
+ * Get bytes of a key. Unicode keys are encoded with the encoding of the trie.
+ *
+ * @return  new reference to a bytes object or NULL with exception set
+ */
+static PyObject * encode_key(TrieObject *self, PyObject *key)
+{
+    if (PyBytes_Check(key)) {
+        Py_INCREF(key);
+        return key;
+    }
+    return PyUnicode_AsEncodedString(key, self->encoding, "strict");
+}
+
+static PyObject *
+values_to_list(TrieObject *self, const TrieValue *values, ssize_t n)
+{
+    PyObject *list = PyList_New(n < 0 ? 0 : n);
+    for (ssize_t i = 0; list && i < n; ++i) {
+        PyObject *item = PyUnicode_Decode(values[i].data, values[i].len,
+                                          self->encoding, "strict");
+        if (!item) {
+            Py_CLEAR(list);
+            break;
+        }
+        PyList_SET_ITEM(list, i, item);
+    }
+    return list;
+}
+
+static PyTypeObject MappingType;
+
+/**
+ * Load and prewarm a file without holding the GIL.
+ *
+ * @return  new mapping or NULL with exception set
+ */
+static MappingObject *
+load_mapping(const char *filename, unsigned flags, unsigned prewarm)
+{
+    Trie *trie;
+    Py_BEGIN_ALLOW_THREADS
+    trie = trie_load_ex(filename, flags);
+    if (trie && prewarm > 0) {
+        trie_prewarm(trie, prewarm);
+    }
+    Py_END_ALLOW_THREADS
+    if (!trie) {
+        PyErr_SetString(PyExc_IOError, trie_get_last_error());
+        return NULL;
+    }
+    MappingObject *mapping = PyObject_New(MappingObject, &MappingType);
+    if (!mapping) {
+        trie_free(trie);
+        return NULL;
+    }
+    mapping->trie = trie;
+    return mapping;
+}
+
+static int
+Trie_init(TrieObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = { "filename", "encoding", "flags", "prewarm", NULL };
+    const char *encoding = "utf8";
+    unsigned flags = 0;
+    unsigned prewarm = 0;
+#if PY_MAJOR_VERSION < 3
+    const char *filename;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|sII", kwlist,
+                                     &filename, &encoding, &flags, &prewarm)) {
+        return -1;
+    }
+#else
+    PyObject *path;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O&|sII", kwlist,
+                                     PyUnicode_FSConverter, &path, &encoding,
+                                     &flags, &prewarm)) {
+        return -1;
+    }
+    const char *filename = PyBytes_AS_STRING(path);
+#endif
+
+    Py_CLEAR(self->mapping);
+    free(self->encoding);
+    free(self->filename);
+    self->encoding = strdup(encoding);
+    self->filename = strdup(filename);
+    self->flags = flags;
+    self->prewarm = prewarm;
+    self->counting = false;
+    self->mapping = load_mapping(filename, flags, prewarm);
+#if PY_MAJOR_VERSION >= 3
+    Py_DECREF(path);
+#endif
+    return self->mapping ? 0 : -1;
+}
+
+static void
+Trie_dealloc(TrieObject *self)
+{
+    Py_XDECREF(self->mapping);
+    free(self->encoding);
+    free(self->filename);
+    scratch_free(&self->scratch);
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyObject *
+Trie_reload(TrieObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = { "filename", NULL };
+#if PY_MAJOR_VERSION < 3
+    const char *filename = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|z:reload", kwlist,
+                                     &filename)) {
+        return NULL;
+    }
+#else
+    PyObject *path = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O&:reload", kwlist,
+                                     PyUnicode_FSConverter, &path)) {
+        return NULL;
+    }
+    const char *filename = path ? PyBytes_AS_STRING(path) : NULL;
+#endif
+    if (!self->mapping) {
+        PyErr_SetString(PyExc_ValueError, "trie is not loaded");
+        return NULL;
+    }
+    char *name = strdup(filename ? filename : self->filename);
+#if PY_MAJOR_VERSION >= 3
+    Py_XDECREF(path);
+#endif
+    if (!name) {
+        return PyErr_NoMemory();
+    }
+    MappingObject *mapping = load_mapping(name, self->flags, self->prewarm);
+    if (!mapping) {
+        free(name);
+        return NULL;
+    }
+    if (self->counting) {
+        trie_set_counters(mapping->trie, 1);
+    }
+    free(self->filename);
+    self->filename = name;
+    MappingObject *old = self->mapping;
+    self->mapping = mapping;
+    Py_DECREF(old);
+    Py_RETURN_NONE;
+}
+
+/**
+ * Find values of a key in the scratch space of the object.
+ *
+ * @return  number of values, -1 if missing or -2 with exception set
+ */
+static ssize_t lookup_key(TrieObject *self, PyObject *key)
+{
+    if (!self->mapping) {
+        PyErr_SetString(PyExc_ValueError, "trie is not loaded");
+        return -2;
+    }
+    PyObject *bytes = encode_key(self, key);
+    if (!bytes) {
+        return -2;
+    }
+    ssize_t n = find_values(self->mapping->trie, PyBytes_AS_STRING(bytes),
+                            PyBytes_GET_SIZE(bytes), NULL, &self->scratch);
+    Py_DECREF(bytes);
+    if (n == -2) {
+        PyErr_NoMemory();
+    }
+    return n;
+}
+
+static PyObject *
+Trie_lookup(TrieObject *self, PyObject *key)
+{
+    ssize_t n = lookup_key(self, key);
+    if (n == -2) {
+        return NULL;
+    }
+    return values_to_list(self, self->scratch.values, n);
+}
+
+static PyTypeObject ValueType;
+
+static PyObject *
+Trie_lookup_views(TrieObject *self, PyObject *key)
+{
+    ssize_t n = lookup_key(self, key);
+    if (n == -2) {
+        return NULL;
+    }
+    PyObject *list = PyList_New(n < 0 ? 0 : n);
+    const char *buf = self->scratch.buf;
+    for (ssize_t i = 0; list && i < n; ++i) {
+        const TrieValue *v = self->scratch.values + i;
+        PyObject *target;
+        if (buf && v->data >= buf && v->data < buf + self->scratch.buf_len) {
+            /* Decoded values live in the scratch buffer and must be copied. */
+            target = PyBytes_FromStringAndSize(v->data, v->len);
+        } else {
+            ValueObject *value = PyObject_New(ValueObject, &ValueType);
+            if (value) {
+                Py_INCREF(self->mapping);
+                value->owner = (PyObject *) self->mapping;
+                value->data = v->data;
+                value->len = v->len;
+            }
+            target = (PyObject *) value;
+        }
+        PyObject *view = target ? PyMemoryView_FromObject(target) : NULL;
+        Py_XDECREF(target);
+        if (!view) {
+            Py_CLEAR(list);
+            break;
+        }
+        PyList_SET_ITEM(list, i, view);
+    }
+    return list;
+}
+
+/**
+ * Position of a value found by `lookup_many()`. Values pointing into the
+ * mapped file are kept as pointers, decoded values are copied to a shared
+ * buffer that may still move, so they are remembered by offset.
+ */
+typedef struct {
+    const char *ptr;    /**< Value in the file or NULL if copied. */
+    size_t offset;      /**< Position in the shared buffer. */
+    size_t len;
+} FoundValue;
+
+typedef struct {
+    ssize_t *counts;        /**< Number of values of each key. */
+    FoundValue *found;
+    size_t found_len;
+    size_t found_cap;
+    char *copied;
+    size_t copied_len;
+    size_t copied_cap;
+} BatchResult;
+
+static bool
+grow(void **array, size_t *cap, size_t needed, size_t item)
+{
+    if (needed <= *cap) {
+        return true;
+    }
+    size_t new_cap = *cap ? *cap : 64;
+    while (new_cap < needed) {
+        new_cap *= 2;
+    }
+    void *tmp = realloc(*array, new_cap * item);
+    if (!tmp) {
+        return false;
+    }
+    *array = tmp;
+    *cap = new_cap;
+    return true;
+}
+
+/**
+ * Look up all keys. Runs without the GIL.
+ *
+ * @return  false on allocation failure
+ */
+static bool
+batch_lookup(Trie *trie, const char **keys, const size_t *lens, size_t n,
+             BatchResult *res)
+{
+    Scratch s = { NULL, 0, NULL, 0 };
+    bool ok = true;
+    for (size_t i = 0; ok && i < n; ++i) {
+        ssize_t count = find_values(trie, keys[i], lens[i], NULL, &s);
+        res->counts[i] = count;
+        if (count == -2) {
+            ok = false;
+            break;
+        }
+        if (count < 0) {
+            continue;
+        }
+        ok = grow((void **) &res->found, &res->found_cap,
+                  res->found_len + count, sizeof *res->found);
+        for (ssize_t j = 0; ok && j < count; ++j) {
+            const TrieValue *v = s.values + j;
+            FoundValue *f = res->found + res->found_len++;
+            f->len = v->len;
+            f->ptr = v->data;
+            if (s.buf && v->data >= s.buf && v->data < s.buf + s.buf_len) {
+                ok = grow((void **) &res->copied, &res->copied_cap,
+                          res->copied_len + v->len, 1);
+                if (ok) {
+                    memcpy(res->copied + res->copied_len, v->data, v->len);
+                    f->ptr = NULL;
+                    f->offset = res->copied_len;
+                    res->copied_len += v->len;
+                }
+            }
+        }
+    }
+    scratch_free(&s);
+    return ok;
+}
+
+static PyObject *
+Trie_lookup_many(TrieObject *self, PyObject *iterable)
+{
+    if (!self->mapping) {
+        PyErr_SetString(PyExc_ValueError, "trie is not loaded");
+        return NULL;
+    }
+    /* Another thread may reload the trie while this one runs without the
+     * GIL, the reference keeps the found values valid. */
+    MappingObject *mapping = self->mapping;
+    Py_INCREF(mapping);
+    PyObject *seq = PySequence_Fast(iterable, "expected an iterable of keys");
+    if (!seq) {
+        Py_DECREF(mapping);
+        return NULL;
+    }
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    PyObject *encoded = PyList_New(n);
+    const char **keys = PyMem_Malloc((n + 1) * sizeof *keys);
+    size_t *lens = PyMem_Malloc((n + 1) * sizeof *lens);
+    BatchResult res = { .counts = PyMem_Malloc((n + 1) * sizeof *res.counts) };
+    PyObject *result = NULL;
+    if (!encoded || !keys || !lens || !res.counts) {
+        PyErr_NoMemory();
+        goto out;
+    }
+
+    for (Py_ssize_t i = 0; i < n; ++i) {
+        PyObject *bytes = encode_key(self, PySequence_Fast_GET_ITEM(seq, i));
+        if (!bytes) {
+            goto out;
+        }
+        PyList_SET_ITEM(encoded, i, bytes);
+        keys[i] = PyBytes_AS_STRING(bytes);
+        lens[i] = PyBytes_GET_SIZE(bytes);
+    }
+
+    bool ok;
+    Py_BEGIN_ALLOW_THREADS
+    ok = batch_lookup(mapping->trie, keys, lens, n, &res);
+    Py_END_ALLOW_THREADS
+    if (!ok) {
+        PyErr_NoMemory();
+        goto out;
+    }
+
+    result = PyList_New(n);
+    const FoundValue *f = res.found;
+    for (Py_ssize_t i = 0; result && i < n; ++i) {
+        PyObject *list = PyList_New(res.counts[i] < 0 ? 0 : res.counts[i]);
+        for (ssize_t j = 0; list && j < res.counts[i]; ++j, ++f) {
+            const char *data = f->ptr ? f->ptr : res.copied + f->offset;
+            PyObject *item = PyUnicode_Decode(data, f->len, self->encoding,
+                                              "strict");
+            if (!item) {
+                Py_CLEAR(list);
+                break;
+            }
+            PyList_SET_ITEM(list, j, item);
+        }
+        if (!list) {
+            Py_CLEAR(result);
+            break;
+        }
+        PyList_SET_ITEM(result, i, list);
+    }
+
+out:
+    free(res.found);
+    free(res.copied);
+    PyMem_Free(res.counts);
+    PyMem_Free(lens);
+    PyMem_Free(keys);
+    Py_XDECREF(encoded);
+    Py_DECREF(seq);
+    Py_DECREF(mapping);
+    return result;
+}
+
+static PyObject *
+Trie_set_counters(TrieObject *self, PyObject *args)
+{
+    int enabled = 1;
+    if (!PyArg_ParseTuple(args, "|i:set_counters", &enabled)) {
+        return NULL;
+    }
+    if (!self->mapping) {
+        PyErr_SetString(PyExc_ValueError, "trie is not loaded");
+        return NULL;
+    }
+    if (trie_set_counters(self->mapping->trie, enabled) < 0) {
+        return PyErr_NoMemory();
+    }
+    self->counting = enabled;
+    Py_RETURN_NONE;
+}
+
+static bool
+set_item(PyObject *dict, const char *name, PyObject *value)
+{
+    bool ok = value && PyDict_SetItemString(dict, name, value) == 0;
+    Py_XDECREF(value);
+    return ok;
+}
+
+static PyObject *
+Trie_counters(TrieObject *self, PyObject *unused)
+{
+    (void) unused;
+    if (!self->mapping) {
+        PyErr_SetString(PyExc_ValueError, "trie is not loaded");
+        return NULL;
+    }
+    TrieCounters c;
+    trie_get_counters(self->mapping->trie, &c);
+
+    PyObject *dict = PyDict_New();
+    PyObject *latency = PyList_New(TRIE_LATENCY_BUCKETS);
+    bool ok = dict && latency;
+    for (unsigned i = 0; ok && i < TRIE_LATENCY_BUCKETS; ++i) {
+        PyObject *item = PyLong_FromUnsignedLongLong(c.latency[i]);
+        ok = item != NULL;
+        if (ok) {
+            PyList_SET_ITEM(latency, i, item);
+        }
+    }
+    ok = ok && set_item(dict, "lookups", PyLong_FromUnsignedLongLong(c.lookups))
+        && set_item(dict, "hits", PyLong_FromUnsignedLongLong(c.hits))
+        && set_item(dict, "misses", PyLong_FromUnsignedLongLong(c.misses))
+        && set_item(dict, "nodes", PyLong_FromUnsignedLongLong(c.nodes))
+        && set_item(dict, "chunks", PyLong_FromUnsignedLongLong(c.chunks))
+        && set_item(dict, "decoded_bytes",
+                    PyLong_FromUnsignedLongLong(c.decoded_bytes))
+        && set_item(dict, "allocations",
+                    PyLong_FromUnsignedLongLong(c.allocations));
+    if (ok) {
+        ok = PyDict_SetItemString(dict, "latency", latency) == 0;
+    }
+    Py_XDECREF(latency);
+    if (!ok) {
+        Py_XDECREF(dict);
+        return NULL;
+    }
+    return dict;
+}
+
+static PyObject *
+Trie_reset_counters(TrieObject *self, PyObject *unused)
+{
+    (void) unused;
+    if (!self->mapping) {
+        PyErr_SetString(PyExc_ValueError, "trie is not loaded");
+        return NULL;
+    }
+    trie_reset_counters(self->mapping->trie);
+    Py_RETURN_NONE;
+}
+
+/**
+ * Parts of an input collected by `Trie.common_prefixes()` and
+ * `Trie.segment()`.
+ */
+typedef struct {
+    TrieObject *self;
+    const char *input;
+    PyObject *list;
+} MatchList;
+
+/**
+ * Append a part of the input with its values, or None for parts that are not
+ * keys, to the list.
+ */
+static int
+append_match(size_t offset, size_t len, const TrieValue *values,
+             ssize_t num_values, void *arg)
+{
+    MatchList *m = arg;
+    PyObject *part = PyUnicode_Decode(m->input + offset, len,
+                                      m->self->encoding, "strict");
+    PyObject *found = Py_None;
+    if (num_values < 0) {
+        Py_INCREF(found);
+    } else {
+        found = values_to_list(m->self, values, num_values);
+    }
+    PyObject *item = part && found ? PyTuple_Pack(2, part, found) : NULL;
+    Py_XDECREF(part);
+    Py_XDECREF(found);
+    if (!item || PyList_Append(m->list, item) < 0) {
+        Py_XDECREF(item);
+        Py_CLEAR(m->list);
+        return 1;
+    }
+    Py_DECREF(item);
+    return 0;
+}
+
+/**
+ * Call `trie_common_prefix_search()` or `trie_segment()` on the encoded input
+ * and collect the parts into a list.
+ */
+static PyObject *
+find_matches(TrieObject *self, PyObject *input,
+             ssize_t (*search)(Trie *, const char *, size_t,
+                               TrieMatchCallback, void *))
+{
+    if (!self->mapping) {
+        PyErr_SetString(PyExc_ValueError, "trie is not loaded");
+        return NULL;
+    }
+    PyObject *bytes = encode_key(self, input);
+    if (!bytes) {
+        return NULL;
+    }
+    MatchList m = { self, PyBytes_AS_STRING(bytes), PyList_New(0) };
+    if (m.list && search(self->mapping->trie, m.input, PyBytes_GET_SIZE(bytes),
+                         append_match, &m) < 0 && m.list) {
+        Py_CLEAR(m.list);
+        PyErr_NoMemory();
+    }
+    Py_DECREF(bytes);
+    return m.list;
+}
+
+static PyObject *
+Trie_common_prefixes(TrieObject *self, PyObject *key)
+{
+    return find_matches(self, key, trie_common_prefix_search);
+}
+
+static PyObject *
+Trie_segment(TrieObject *self, PyObject *text)
+{
+    return find_matches(self, text, trie_segment);
+}
+
+static PyObject *
+Trie_longest_prefix(TrieObject *self, PyObject *key)
+{
+    if (!self->mapping) {
+        PyErr_SetString(PyExc_ValueError, "trie is not loaded");
+        return NULL;
+    }
+    PyObject *bytes = encode_key(self, key);
+    if (!bytes) {
+        return NULL;
+    }
+    size_t len;
+    ssize_t n = find_values(self->mapping->trie, PyBytes_AS_STRING(bytes),
+                            PyBytes_GET_SIZE(bytes), &len, &self->scratch);
+    PyObject *result = NULL;
+    if (n == -2) {
+        PyErr_NoMemory();
+    } else if (n == -1) {
+        Py_INCREF(Py_None);
+        result = Py_None;
+    } else {
+        PyObject *prefix = PyUnicode_Decode(PyBytes_AS_STRING(bytes), len,
+                                            self->encoding, "strict");
+        PyObject *list = prefix ? values_to_list(self, self->scratch.values, n)
+                                : NULL;
+        result = list ? PyTuple_Pack(2, prefix, list) : NULL;
+        Py_XDECREF(prefix);
+        Py_XDECREF(list);
+    }
+    Py_DECREF(bytes);
+    return result;
+}
+
+/**
+ * Check that the keys of the trie are numbered.
+ *
+ * @return  the trie or NULL with exception set
+ */
+static Trie * numbered_trie(TrieObject *self)
+{
+    if (!self->mapping) {
+        PyErr_SetString(PyExc_ValueError, "trie is not loaded");
+        return NULL;
+    }
+    if (trie_count_prefix(self->mapping->trie, "", 0) < 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "trie has no key counts, compile it with -k");
+        return NULL;
+    }
+    return self->mapping->trie;
+}
+
+static PyObject *
+Trie_lookup_id(TrieObject *self, PyObject *key)
+{
+    Trie *trie = numbered_trie(self);
+    PyObject *bytes = trie ? encode_key(self, key) : NULL;
+    if (!bytes) {
+        return NULL;
+    }
+    ssize_t id = trie_lookup_id(trie, PyBytes_AS_STRING(bytes),
+                                PyBytes_GET_SIZE(bytes));
+    Py_DECREF(bytes);
+    if (id < 0) {
+        Py_RETURN_NONE;
+    }
+    return PyLong_FromSsize_t(id);
+}
+
+static PyObject *
+Trie_key_by_id(TrieObject *self, PyObject *arg)
+{
+    Trie *trie = numbered_trie(self);
+    if (!trie) {
+        return NULL;
+    }
+    Py_ssize_t id = PyNumber_AsSsize_t(arg, PyExc_OverflowError);
+    if (id == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    ssize_t len = id < 0 ? -1 : trie_key_by_id(trie, id, NULL, 0);
+    if (len < 0) {
+        PyErr_SetString(PyExc_IndexError, "key number out of range");
+        return NULL;
+    }
+    char *buf = malloc(len + 1);
+    if (!buf) {
+        return PyErr_NoMemory();
+    }
+    trie_key_by_id(trie, id, buf, len + 1);
+    PyObject *key = PyUnicode_Decode(buf, len, self->encoding, "strict");
+    free(buf);
+    return key;
+}
+
+static PyObject *
+Trie_count_prefix(TrieObject *self, PyObject *prefix)
+{
+    Trie *trie = numbered_trie(self);
+    PyObject *bytes = trie ? encode_key(self, prefix) : NULL;
+    if (!bytes) {
+        return NULL;
+    }
+    ssize_t count = trie_count_prefix(trie, PyBytes_AS_STRING(bytes),
+                                      PyBytes_GET_SIZE(bytes));
+    Py_DECREF(bytes);
+    return PyLong_FromSsize_t(count);
+}
+
+static PyTypeObject PrefixIterType;
+
+static PyObject *
+Trie_iter_prefix(TrieObject *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = { "prefix", "limit", "after", NULL };
+    PyObject *prefix;
+    PyObject *limit = Py_None;
+    PyObject *after = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|OO:iter_prefix", kwlist,
+                                     &prefix, &limit, &after)) {
+        return NULL;
+    }
+    if (!self->mapping) {
+        PyErr_SetString(PyExc_ValueError, "trie is not loaded");
+        return NULL;
+    }
+    Py_ssize_t left = -1;
+    if (limit != Py_None) {
+        left = PyNumber_AsSsize_t(limit, PyExc_OverflowError);
+        if (left == -1 && PyErr_Occurred()) {
+            return NULL;
+        }
+        if (left < 0) {
+            PyErr_SetString(PyExc_ValueError, "limit must not be negative");
+            return NULL;
+        }
+    }
+    PyObject *prefix_bytes = encode_key(self, prefix);
+    PyObject *after_bytes = after == Py_None ? NULL : encode_key(self, after);
+    if (!prefix_bytes || (after != Py_None && !after_bytes)) {
+        Py_XDECREF(prefix_bytes);
+        Py_XDECREF(after_bytes);
+        return NULL;
+    }
+    TrieIter *iter = trie_iter_prefix(
+        self->mapping->trie, PyBytes_AS_STRING(prefix_bytes),
+        PyBytes_GET_SIZE(prefix_bytes),
+        after_bytes ? PyBytes_AS_STRING(after_bytes) : NULL,
+        after_bytes ? PyBytes_GET_SIZE(after_bytes) : 0);
+    Py_DECREF(prefix_bytes);
+    Py_XDECREF(after_bytes);
+    if (!iter) {
+        return PyErr_NoMemory();
+    }
+    PrefixIterObject *it = PyObject_New(PrefixIterObject, &PrefixIterType);
+    if (!it) {
+        trie_iter_free(iter);
+        return NULL;
+    }
+    Py_INCREF(self);
+    it->owner = self;
+    Py_INCREF(self->mapping);
+    it->mapping = self->mapping;
+    it->iter = iter;
+    it->left = left;
+    return (PyObject *) it;
+}
+
+static PyMethodDef Trie_methods[] = {
+    { "lookup", (PyCFunction) Trie_lookup, METH_O,
+      "lookup(key) -> list of values stored under the key, empty if missing" },
+    { "lookup_many", (PyCFunction) Trie_lookup_many, METH_O,
+      "lookup_many(keys) -> list with result of lookup() for each key\n\n"
+      "The lookups run without holding the GIL." },
+    { "lookup_views", (PyCFunction) Trie_lookup_views, METH_O,
+      "lookup_views(key) -> list of read only memoryviews of the raw values\n\n"
+      "Values stored as they are (tries compiled with -u and without -b)\n"
+      "point directly into the mapped file." },
+    { "set_counters", (PyCFunction) Trie_set_counters, METH_VARARGS,
+      "set_counters(enabled=True)\n\n"
+      "Start or stop counting what the lookups do." },
+    { "counters", (PyCFunction) Trie_counters, METH_NOARGS,
+      "counters() -> dict with the lookup counters summed over all threads\n\n"
+      "The 'latency' item is a list, item i is the number of lookups that\n"
+      "took at least 2**i and less than 2**(i+1) nanoseconds." },
+    { "reset_counters", (PyCFunction) Trie_reset_counters, METH_NOARGS,
+      "reset_counters()\n\nSet all counters back to zero." },
+    { "reload", (PyCFunction) Trie_reload, METH_VARARGS | METH_KEYWORDS,
+      "reload(filename=None)\n\n"
+      "Load the file again, or another file, and use it for all following\n"
+      "lookups. The file is loaded without holding the GIL while other\n"
+      "threads keep using the old one. Values from the old file stay valid,\n"
+      "it is unmapped when nothing uses it anymore." },
+    { "iter_prefix", (PyCFunction) Trie_iter_prefix,
+      METH_VARARGS | METH_KEYWORDS,
+      "iter_prefix(prefix, limit=None, after=None) -> iterator of (key, values)\n\n"
+      "Iterate over the keys starting with prefix in sorted order, with the\n"
+      "values of each key as returned by lookup(). At most limit keys are\n"
+      "returned. To continue later, pass the last returned key as after.\n"
+      "The iterator keeps using the file loaded when it was created." },
+    { "common_prefixes", (PyCFunction) Trie_common_prefixes, METH_O,
+      "common_prefixes(key) -> list of (prefix, values) for keys key starts with" },
+    { "longest_prefix", (PyCFunction) Trie_longest_prefix, METH_O,
+      "longest_prefix(key) -> (prefix, values) for the longest key key starts\n"
+      "with, or None" },
+    { "segment", (PyCFunction) Trie_segment, METH_O,
+      "segment(text) -> list of (part, values) splitting text into keys\n\n"
+      "The longest key at each position is taken. Parts of the text where no\n"
+      "key starts have None as values." },
+    { "lookup_id", (PyCFunction) Trie_lookup_id, METH_O,
+      "lookup_id(key) -> number of the key in sorted order, None if missing\n\n"
+      "The trie must be compiled with -k." },
+    { "key_by_id", (PyCFunction) Trie_key_by_id, METH_O,
+      "key_by_id(number) -> key with the number returned by lookup_id()\n\n"
+      "Raises IndexError if there is no such key." },
+    { "count_prefix", (PyCFunction) Trie_count_prefix, METH_O,
+      "count_prefix(prefix) -> number of keys starting with prefix" },
+    { NULL, NULL, 0, NULL }
+};
+
+static PyTypeObject TrieType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "libtrie._libtrie.Trie",
+    .tp_basicsize = sizeof(TrieObject),
+    .tp_dealloc = (destructor) Trie_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Trie(filename, encoding='utf8', flags=0, prewarm=0)\n\n"
+              "Compiled trie loaded from a file.",
+    .tp_methods = Trie_methods,
+    .tp_init = (initproc) Trie_init,
+    .tp_new = PyType_GenericNew,
+};
+
+static void
+Mapping_dealloc(MappingObject *self)
+{
+    trie_free(self->trie);
+    PyObject_Del(self);
+}
+
+static PyTypeObject MappingType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "libtrie._libtrie.Mapping",
+    .tp_basicsize = sizeof(MappingObject),
+    .tp_dealloc = (destructor) Mapping_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+};
+
+static void
+PrefixIter_dealloc(PrefixIterObject *self)
+{
+    trie_iter_free(self->iter);
+    Py_XDECREF(self->mapping);
+    Py_XDECREF(self->owner);
+    PyObject_Del(self);
+}
+
+static PyObject *
+PrefixIter_next(PrefixIterObject *self)
+{
+    if (self->left == 0) {
+        return NULL;
+    }
+    const char *key;
+    size_t key_len, num_values;
+    const TrieValue *values;
+    int ret = trie_iter_next(self->iter, &key, &key_len, &values, &num_values);
+    if (ret < 0) {
+        return PyErr_NoMemory();
+    }
+    if (ret == 0) {
+        self->left = 0;
+        return NULL;
+    }
+    if (self->left > 0) {
+        --self->left;
+    }
+    PyObject *list = values_to_list(self->owner, values, num_values);
+    PyObject *item = list ? PyUnicode_Decode(key, key_len,
+                                             self->owner->encoding, "strict")
+                          : NULL;
+    PyObject *result = item ? PyTuple_Pack(2, item, list) : NULL;
+    Py_XDECREF(item);
+    Py_XDECREF(list);
+    return result;
+}
+
+static PyTypeObject PrefixIterType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "libtrie._libtrie.PrefixIterator",
+    .tp_basicsize = sizeof(PrefixIterObject),
+    .tp_dealloc = (destructor) PrefixIter_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_iter = PyObject_SelfIter,
+    .tp_iternext = (iternextfunc) PrefixIter_next,
+};
+
+static int
+Value_getbuffer(ValueObject *self, Py_buffer *view, int flags)
+{
+    return PyBuffer_FillInfo(view, (PyObject *) self, (void *) self->data,
+                             self->len, 1, flags);
+}
+
+static void
+Value_dealloc(ValueObject *self)
+{
+    Py_XDECREF(self->owner);
+    PyObject_Del(self);
+}
+
+static PyBufferProcs Value_as_buffer = {
+    .bf_getbuffer = (getbufferproc) Value_getbuffer,
+};
+
+static PyTypeObject ValueType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "libtrie._libtrie.Value",
+    .tp_basicsize = sizeof(ValueObject),
+    .tp_dealloc = (destructor) Value_dealloc,
+    .tp_as_buffer = &Value_as_buffer,
+    .tp_flags = BUFFER_FLAGS,
+};
+
+static PyObject * init_module(PyObject *module)
+{
+    if (!module || PyType_Ready(&TrieType) < 0 || PyType_Ready(&ValueType) < 0
+            || PyType_Ready(&MappingType) < 0
+            || PyType_Ready(&PrefixIterType) < 0) {
+        return NULL;
+    }
+    Py_INCREF(&TrieType);
+    PyModule_AddObject(module, "Trie", (PyObject *) &TrieType);
+    return module;
+}
+
+#if PY_MAJOR_VERSION < 3
+PyMODINIT_FUNC init_libtrie(void)
+{
+    init_module(Py_InitModule("_libtrie", NULL));
+}
+#else
+static struct PyModuleDef libtrie_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "_libtrie",
+    .m_doc = "Compiled interface to libtrie.",
+    .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit__libtrie(void)
+{
+    return init_module(PyModule_Create(&libtrie_module));
+}
+#endif
@@ -0,0 +1,129 @@
+# vim: set encoding=utf-8
+
+"""
+Client for the `list-serve` daemon. It talks to the daemon over a Unix domain
+socket and does not need the shared library.
+"""
+
+import socket
+import struct
+
+# Status codes of responses, see serve-protocol.h.
+OK = 0
+NO_TRIE = 1
+BAD_FRAME = 2
+NO_MEMORY = 3
+TOO_LARGE = 4
+
+_HEADER = struct.Struct('<IIHH')
+_U32 = struct.Struct('<I')
+_I32 = struct.Struct('<i')
+_MAX_KEYS = 65535
+
+# Keys in one request and requests waiting for a response in `lookup_many`,
+# the same as REMOTE_BATCH and REMOTE_WINDOW of list-query.
+_BATCH = 256
+_WINDOW = 16
+
+
+class ServerError(Exception):
+    """The daemon could not answer a request."""
+
+
+class Client(object):
+    """
+    Connection to a `list-serve` daemon. Requests can be pipelined by calling
+    `send` multiple times before the matching `recv` calls. Responses come in
+    the order of the requests.
+
+    The daemon stops reading requests while the client leaves too many
+    responses unread, so only a few requests should be sent ahead of `recv`.
+    """
+
+    def __init__(self, path, encoding='utf8'):
+        self.encoding = encoding
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(path)
+        self.next_id = 0
+
+    def close(self):
+        """Close the connection."""
+        self.sock.close()
+
+    def send(self, keys, trie=0):
+        """
+        Send a request to look up `keys` in trie with index `trie` without
+        waiting for the response. Returns id of the request.
+        """
+        if len(keys) > _MAX_KEYS:
+            raise ValueError('too many keys in one request')
+        parts = []
+        for key in keys:
+            if not isinstance(key, bytes):
+                key = key.encode(self.encoding)
+            parts.append(_U32.pack(len(key)))
+            parts.append(key)
+        body = b''.join(parts)
+        req_id = self.next_id
+        self.next_id = (self.next_id + 1) & 0xffffffff
+        self.sock.sendall(_HEADER.pack(len(body) + 8, req_id, trie, len(keys))
+                          + body)
+        return req_id
+
+    def _read(self, size):
+        chunks = []
+        while size > 0:
+            chunk = self.sock.recv(size)
+            if not chunk:
+                raise ServerError('connection closed')
+            chunks.append(chunk)
+            size -= len(chunk)
+        return b''.join(chunks)
+
+    def recv(self):
+        """
+        Receive the response to the oldest request. Returns the request id
+        and a list with the values of each key (empty for missing keys).
+        """
+        length, req_id, status, num_keys = _HEADER.unpack(self._read(12))
+        data = self._read(length - 8)
+        if status != OK:
+            raise ServerError('request failed with status %d' % status)
+        results = []
+        pos = 0
+        for _ in range(num_keys):
+            count = _I32.unpack_from(data, pos)[0]
+            pos += 4
+            values = []
+            for _ in range(count):
+                size = _U32.unpack_from(data, pos)[0]
+                pos += 4
+                values.append(data[pos:pos + size].decode(self.encoding))
+                pos += size
+            results.append(values)
+        return req_id, results
+
+    def lookup_many(self, keys, trie=0):
+        """
+        Look up all `keys` and return a list of results, one list of values
+        for each key. The keys are sent in small requests and responses are
+        read as soon as `_WINDOW` requests are waiting for them.
+        """
+        keys = list(keys)
+        results = []
+        waiting = 0
+        for start in range(0, len(keys), _BATCH):
+            if waiting == _WINDOW:
+                results.extend(self.recv()[1])
+                waiting -= 1
+            self.send(keys[start:start + _BATCH], trie)
+            waiting += 1
+        for _ in range(waiting):
+            results.extend(self.recv()[1])
+        return results
+
+    def lookup(self, key, trie=0):
+        """
+        Return list of values stored under `key`, empty if it is missing.
+        """
+        return self.lookup_many([key], trie)[0]
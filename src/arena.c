@@ -0,0 +1,90 @@
+#include "trie-private.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Bump allocator for small objects that are all freed at the same time.
+ */
+
+/**
+ * Size of data in one block. Bigger allocations get their own block.
+ */
+#define ARENA_BLOCK_SIZE (1 << 20)
+
+static size_t arena_align(size_t size)
+{
+    return (size + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+}
+
+void * arena_alloc(Arena *arena, size_t size)
+{
+    size = arena_align(size);
+    ArenaBlock *block = arena->head;
+    if (!block || block->used + size > block->size) {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof *block + block_size);
+        if (!block) {
+            return NULL;
+        }
+        block->size = block_size;
+        block->used = 0;
+        block->next = arena->head;
+        arena->head = block;
+        arena->allocated += block_size;
+    }
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+void * arena_grow(Arena *arena, void *ptr, size_t old_size, size_t new_size)
+{
+    ArenaBlock *block = arena->head;
+    old_size = arena_align(old_size);
+    new_size = arena_align(new_size);
+    /* The most recent allocation can be extended in place. */
+    if (block && (char *) ptr + old_size == block->data + block->used
+            && block->used - old_size + new_size <= block->size) {
+        block->used += new_size - old_size;
+        return ptr;
+    }
+    void *new_ptr = arena_alloc(arena, new_size);
+    if (new_ptr) {
+        memcpy(new_ptr, ptr, old_size);
+    }
+    return new_ptr;
+}
+
+void arena_merge(Arena *arena, Arena *other)
+{
+    ArenaBlock *tail = other->head;
+    if (!tail) {
+        return;
+    }
+    while (tail->next) {
+        tail = tail->next;
+    }
+    /* Keep the current block of `arena` in front so that it is filled up. */
+    if (arena->head) {
+        tail->next = arena->head->next;
+        arena->head->next = other->head;
+    } else {
+        arena->head = other->head;
+    }
+    arena->allocated += other->allocated;
+    other->head = NULL;
+    other->allocated = 0;
+}
+
+void arena_free(Arena *arena)
+{
+    ArenaBlock *block = arena->head;
+    while (block) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+    arena->allocated = 0;
+}
@@ -0,0 +1,230 @@
+#include "trie-client.h"
+#include "serve-protocol.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * Blocking client for the `list-serve` daemon.
+ */
+
+struct trie_client {
+    int fd;
+    uint32_t next_id;
+
+    unsigned char *out;     /**< Frame being sent. */
+    size_t out_cap;
+
+    unsigned char *in;      /**< Last received frame. */
+    size_t in_cap;
+    ssize_t *counts;        /**< Parsed counts of the last response. */
+    size_t counts_cap;
+    TrieValue *values;      /**< Parsed values of the last response. */
+    size_t values_cap;
+};
+
+static bool grow(void **array, size_t *cap, size_t needed, size_t item)
+{
+    if (needed <= *cap) {
+        return true;
+    }
+    size_t new_cap = *cap ? *cap : 64;
+    while (new_cap < needed) {
+        new_cap *= 2;
+    }
+    void *tmp = realloc(*array, new_cap * item);
+    if (!tmp) {
+        return false;
+    }
+    *array = tmp;
+    *cap = new_cap;
+    return true;
+}
+
+TrieClient * trie_client_connect(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof addr.sun_path) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (connect(fd, (struct sockaddr *) &addr, sizeof addr) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+
+    TrieClient *client = calloc(1, sizeof *client);
+    if (!client) {
+        close(fd);
+        return NULL;
+    }
+    client->fd = fd;
+    return client;
+}
+
+void trie_client_close(TrieClient *client)
+{
+    if (!client) {
+        return;
+    }
+    close(client->fd);
+    free(client->out);
+    free(client->in);
+    free(client->counts);
+    free(client->values);
+    free(client);
+}
+
+static int write_all(int fd, const unsigned char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int read_all(int fd, unsigned char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = recv(fd, data, len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n == 0) {
+                errno = ECONNRESET;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int64_t trie_client_send(TrieClient *client, unsigned trie, const char **keys,
+                         const size_t *key_lens, size_t n)
+{
+    if (n > SERVE_MAX_KEYS || trie > UINT16_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    size_t len = SERVE_HEADER_LEN;
+    for (size_t i = 0; i < n; ++i) {
+        len += 4 + key_lens[i];
+    }
+    if (len - 4 > SERVE_MAX_FRAME) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (!grow((void **) &client->out, &client->out_cap, len, 1)) {
+        return -1;
+    }
+
+    uint32_t id = client->next_id++;
+    unsigned char *pos = client->out;
+    serve_put_u32(pos, len - 4);
+    serve_put_u32(pos + 4, id);
+    serve_put_u16(pos + 8, trie);
+    serve_put_u16(pos + 10, n);
+    pos += SERVE_HEADER_LEN;
+    for (size_t i = 0; i < n; ++i) {
+        serve_put_u32(pos, key_lens[i]);
+        memcpy(pos + 4, keys[i], key_lens[i]);
+        pos += 4 + key_lens[i];
+    }
+    if (write_all(client->fd, client->out, len) < 0) {
+        return -1;
+    }
+    return id;
+}
+
+int trie_client_recv(TrieClient *client, TrieClientResponse *response)
+{
+    unsigned char header[SERVE_HEADER_LEN];
+    if (read_all(client->fd, header, sizeof header) < 0) {
+        return -1;
+    }
+    size_t len = serve_get_u32(header);
+    if (len < SERVE_HEADER_LEN - 4 || len > SERVE_MAX_FRAME) {
+        errno = EPROTO;
+        return -1;
+    }
+    len -= SERVE_HEADER_LEN - 4;
+    if (!grow((void **) &client->in, &client->in_cap, len, 1)
+            || read_all(client->fd, client->in, len) < 0) {
+        return -1;
+    }
+
+    size_t num_keys = serve_get_u16(header + 10);
+    if (!grow((void **) &client->counts, &client->counts_cap, num_keys,
+              sizeof *client->counts)) {
+        return -1;
+    }
+    const unsigned char *pos = client->in;
+    const unsigned char *end = client->in + len;
+    size_t num_values = 0;
+    for (size_t i = 0; i < num_keys; ++i) {
+        if (end - pos < 4) {
+            goto bad_frame;
+        }
+        int32_t count = (int32_t) serve_get_u32(pos);
+        pos += 4;
+        client->counts[i] = count;
+        for (int32_t j = 0; j < count; ++j) {
+            if (end - pos < 4 || (size_t) (end - pos - 4) < serve_get_u32(pos)) {
+                goto bad_frame;
+            }
+            if (!grow((void **) &client->values, &client->values_cap,
+                      num_values + 1, sizeof *client->values)) {
+                return -1;
+            }
+            TrieValue *value = client->values + num_values++;
+            value->len = serve_get_u32(pos);
+            value->data = (const char *) pos + 4;
+            pos += 4 + value->len;
+        }
+    }
+
+    response->id = serve_get_u32(header + 4);
+    response->status = serve_get_u16(header + 8);
+    response->num_keys = num_keys;
+    response->counts = client->counts;
+    response->values = client->values;
+    return 0;
+
+bad_frame:
+    errno = EPROTO;
+    return -1;
+}
+
+int trie_client_lookup(TrieClient *client, unsigned trie, const char **keys,
+                       const size_t *key_lens, size_t n,
+                       TrieClientResponse *response)
+{
+    if (trie_client_send(client, trie, keys, key_lens, n) < 0) {
+        return -1;
+    }
+    return trie_client_recv(client, response);
+}
@@ -1,34 +1,64 @@
 #include <config.h>
 #include "trie.h"
 
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <unistd.h>
 
+/**
+ * Split a line into key and value. Returns 0 if the line should be skipped.
+ */
+static int
+parse_line(char *line, const char *delimiter, int with_content,
+           char **key, char **val)
+{
+    char *pch = strchr(line, '\n');
+    if (pch)
+        *pch = 0;
+    if (strlen(line) <= 1)
+        return 0;
+    *val = NULL;
+    if (with_content) {
+        *key = strtok(line, delimiter);
+        *val = strtok(NULL, "\n");
+        if (!*val)
+            return 0;
+    } else {
+        *key = line;
+    }
+    return 1;
+}
+
 static Trie *
-load_data(FILE *fh, const char *delimiter, int with_content, int use_compress)
+load_data(FILE *fh, const char *delimiter, int with_content, int use_compress,
+          unsigned flags)
 {
     char *line = NULL;
     size_t len = 0;
-    Trie *trie = trie_new(with_content, use_compress);
+    Trie *trie = trie_new_ex(with_content, use_compress, flags);
     unsigned count = 0;
 
+    if (!trie) {
+        fprintf(stderr, "Failed to create trie: %s\n", trie_get_last_error());
+        return NULL;
+    }
+
     while (getline(&line, &len, fh) > 0) {
-        char *pch = strchr(line, '\n');
-        *pch = 0;
-        if (strlen(line) <= 1)
+        char *key, *val;
+        if (!parse_line(line, delimiter, with_content, &key, &val))
             continue;
-        char *key, *val = NULL;
-        if (with_content) {
-            key = strtok(line, delimiter);
-            val = strtok(NULL, "\n");
-            if (!val)
-                continue;
-        } else {
-            key = line;
+        if (trie_insert(trie, key, val) < 0) {
+            fprintf(stderr, "Failed to insert '%s': %s\n",
+                    key, trie_get_last_error());
+            trie_free(trie);
+            free(line);
+            return NULL;
         }
-        trie_insert(trie, key, val);
         ++count;
         if (isatty(STDOUT_FILENO) && (count % 1000) == 0) {
             printf("\rInserted %u items", count);
@@ -45,6 +75,194 @@ load_data(FILE *fh, const char *delimiter, int with_content, int use_compress)
     return trie;
 }
 
+/**
+ * Keys are split into shards by their first byte, so there is no use for
+ * more threads than there are bytes.
+ */
+#define MAX_JOBS (UCHAR_MAX + 1)
+
+typedef struct {
+    char *key;
+    char *val;
+} Record;
+
+typedef struct {
+    Record *records;
+    size_t count;
+    int with_content;
+    int use_compress;
+    unsigned flags;
+    Trie *trie;
+} Shard;
+
+/**
+ * Build a trie from the records of this shard. Keys with the same first
+ * byte always end up in the same shard, so the shards can be joined under a
+ * common root.
+ */
+static void * build_shard(void *arg)
+{
+    Shard *shard = arg;
+    Trie *trie = trie_new_ex(shard->with_content, shard->use_compress,
+                             shard->flags);
+    for (size_t i = 0; trie && i < shard->count; ++i) {
+        Record *rec = shard->records + i;
+        if (trie_insert(trie, rec->key, rec->val) < 0) {
+            fprintf(stderr, "Failed to insert '%s': %s\n",
+                    rec->key, trie_get_last_error());
+            trie_free(trie);
+            trie = NULL;
+        }
+    }
+    shard->trie = trie;
+    return NULL;
+}
+
+static unsigned record_shard(const Record *rec, unsigned jobs)
+{
+    return (unsigned char) rec->key[0] % jobs;
+}
+
+/**
+ * Read all records into `records`, keeping the lines they point into in
+ * `lines`. Returns the number of records, or -1 if memory ran out.
+ */
+static ssize_t
+read_records(FILE *fh, const char *delimiter, int with_content,
+             Record **records, char ***lines)
+{
+    char *line = NULL;
+    size_t len = 0;
+    size_t count = 0, records_len = 0;
+    *records = NULL;
+    *lines = NULL;
+
+    while (getline(&line, &len, fh) > 0) {
+        char *key, *val;
+        if (!parse_line(line, delimiter, with_content, &key, &val))
+            continue;
+        if (count == records_len) {
+            records_len = records_len ? 2 * records_len : 1024;
+            Record *r = realloc(*records, records_len * sizeof *r);
+            if (r)
+                *records = r;
+            char **l = realloc(*lines, records_len * sizeof *l);
+            if (l)
+                *lines = l;
+            if (!r || !l) {
+                free(line);
+                return -1;
+            }
+        }
+        (*records)[count].key = key;
+        (*records)[count].val = val;
+        (*lines)[count++] = line;
+        line = NULL;
+        len = 0;
+    }
+    free(line);
+    return count;
+}
+
+static Trie *
+load_data_parallel(FILE *fh, const char *delimiter, int with_content,
+                   int use_compress, unsigned flags, unsigned jobs)
+{
+    Record *records, *sorted = NULL;
+    char **lines;
+    ssize_t n = read_records(fh, delimiter, with_content, &records, &lines);
+    size_t count = n < 0 ? 0 : n;
+    if (n >= 0)
+        sorted = malloc((count ? count : 1) * sizeof *sorted);
+    if (!sorted) {
+        fprintf(stderr, "Out of memory\n");
+        for (size_t i = 0; i < count; ++i)
+            free(lines[i]);
+        free(lines);
+        free(records);
+        return NULL;
+    }
+
+    /* Group the records by shard in one pass, keeping their order. */
+    Shard shards[MAX_JOBS] = { { 0 } };
+    for (size_t i = 0; i < count; ++i)
+        ++shards[record_shard(records + i, jobs)].count;
+    size_t start = 0;
+    for (unsigned i = 0; i < jobs; ++i) {
+        shards[i].records = sorted + start;
+        start += shards[i].count;
+        shards[i].count = 0;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        Shard *shard = shards + record_shard(records + i, jobs);
+        shard->records[shard->count++] = records[i];
+    }
+    free(records);
+
+    pthread_t threads[MAX_JOBS];
+    for (unsigned i = 0; i < jobs; ++i) {
+        shards[i].with_content = with_content;
+        shards[i].use_compress = use_compress;
+        shards[i].flags = flags;
+        if (pthread_create(threads + i, NULL, build_shard, shards + i) != 0) {
+            build_shard(shards + i);
+            threads[i] = pthread_self();
+        }
+    }
+    int failed = 0;
+    Trie *parts[MAX_JOBS];
+    for (unsigned i = 0; i < jobs; ++i) {
+        if (!pthread_equal(threads[i], pthread_self()))
+            pthread_join(threads[i], NULL);
+        parts[i] = shards[i].trie;
+        failed |= parts[i] == NULL;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+        free(lines[i]);
+    free(lines);
+    free(sorted);
+
+    if (failed) {
+        for (unsigned i = 0; i < jobs; ++i)
+            trie_free(parts[i]);
+        return NULL;
+    }
+
+    printf("Inserted %zu items\n", count);
+
+    Trie *trie = trie_join(parts, jobs);
+    trie_set_threads(trie, jobs);
+    return trie;
+}
+
+/**
+ * Print the peak memory usage of the process.
+ */
+static void print_memory_usage(void)
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        printf("Peak memory usage: %ld kB\n", usage.ru_maxrss);
+    }
+}
+
+/**
+ * Print the same statistics of the written file as `list-stats`.
+ */
+static void print_stats(const char *filename)
+{
+    Trie *trie = trie_load(filename);
+    if (!trie) {
+        fprintf(stderr, "Failed to load trie: %s\n", trie_get_last_error());
+        return;
+    }
+    TrieStats stats;
+    trie_stats(trie, &stats);
+    trie_stats_print(&stats, stdout);
+    trie_free(trie);
+}
+
 static void usage(FILE *fh, const char *prog)
 {
     fprintf(fh, "Usage: %s [OPTIONS...] INPUT OUTPUT\n", prog);
@@ -54,9 +272,16 @@ static void help(const char *prog)
 {
     usage(stdout, prog);
     puts("\nAvailable options:");
+    puts("  -b              store values in front coded blocks");
     puts("  -dDELIMITER     set delimiter between key and value");
     puts("  -e              do not store data associated with keys");
+    puts("  -jJOBS          build with JOBS threads");
+    puts("  -k              store key counts to number the keys");
+    puts("  -m              merge identical subtrees");
+    puts("  -r              collapse chains of nodes with single child");
+    puts("  -s, --sorted    input is sorted, build with bounded memory");
     puts("  -u              do not use compression");
+    puts("  -v              print memory usage and statistics of the trie");
     puts("  -h              print this help");
     puts("");
     puts("This is list-compile from "PACKAGE" "VERSION".");
@@ -68,19 +293,54 @@ int main(int argc, char *argv[])
     const char *delimiter = ":";
     int with_content = 1;
     int use_compress = 1;
+    unsigned flags = 0;
+    unsigned jobs = 1;
+    int verbose = 0;
+
+    static const struct option long_options[] = {
+        { "sorted", no_argument, NULL, 's' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
 
     int opt;
-    while ((opt = getopt(argc, argv, "d:euh")) != -1) {
+    while ((opt = getopt_long(argc, argv, "bd:ej:kmrsuvh", long_options, NULL)) != -1) {
         switch (opt) {
+        case 'b':
+            flags |= TRIE_BUILD_BLOCK_VALUES;
+            break;
         case 'd':
             delimiter = optarg;
             break;
         case 'e':
             with_content = 0;
             break;
+        case 'j':
+            if (atoi(optarg) < 1 || atoi(optarg) > MAX_JOBS) {
+                fprintf(stderr, "Number of jobs must be between 1 and %d\n",
+                        MAX_JOBS);
+                return 1;
+            }
+            jobs = atoi(optarg);
+            break;
+        case 'k':
+            flags |= TRIE_BUILD_KEY_COUNTS;
+            break;
+        case 'm':
+            flags |= TRIE_BUILD_MINIMIZE;
+            break;
+        case 'r':
+            flags |= TRIE_BUILD_RADIX;
+            break;
+        case 's':
+            flags |= TRIE_BUILD_SORTED;
+            break;
         case 'u':
             use_compress = 0;
             break;
+        case 'v':
+            verbose = 1;
+            break;
         case 'h':
             help(argv[0]);
             return 0;
@@ -95,6 +355,11 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    if (jobs > 1 && (flags & TRIE_BUILD_SORTED)) {
+        fprintf(stderr, "Option -j can not be combined with -s\n");
+        return 1;
+    }
+
     FILE *infile = NULL;
     if (strcmp(argv[optind], "-") == 0) {
         infile = stdin;
@@ -106,12 +371,30 @@ int main(int argc, char *argv[])
         return 2;
     }
 
-    Trie *trie = load_data(infile, delimiter, with_content, use_compress);
+    Trie *trie;
+    if (jobs > 1) {
+        trie = load_data_parallel(infile, delimiter, with_content,
+                                  use_compress, flags, jobs);
+    } else {
+        trie = load_data(infile, delimiter, with_content, use_compress, flags);
+    }
     fclose(infile);
+    if (!trie) {
+        return 3;
+    }
 
     trie_serialize(trie, argv[optind + 1]);
 
+    if (verbose) {
+        printf("Root table: %zu bytes\n", trie_root_table_size(trie));
+    }
+
     trie_free(trie);
 
+    if (verbose) {
+        print_memory_usage();
+        print_stats(argv[optind + 1]);
+    }
+
     return 0;
 }
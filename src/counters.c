@@ -0,0 +1,202 @@
+#include "trie-private.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Lookup counters. Every thread that looks up keys in a trie with counting
+ * enabled gets its own slot, so that the counters are updated without any
+ * locking or atomic read-modify-write instructions. Reading the counters sums
+ * all slots.
+ */
+
+Counters * counters_new(void)
+{
+    Counters *counters = calloc(1, sizeof *counters);
+    if (!counters) {
+        return NULL;
+    }
+    thread_slots_init(&counters->slots);
+    pthread_mutex_init(&counters->lock, NULL);
+    return counters;
+}
+
+void counters_free(Counters *counters)
+{
+    if (!counters) {
+        return;
+    }
+    thread_slots_free(&counters->slots);
+    pthread_mutex_destroy(&counters->lock);
+    free(counters);
+}
+
+void counters_set_enabled(Counters *counters, bool enabled)
+{
+    __atomic_store_n(&counters->enabled, enabled, __ATOMIC_RELAXED);
+}
+
+CounterSlot * counters_slot(Counters *counters)
+{
+    return (CounterSlot *) thread_slots_get(&counters->slots,
+                                            sizeof (CounterSlot));
+}
+
+/**
+ * Add all counters of `src` to `dst`, reading each with a relaxed atomic load
+ * as the owning thread may be updating it.
+ */
+static void add_counts(TrieCounters *dst, const TrieCounters *src)
+{
+    const uint64_t *from = (const uint64_t *) src;
+    uint64_t *to = (uint64_t *) dst;
+    for (size_t i = 0; i < sizeof *src / sizeof *from; ++i) {
+        to[i] += __atomic_load_n(from + i, __ATOMIC_RELAXED);
+    }
+}
+
+static void sum_slots(Counters *counters, TrieCounters *sum)
+{
+    memset(sum, 0, sizeof *sum);
+    for (ThreadSlot *slot = thread_slots_first(&counters->slots); slot;
+            slot = slot->next) {
+        add_counts(sum, &((CounterSlot *) slot)->counts);
+    }
+}
+
+void counters_sum(Counters *counters, TrieCounters *sum)
+{
+    pthread_mutex_lock(&counters->lock);
+    sum_slots(counters, sum);
+    const uint64_t *base = (const uint64_t *) &counters->base;
+    uint64_t *to = (uint64_t *) sum;
+    for (size_t i = 0; i < sizeof *sum / sizeof *to; ++i) {
+        to[i] -= base[i];
+    }
+    pthread_mutex_unlock(&counters->lock);
+}
+
+void counters_reset(Counters *counters)
+{
+    /* The slots are never written by other threads, so the current sum
+     * becomes the new zero. */
+    pthread_mutex_lock(&counters->lock);
+    sum_slots(counters, &counters->base);
+    pthread_mutex_unlock(&counters->lock);
+}
+
+uint64_t counters_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void counters_add_latency(CounterSlot *slot, uint64_t ns, uint64_t n)
+{
+    unsigned bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+    if (bucket >= TRIE_LATENCY_BUCKETS) {
+        bucket = TRIE_LATENCY_BUCKETS - 1;
+    }
+    counter_add(&slot->counts.latency[bucket], n);
+}
+
+int trie_set_counters(Trie *trie, int enabled)
+{
+    if (!trie->base_mem) {
+        return -1;
+    }
+    Counters *counters = __atomic_load_n(&trie->counters, __ATOMIC_ACQUIRE);
+    if (!counters) {
+        if (!enabled) {
+            return 0;
+        }
+        Counters *created = counters_new();
+        if (!created) {
+            return -1;
+        }
+        /* Threads enabling counting at once all use the first counters
+         * published, the others free theirs. */
+        if (__atomic_compare_exchange_n(&trie->counters, &counters, created,
+                                        false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE)) {
+            counters = created;
+        } else {
+            counters_free(created);
+        }
+    }
+    counters_set_enabled(counters, enabled);
+    return 0;
+}
+
+void trie_get_counters(Trie *trie, TrieCounters *counters)
+{
+    Counters *c = __atomic_load_n(&trie->counters, __ATOMIC_ACQUIRE);
+    if (!c) {
+        memset(counters, 0, sizeof *counters);
+        return;
+    }
+    counters_sum(c, counters);
+}
+
+void trie_reset_counters(Trie *trie)
+{
+    Counters *c = __atomic_load_n(&trie->counters, __ATOMIC_ACQUIRE);
+    if (c) {
+        counters_reset(c);
+    }
+}
+
+/**
+ * Smallest latency in nanoseconds such that at least `fraction` of lookups
+ * were not slower, up to the precision of the histogram.
+ */
+static uint64_t percentile(const TrieCounters *c, uint64_t total, double fraction)
+{
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < TRIE_LATENCY_BUCKETS; ++i) {
+        seen += c->latency[i];
+        if (seen >= total * fraction) {
+            return UINT64_C(2) << i;
+        }
+    }
+    return 0;
+}
+
+static double per_lookup(uint64_t value, uint64_t lookups)
+{
+    return lookups ? (double) value / lookups : 0;
+}
+
+void trie_counters_print(const TrieCounters *c, FILE *fh)
+{
+    fprintf(fh, "Lookups: %llu (%llu hits, %llu misses)\n",
+            (unsigned long long) c->lookups, (unsigned long long) c->hits,
+            (unsigned long long) c->misses);
+    fprintf(fh, "Nodes visited: %llu (%.2f per lookup)\n",
+            (unsigned long long) c->nodes, per_lookup(c->nodes, c->lookups));
+    fprintf(fh, "Chunks compared: %llu (%.2f per lookup)\n",
+            (unsigned long long) c->chunks, per_lookup(c->chunks, c->lookups));
+    fprintf(fh, "Decoded bytes: %llu\n", (unsigned long long) c->decoded_bytes);
+    fprintf(fh, "Allocations: %llu\n", (unsigned long long) c->allocations);
+
+    uint64_t total = 0;
+    for (unsigned i = 0; i < TRIE_LATENCY_BUCKETS; ++i) {
+        total += c->latency[i];
+    }
+    if (total == 0) {
+        return;
+    }
+    fprintf(fh, "Latency: p50 < %llu ns, p90 < %llu ns, p99 < %llu ns\n",
+            (unsigned long long) percentile(c, total, 0.5),
+            (unsigned long long) percentile(c, total, 0.9),
+            (unsigned long long) percentile(c, total, 0.99));
+    for (unsigned i = 0; i < TRIE_LATENCY_BUCKETS; ++i) {
+        if (c->latency[i]) {
+            fprintf(fh, "  < %10llu ns: %llu\n",
+                    (unsigned long long) (UINT64_C(2) << i),
+                    (unsigned long long) c->latency[i]);
+        }
+    }
+}
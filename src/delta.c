@@ -0,0 +1,434 @@
+#include "trie-private.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Mutable overlay over a loaded trie. Inserted values and removed keys are
+ * kept in a hash table. Lookups combine the table with the base trie, and
+ * `trie_merge()` writes both into a new file in a single pass over the keys
+ * of the base in sorted order.
+ */
+
+typedef struct delta_value DeltaValue;
+
+struct delta_value {
+    DeltaValue *next;
+    size_t len;
+    char data[];
+};
+
+typedef struct {
+    const char *key;
+    size_t key_len;
+    bool removed;       /**< Values of the key in the base are hidden. */
+    uint32_t count;     /**< Number of inserted values. */
+    DeltaValue *head;   /**< Inserted values in order of insertion. */
+    DeltaValue *tail;
+} DeltaEntry;
+
+struct trie_delta {
+    Trie *base;
+    Arena arena;            /**< Storage of keys and values. */
+    DeltaEntry *entries;
+    size_t len;
+    size_t cap;
+    uint32_t *table;        /**< Index of entry plus one, 0 for empty slots. */
+    size_t table_size;      /**< Power of two. */
+};
+
+static uint64_t hash_key(const char *key, size_t len)
+{
+    /* FNV-1a */
+    uint64_t hash = UINT64_C(14695981039346656037);
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (unsigned char) key[i];
+        hash *= UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+/**
+ * Find the slot of the table where the key is or should be.
+ */
+static uint32_t *
+find_slot(TrieDelta *delta, const char *key, size_t key_len)
+{
+    size_t mask = delta->table_size - 1;
+    size_t pos = hash_key(key, key_len) & mask;
+    for (;;) {
+        uint32_t *slot = delta->table + pos;
+        if (*slot == 0) {
+            return slot;
+        }
+        const DeltaEntry *entry = delta->entries + *slot - 1;
+        if (entry->key_len == key_len && memcmp(entry->key, key, key_len) == 0) {
+            return slot;
+        }
+        pos = (pos + 1) & mask;
+    }
+}
+
+static bool grow_table(TrieDelta *delta)
+{
+    size_t size = delta->table_size * 2;
+    uint32_t *table = calloc(size, sizeof *table);
+    if (!table) {
+        return false;
+    }
+    free(delta->table);
+    delta->table = table;
+    delta->table_size = size;
+    for (size_t i = 0; i < delta->len; ++i) {
+        const DeltaEntry *entry = delta->entries + i;
+        *find_slot(delta, entry->key, entry->key_len) = i + 1;
+    }
+    return true;
+}
+
+/**
+ * Find the entry of a key.
+ *
+ * @param create    whether to add a new entry if the key is not there
+ * @return          the entry, NULL if there is none or it could not be added
+ */
+static DeltaEntry *
+find_entry(TrieDelta *delta, const char *key, size_t key_len, bool create)
+{
+    uint32_t *slot = find_slot(delta, key, key_len);
+    if (*slot) {
+        return delta->entries + *slot - 1;
+    }
+    if (!create) {
+        return NULL;
+    }
+    if (2 * (delta->len + 1) > delta->table_size) {
+        if (!grow_table(delta)) {
+            set_last_error(ERROR_NOMEM);
+            return NULL;
+        }
+        slot = find_slot(delta, key, key_len);
+    }
+    if (delta->len == delta->cap) {
+        size_t cap = delta->cap * 2;
+        DeltaEntry *entries = realloc(delta->entries, cap * sizeof *entries);
+        if (!entries) {
+            set_last_error(ERROR_NOMEM);
+            return NULL;
+        }
+        delta->entries = entries;
+        delta->cap = cap;
+    }
+    char *copy = arena_alloc(&delta->arena, key_len + 1);
+    if (!copy) {
+        set_last_error(ERROR_NOMEM);
+        return NULL;
+    }
+    memcpy(copy, key, key_len);
+    copy[key_len] = 0;
+
+    DeltaEntry *entry = delta->entries + delta->len;
+    memset(entry, 0, sizeof *entry);
+    entry->key = copy;
+    entry->key_len = key_len;
+    *slot = ++delta->len;
+    return entry;
+}
+
+TrieDelta * trie_delta_new(Trie *base)
+{
+    if (!base->base_mem) {
+        set_last_error(ERROR_FLAGS);
+        return NULL;
+    }
+    TrieDelta *delta = calloc(1, sizeof *delta);
+    if (!delta) {
+        set_last_error(ERROR_NOMEM);
+        return NULL;
+    }
+    delta->base = base;
+    delta->cap = 64;
+    delta->entries = malloc(delta->cap * sizeof *delta->entries);
+    delta->table_size = 128;
+    delta->table = calloc(delta->table_size, sizeof *delta->table);
+    if (!delta->entries || !delta->table) {
+        set_last_error(ERROR_NOMEM);
+        trie_delta_free(delta);
+        return NULL;
+    }
+    return delta;
+}
+
+void trie_delta_free(TrieDelta *delta)
+{
+    if (!delta) {
+        return;
+    }
+    arena_free(&delta->arena);
+    free(delta->entries);
+    free(delta->table);
+    free(delta);
+}
+
+int trie_delta_insert(TrieDelta *delta, const char *key, const char *value)
+{
+    if (delta->base->with_content && !value) {
+        return -1;
+    }
+    DeltaEntry *entry = find_entry(delta, key, strlen(key), true);
+    if (!entry) {
+        return -1;
+    }
+    if (!delta->base->with_content) {
+        entry->count = 1;
+        return 0;
+    }
+    size_t len = strlen(value);
+    DeltaValue *v = arena_alloc(&delta->arena, sizeof *v + len);
+    if (!v) {
+        set_last_error(ERROR_NOMEM);
+        return -1;
+    }
+    v->next = NULL;
+    v->len = len;
+    memcpy(v->data, value, len);
+    if (entry->tail) {
+        entry->tail->next = v;
+    } else {
+        entry->head = v;
+    }
+    entry->tail = v;
+    ++entry->count;
+    return 0;
+}
+
+int trie_delta_remove(TrieDelta *delta, const char *key)
+{
+    DeltaEntry *entry = find_entry(delta, key, strlen(key), true);
+    if (!entry) {
+        return -1;
+    }
+    entry->removed = true;
+    entry->count = 0;
+    entry->head = entry->tail = NULL;
+    return 0;
+}
+
+ssize_t trie_delta_lookup_values(TrieDelta *delta, const char *key,
+                                 size_t key_len, TrieValue *values,
+                                 size_t max_values, char *buf, size_t buf_len)
+{
+    const DeltaEntry *entry = find_entry(delta, key, key_len, false);
+    ssize_t n = -1;
+    if (!entry || !entry->removed) {
+        n = trie_lookup_values(delta->base, key, key_len, values, max_values,
+                               buf, buf_len);
+    }
+    if (!entry || entry->count == 0) {
+        return n;
+    }
+    if (!delta->base->with_content) {
+        if (n < 0 && max_values > 0) {
+            values[0].data = "Found";
+            values[0].len = 5;
+        }
+        return 1;
+    }
+    size_t i = n < 0 ? 0 : n;
+    for (const DeltaValue *v = entry->head; v; v = v->next, ++i) {
+        if (i < max_values) {
+            values[i].data = v->data;
+            values[i].len = v->len;
+        }
+    }
+    return i;
+}
+
+/**
+ * State of `trie_merge()`.
+ */
+typedef struct {
+    Trie *base;
+    Trie *out;
+    const DeltaEntry **entries; /**< Entries of the delta sorted by key. */
+    size_t num_entries;
+    size_t next;                /**< First entry not yet written. */
+    TrieValue *values;          /**< Space for values of a base key. */
+    size_t max_values;
+    char *buf;                  /**< Space for decoded values. */
+    size_t buf_len;
+    char *value;                /**< The value being inserted. */
+    size_t value_cap;
+} Merge;
+
+static int compare_keys(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+    int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return a_len < b_len ? -1 : a_len > b_len;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const DeltaEntry *x = *(const DeltaEntry * const *) a;
+    const DeltaEntry *y = *(const DeltaEntry * const *) b;
+    return compare_keys(x->key, x->key_len, y->key, y->key_len);
+}
+
+/**
+ * Insert a value into the output. It is copied to add the terminating NUL.
+ */
+static int insert_value(Merge *m, const char *key, const char *data, size_t len)
+{
+    if (!m->out->with_content) {
+        return trie_insert(m->out, key, NULL);
+    }
+    if (len + 1 > m->value_cap) {
+        char *value = realloc(m->value, 2 * (len + 1));
+        if (!value) {
+            set_last_error(ERROR_NOMEM);
+            return -1;
+        }
+        m->value = value;
+        m->value_cap = 2 * (len + 1);
+    }
+    memcpy(m->value, data, len);
+    m->value[len] = 0;
+    return trie_insert(m->out, key, m->value);
+}
+
+static int insert_entry(Merge *m, const DeltaEntry *entry)
+{
+    if (!m->out->with_content && entry->count > 0) {
+        return insert_value(m, entry->key, NULL, 0);
+    }
+    for (const DeltaValue *v = entry->head; v; v = v->next) {
+        if (insert_value(m, entry->key, v->data, v->len) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int insert_base(Merge *m, const char *key, size_t key_len, NodeId node)
+{
+    for (;;) {
+        ssize_t n = node_values(m->base, node, key, key_len, m->values,
+                                m->max_values, m->buf, m->buf_len);
+        if ((size_t) n > m->max_values) {
+            TrieValue *values = realloc(m->values, n * sizeof *values);
+            if (!values) {
+                set_last_error(ERROR_NOMEM);
+                return -1;
+            }
+            m->values = values;
+            m->max_values = n;
+            continue;
+        }
+        size_t total = 0;
+        bool missing = false;
+        for (ssize_t i = 0; i < n; ++i) {
+            total += m->values[i].len;
+            missing = missing || (m->values[i].data == NULL && m->values[i].len > 0);
+        }
+        if (missing) {
+            char *buf = realloc(m->buf, total);
+            if (!buf) {
+                set_last_error(ERROR_NOMEM);
+                return -1;
+            }
+            m->buf = buf;
+            m->buf_len = total;
+            continue;
+        }
+        if (!m->out->with_content) {
+            return insert_value(m, key, NULL, 0);
+        }
+        for (ssize_t i = 0; i < n; ++i) {
+            if (insert_value(m, key, m->values[i].data, m->values[i].len) < 0) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+}
+
+static int merge_key(const char *key, size_t key_len, NodeId node, void *arg)
+{
+    Merge *m = arg;
+    while (m->next < m->num_entries) {
+        const DeltaEntry *entry = m->entries[m->next];
+        int cmp = compare_keys(entry->key, entry->key_len, key, key_len);
+        if (cmp > 0) {
+            break;
+        }
+        ++m->next;
+        if (cmp < 0) {
+            if (insert_entry(m, entry) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (!entry->removed && insert_base(m, key, key_len, node) < 0) {
+            return -1;
+        }
+        return insert_entry(m, entry);
+    }
+    return insert_base(m, key, key_len, node);
+}
+
+int trie_merge(Trie *base, TrieDelta *delta, const char *filename)
+{
+    if (!base->base_mem || (delta && delta->base != base)) {
+        set_last_error(ERROR_FLAGS);
+        return -1;
+    }
+    unsigned flags = TRIE_BUILD_SORTED
+        | (base->flags & (TRIE_BUILD_RADIX | TRIE_BUILD_KEY_COUNTS));
+    Merge m = { .base = base };
+    m.out = trie_new_ex(base->with_content, base->use_compress, flags);
+    if (!m.out) {
+        return -1;
+    }
+    if (delta) {
+        m.num_entries = delta->len;
+        m.entries = malloc((delta->len + 1) * sizeof *m.entries);
+        if (!m.entries) {
+            set_last_error(ERROR_NOMEM);
+            trie_free(m.out);
+            return -1;
+        }
+        for (size_t i = 0; i < delta->len; ++i) {
+            m.entries[i] = delta->entries + i;
+        }
+        qsort(m.entries, m.num_entries, sizeof *m.entries, compare_entries);
+    }
+
+    int ret = walk_keys(base, merge_key, &m);
+    for (; ret == 0 && m.next < m.num_entries; ++m.next) {
+        ret = insert_entry(&m, m.entries[m.next]);
+    }
+
+    if (ret == 0) {
+        FILE *fh = fopen(filename, "w");
+        if (!fh) {
+            set_last_error(ERROR_OPEN);
+            ret = -1;
+        } else {
+            stream_finish(m.out, fh);
+            if (fclose(fh) != 0) {
+                set_last_error(ERROR_OPEN);
+                ret = -1;
+            }
+        }
+    }
+
+    trie_free(m.out);
+    free(m.entries);
+    free(m.values);
+    free(m.buf);
+    free(m.value);
+    return ret;
+}
@@ -0,0 +1,179 @@
+#include "trie-private.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Reloadable handle. Readers publish the epoch in which they started using
+ * the trie in a slot of their own, a reload publishes the new trie, starts a
+ * new epoch and frees the old trie once no slot is in an older epoch. Readers
+ * never take a lock or wait for a reload; only the reloading thread waits.
+ */
+
+/**
+ * State of a single reader thread. The epoch is written by the owning thread
+ * and read by reloads, the depth is only used by the owning thread.
+ */
+typedef struct {
+    ThreadSlot base;
+    uint64_t epoch;     /**< Epoch when the trie was acquired, 0 if not. */
+    unsigned depth;     /**< Number of nested acquisitions. */
+    Trie *trie;         /**< Trie returned by the outermost acquisition. */
+} ReaderSlot;
+
+struct trie_handle {
+    Trie *current;          /**< Trie returned to new readers. */
+    uint64_t epoch;         /**< Current epoch, starts at 1. */
+    ThreadSlots slots;      /**< Slots of all threads that read the handle. */
+    pthread_mutex_t reload; /**< Serializes reloads. */
+    char *filename;         /**< File that was loaded last. */
+    unsigned flags;
+    unsigned prewarm;
+};
+
+/**
+ * Load and prewarm a file with the settings of the handle.
+ */
+static Trie * load(TrieHandle *handle, const char *filename)
+{
+    Trie *trie = trie_load_ex(filename, handle->flags);
+    if (trie && handle->prewarm > 0) {
+        trie_prewarm(trie, handle->prewarm);
+    }
+    return trie;
+}
+
+TrieHandle * trie_handle_open(const char *filename, unsigned flags,
+                              unsigned prewarm)
+{
+    TrieHandle *handle = calloc(1, sizeof *handle);
+    if (!handle) {
+        return NULL;
+    }
+    handle->filename = strdup(filename);
+    handle->flags = flags;
+    handle->prewarm = prewarm;
+    handle->epoch = 1;
+    thread_slots_init(&handle->slots);
+    if (!handle->filename) {
+        free(handle);
+        return NULL;
+    }
+    handle->current = load(handle, filename);
+    if (!handle->current) {
+        free(handle->filename);
+        free(handle);
+        return NULL;
+    }
+    pthread_mutex_init(&handle->reload, NULL);
+    return handle;
+}
+
+void trie_handle_close(TrieHandle *handle)
+{
+    if (!handle) {
+        return;
+    }
+    thread_slots_free(&handle->slots);
+    trie_free(handle->current);
+    pthread_mutex_destroy(&handle->reload);
+    free(handle->filename);
+    free(handle);
+}
+
+/**
+ * Find the slot of the calling thread. If the thread never read the handle,
+ * a slot is added only when `create` is set.
+ */
+static ReaderSlot * reader_slot(TrieHandle *handle, bool create)
+{
+    return (ReaderSlot *) thread_slots_get(&handle->slots,
+                                           create ? sizeof (ReaderSlot) : 0);
+}
+
+Trie * trie_handle_acquire(TrieHandle *handle)
+{
+    ReaderSlot *slot = reader_slot(handle, true);
+    if (!slot) {
+        return NULL;
+    }
+    if (slot->depth++ > 0) {
+        return slot->trie;
+    }
+    /* The epoch must be visible to reloads before the trie is read, so that
+     * a reload that replaces this trie afterwards waits for the slot. */
+    uint64_t epoch = __atomic_load_n(&handle->epoch, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&slot->epoch, epoch, __ATOMIC_SEQ_CST);
+    slot->trie = __atomic_load_n(&handle->current, __ATOMIC_SEQ_CST);
+    return slot->trie;
+}
+
+void trie_handle_release(TrieHandle *handle)
+{
+    /* A thread that acquired the handle always has a slot. */
+    ReaderSlot *slot = reader_slot(handle, false);
+    if (!slot || slot->depth == 0 || --slot->depth > 0) {
+        return;
+    }
+    slot->trie = NULL;
+    __atomic_store_n(&slot->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Whether some reader may still use a trie that was current before `epoch`.
+ */
+static bool has_old_readers(TrieHandle *handle, uint64_t epoch)
+{
+    for (ThreadSlot *slot = thread_slots_first(&handle->slots); slot;
+            slot = slot->next) {
+        uint64_t reader = __atomic_load_n(&((ReaderSlot *) slot)->epoch,
+                                          __ATOMIC_SEQ_CST);
+        if (reader != 0 && reader < epoch) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Wait until all readers that started before `epoch` released the trie. The
+ * first rounds only yield, as most readers finish within a single lookup.
+ */
+static void wait_for_readers(TrieHandle *handle, uint64_t epoch)
+{
+    for (unsigned round = 0; has_old_readers(handle, epoch); ++round) {
+        if (round < 64) {
+            sched_yield();
+        } else {
+            struct timespec ts = { 0, 100000 };
+            nanosleep(&ts, NULL);
+        }
+    }
+}
+
+int trie_handle_reload(TrieHandle *handle, const char *filename)
+{
+    pthread_mutex_lock(&handle->reload);
+    char *name = strdup(filename ? filename : handle->filename);
+    Trie *trie = name ? load(handle, name) : NULL;
+    if (!trie) {
+        pthread_mutex_unlock(&handle->reload);
+        free(name);
+        return -1;
+    }
+    free(handle->filename);
+    handle->filename = name;
+
+    /* Only reloads change the current trie and they hold the lock. */
+    if (counters_active(handle->current)) {
+        trie_set_counters(trie, 1);
+    }
+    Trie *old = __atomic_exchange_n(&handle->current, trie, __ATOMIC_SEQ_CST);
+    uint64_t epoch = __atomic_add_fetch(&handle->epoch, 1, __ATOMIC_SEQ_CST);
+    wait_for_readers(handle, epoch);
+    trie_free(old);
+    pthread_mutex_unlock(&handle->reload);
+    return 0;
+}
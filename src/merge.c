@@ -0,0 +1,219 @@
+#include <config.h>
+#include "trie.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Split a line into key and value like `list-compile` does. Returns 0 if the
+ * line should be skipped.
+ */
+static int
+parse_line(char *line, const char *delimiter, int with_content,
+           char **key, char **val)
+{
+    char *pch = strchr(line, '\n');
+    if (pch)
+        *pch = 0;
+    if (strlen(line) <= 1)
+        return 0;
+    *val = NULL;
+    if (with_content) {
+        *key = strtok(line, delimiter);
+        *val = strtok(NULL, "\n");
+        if (!*val)
+            return 0;
+    } else {
+        *key = line;
+    }
+    return 1;
+}
+
+static FILE * open_input(const char *filename)
+{
+    if (strcmp(filename, "-") == 0) {
+        return stdin;
+    }
+    FILE *fh = fopen(filename, "r");
+    if (!fh) {
+        perror(filename);
+    }
+    return fh;
+}
+
+/**
+ * Remove every key listed in the file, one per line.
+ *
+ * @return  number of keys or -1 on failure
+ */
+static long remove_keys(TrieDelta *delta, const char *filename)
+{
+    FILE *fh = open_input(filename);
+    if (!fh) {
+        return -1;
+    }
+    char *line = NULL;
+    size_t len = 0;
+    long count = 0;
+    while (getline(&line, &len, fh) > 0) {
+        line[strcspn(line, "\n")] = 0;
+        if (!*line) {
+            continue;
+        }
+        if (trie_delta_remove(delta, line) < 0) {
+            fprintf(stderr, "Failed to remove '%s': %s\n", line,
+                    trie_get_last_error());
+            count = -1;
+            break;
+        }
+        ++count;
+    }
+    free(line);
+    if (fh != stdin) {
+        fclose(fh);
+    }
+    return count;
+}
+
+/**
+ * Insert every line of the file like `list-compile` would.
+ *
+ * @return  number of inserted items or -1 on failure
+ */
+static long
+add_lines(TrieDelta *delta, const char *filename, const char *delimiter,
+          int with_content)
+{
+    FILE *fh = open_input(filename);
+    if (!fh) {
+        return -1;
+    }
+    char *line = NULL;
+    size_t len = 0;
+    long count = 0;
+    while (getline(&line, &len, fh) > 0) {
+        char *key, *val;
+        if (!parse_line(line, delimiter, with_content, &key, &val))
+            continue;
+        if (trie_delta_insert(delta, key, val) < 0) {
+            fprintf(stderr, "Failed to insert '%s': %s\n", key,
+                    trie_get_last_error());
+            count = -1;
+            break;
+        }
+        ++count;
+    }
+    free(line);
+    if (fh != stdin) {
+        fclose(fh);
+    }
+    return count;
+}
+
+static void usage(FILE *fh, const char *prog)
+{
+    fprintf(fh, "Usage: %s [OPTIONS...] BASE OUTPUT\n", prog);
+}
+
+static void help(const char *prog)
+{
+    usage(stdout, prog);
+    puts("\nWrite the compiled trie BASE with changes applied into OUTPUT.");
+    puts("\nAvailable options:");
+    puts("  -a, --add=FILE      add lines of FILE in the format of list-compile");
+    puts("  -x, --remove=FILE   remove keys listed in FILE, one per line");
+    puts("  -dDELIMITER         set delimiter between key and value");
+    puts("  -e                  BASE was compiled with -e, lines are whole keys");
+    puts("  -h, --help          print this help");
+    puts("");
+    puts("Keys are removed before the lines are added, so a key that is both");
+    puts("removed and added gets only the new values. FILE can be - for");
+    puts("standard input.");
+    puts("");
+    puts("This is list-merge from "PACKAGE" "VERSION".");
+    puts("File bug reports at <"PACKAGE_URL">.");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *delimiter = ":";
+    const char *add = NULL;
+    const char *remove = NULL;
+    int with_content = 1;
+
+    static const struct option long_options[] = {
+        { "add", required_argument, NULL, 'a' },
+        { "remove", required_argument, NULL, 'x' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "a:x:d:eh", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'a':
+            add = optarg;
+            break;
+        case 'x':
+            remove = optarg;
+            break;
+        case 'd':
+            delimiter = optarg;
+            break;
+        case 'e':
+            with_content = 0;
+            break;
+        case 'h':
+            help(argv[0]);
+            return 0;
+        default:
+            usage(stderr, argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind != argc - 2) {
+        fprintf(stderr, "Expected base and output file names\n");
+        return 1;
+    }
+    if (add && remove && strcmp(add, "-") == 0 && strcmp(remove, "-") == 0) {
+        fprintf(stderr, "Only one of -a and -x can read standard input\n");
+        return 1;
+    }
+
+    Trie *trie = trie_load(argv[optind]);
+    if (!trie) {
+        fprintf(stderr, "Failed to load trie: %s\n", trie_get_last_error());
+        return 2;
+    }
+    TrieDelta *delta = trie_delta_new(trie);
+    if (!delta) {
+        fprintf(stderr, "Failed to create delta: %s\n", trie_get_last_error());
+        trie_free(trie);
+        return 3;
+    }
+
+    int ret = 0;
+    long removed = 0, added = 0;
+    if (remove) {
+        removed = remove_keys(delta, remove);
+    }
+    if (add && removed >= 0) {
+        added = add_lines(delta, add, delimiter, with_content);
+    }
+    if (removed < 0 || added < 0) {
+        ret = 3;
+    } else if (trie_merge(trie, delta, argv[optind + 1]) < 0) {
+        fprintf(stderr, "Failed to write %s: %s\n", argv[optind + 1],
+                trie_get_last_error());
+        ret = 3;
+    } else {
+        printf("Removed %ld keys, added %ld items\n", removed, added);
+    }
+
+    trie_delta_free(delta);
+    trie_free(trie);
+    return ret;
+}
@@ -0,0 +1,229 @@
+#include "trie-private.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Helpers for building the trie with multiple threads.
+ */
+
+typedef struct {
+    size_t start;
+    size_t end;
+    void (*fn)(size_t, size_t, void *);
+    void *arg;
+} RangeJob;
+
+static void * run_range(void *arg)
+{
+    RangeJob *job = arg;
+    job->fn(job->start, job->end, job->arg);
+    return NULL;
+}
+
+void parallel_for(size_t start, size_t end, unsigned threads,
+                  void (*fn)(size_t, size_t, void *), void *arg)
+{
+    size_t total = end > start ? end - start : 0;
+    if (threads <= 1 || total < threads) {
+        fn(start, end, arg);
+        return;
+    }
+
+    RangeJob jobs[threads];
+    pthread_t ids[threads];
+    for (unsigned i = 0; i < threads; ++i) {
+        jobs[i].start = start + total * i / threads;
+        jobs[i].end = start + total * (i + 1) / threads;
+        jobs[i].fn = fn;
+        jobs[i].arg = arg;
+    }
+    /* The calling thread takes the first range itself. */
+    for (unsigned i = 1; i < threads; ++i) {
+        if (pthread_create(ids + i, NULL, run_range, jobs + i) != 0) {
+            run_range(jobs + i);
+            ids[i] = pthread_self();
+        }
+    }
+    run_range(jobs);
+    for (unsigned i = 1; i < threads; ++i) {
+        if (!pthread_equal(ids[i], pthread_self())) {
+            pthread_join(ids[i], NULL);
+        }
+    }
+}
+
+typedef struct {
+    char *base;
+    char *tmp;
+    size_t n;
+    size_t size;
+    int (*compare)(const void *, const void *);
+    size_t run;         /**< Length of already sorted runs. */
+} SortJob;
+
+static void sort_runs(size_t start, size_t end, void *arg)
+{
+    SortJob *job = arg;
+    for (size_t i = start; i < end; ++i) {
+        size_t from = i * job->run;
+        size_t to = from + job->run < job->n ? from + job->run : job->n;
+        qsort(job->base + from * job->size, to - from, job->size, job->compare);
+    }
+}
+
+/**
+ * Merge pairs of neighbouring runs into the temporary array.
+ */
+static void merge_runs(size_t start, size_t end, void *arg)
+{
+    SortJob *job = arg;
+    size_t size = job->size;
+    for (size_t i = start; i < end; ++i) {
+        size_t lo = 2 * i * job->run;
+        size_t mid = lo + job->run < job->n ? lo + job->run : job->n;
+        size_t hi = mid + job->run < job->n ? mid + job->run : job->n;
+        size_t a = lo, b = mid, out = lo;
+        while (a < mid && b < hi) {
+            /* Take from the left run on ties to keep the merge stable. */
+            if (job->compare(job->base + b * size, job->base + a * size) < 0) {
+                memcpy(job->tmp + out++ * size, job->base + b++ * size, size);
+            } else {
+                memcpy(job->tmp + out++ * size, job->base + a++ * size, size);
+            }
+        }
+        memcpy(job->tmp + out * size, job->base + a * size, (mid - a) * size);
+        out += mid - a;
+        memcpy(job->tmp + out * size, job->base + b * size, (hi - b) * size);
+    }
+}
+
+void parallel_sort(void *base, size_t n, size_t size,
+                   int (*compare)(const void *, const void *),
+                   unsigned threads)
+{
+    if (threads <= 1 || n < 2 * threads) {
+        qsort(base, n, size, compare);
+        return;
+    }
+    SortJob job = {
+        .base = base,
+        .tmp = malloc(n * size),
+        .n = n,
+        .size = size,
+        .compare = compare,
+        .run = (n + threads - 1) / threads,
+    };
+    parallel_for(0, threads, threads, sort_runs, &job);
+
+    while (job.run < n) {
+        size_t pairs = (n + 2 * job.run - 1) / (2 * job.run);
+        parallel_for(0, pairs, threads, merge_runs, &job);
+        char *swap = job.base;
+        job.base = job.tmp;
+        job.tmp = swap;
+        job.run *= 2;
+    }
+    if (job.base != base) {
+        memcpy(base, job.base, n * size);
+        job.tmp = job.base;
+    }
+    free(job.tmp);
+}
+
+/**
+ * Make sure an array has room for `needed` items.
+ */
+static void * reserve(void *array, uint32_t *len, size_t needed, size_t item)
+{
+    if (needed <= *len) {
+        return array;
+    }
+    while (*len < needed) {
+        *len *= 2;
+    }
+    return realloc(array, *len * item);
+}
+
+/**
+ * Move all nodes, chunks and data of `part` into `trie`. The root of the part
+ * is merged with the root of the trie.
+ */
+static void join_part(Trie *trie, Trie *part)
+{
+    /* Node 1 of part becomes node 1 of trie, other nodes are appended. */
+    NodeId node_base = trie->idx - 2;
+    ChunkId chunk_base = trie->chunks_idx - 1;
+    DataId data_base = trie->with_content ? trie->data_idx - 1 : 0;
+
+    trie->nodes = reserve(trie->nodes, &trie->len,
+                          trie->idx + part->idx - 2, sizeof *trie->nodes);
+    trie->chunks = reserve(trie->chunks, &trie->chunks_len,
+                           trie->chunks_idx + part->chunks_idx - 1,
+                           sizeof *trie->chunks);
+    if (trie->with_content) {
+        trie->data_builder = reserve(trie->data_builder, &trie->data_len,
+                                     trie->data_idx + part->data_idx - 1,
+                                     sizeof *trie->data_builder);
+        memcpy(trie->data_builder + trie->data_idx, part->data_builder + 1,
+               (part->data_idx - 1) * sizeof *trie->data_builder);
+        trie->data_idx += part->data_idx - 1;
+        arena_merge(&trie->arena, &part->arena);
+    }
+
+    for (ChunkId c = 1; c < part->chunks_idx; ++c) {
+        TrieNodeChunkBuilder *chunk = trie->chunks + trie->chunks_idx++;
+        *chunk = part->chunks[c];
+        chunk->value += node_base;
+        if (chunk->next) {
+            chunk->next += chunk_base;
+        }
+    }
+
+    for (NodeId idx = 2; idx < part->idx; ++idx) {
+        TrieNode *node = trie->nodes + trie->idx++;
+        *node = part->nodes[idx];
+        if (node->chunk) {
+            node->chunk += chunk_base;
+        }
+        if (node->data && trie->with_content) {
+            node->data += data_base;
+        }
+    }
+
+    /* Children of the part root are added to the list of the trie root. */
+    ChunkId part_root = part->nodes[1].chunk;
+    if (part_root) {
+        ChunkId last = trie->nodes[1].chunk;
+        if (!last) {
+            trie->nodes[1].chunk = part_root + chunk_base;
+        } else {
+            while (trie->chunks[last].next) {
+                last = trie->chunks[last].next;
+            }
+            trie->chunks[last].next = part_root + chunk_base;
+        }
+    }
+    if (part->nodes[1].data) {
+        assert(trie->nodes[1].data == 0);
+        trie->nodes[1].data = part->nodes[1].data + data_base;
+    }
+
+    trie_free(part);
+}
+
+Trie * trie_join(Trie **parts, size_t count)
+{
+    if (count == 0) {
+        return NULL;
+    }
+    Trie *trie = parts[0];
+    for (size_t i = 1; i < count; ++i) {
+        assert(parts[i]->with_content == trie->with_content);
+        assert(!parts[i]->stream && !trie->stream);
+        join_part(trie, parts[i]);
+    }
+    return trie;
+}
@@ -1,48 +1,800 @@
 #include <config.h>
 #include "trie.h"
+#include "trie-client.h"
 
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <string.h>
+#include <unistd.h>
+
+/**
+ * How much input each thread gets in one round. The input is read in blocks
+ * of this size and each thread looks up the keys of one block.
+ */
+#define BLOCK_SIZE (1 << 20)
+
+#define MAX_JOBS 256
+
+/**
+ * Keys of a block are looked up with `trie_lookup_batch_into()` in groups of
+ * this many keys.
+ */
+#define LOOKUP_BATCH 64
+
+/**
+ * When querying a server, keys are sent in requests of this many keys and at
+ * most `REMOTE_WINDOW` requests are waiting for a response at any time.
+ */
+#define REMOTE_BATCH 256
+#define REMOTE_WINDOW 16
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} Buffer;
+
+static void buffer_reserve(Buffer *buf, size_t needed)
+{
+    if (needed <= buf->cap) {
+        return;
+    }
+    buf->cap = buf->cap ? buf->cap : BLOCK_SIZE;
+    while (buf->cap < needed) {
+        buf->cap *= 2;
+    }
+    buf->data = realloc(buf->data, buf->cap);
+    if (!buf->data) {
+        perror("realloc");
+        exit(2);
+    }
+}
+
+static void buffer_append(Buffer *buf, const char *data, size_t len)
+{
+    buffer_reserve(buf, buf->len + len);
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+/**
+ * What is printed for each input.
+ */
+typedef enum {
+    MODE_LOOKUP,            /**< Values of the key. */
+    MODE_FUZZY,             /**< Keys within a number of edits. */
+    MODE_PREFIX,            /**< Keys starting with the input. */
+    MODE_COMMON_PREFIXES,   /**< Keys the input starts with. */
+    MODE_SEGMENT,           /**< The input split into keys. */
+    MODE_ID,                /**< Number of the key. */
+    MODE_KEY_BY_ID,         /**< Key with the number given as input. */
+    MODE_COUNT,             /**< Number of keys starting with the input. */
+} Mode;
+
+typedef struct {
+    char delim;             /**< Separator of keys and results. */
+    const char *not_found;  /**< What to print for missing keys. */
+    size_t not_found_len;
+    const char *server;     /**< Socket of list-serve to query, if any. */
+    unsigned trie_index;    /**< Which trie of the server to query. */
+    Mode mode;
+    unsigned fuzzy;         /**< Largest edit distance of fuzzy matches. */
+    size_t limit;           /**< Most keys printed per prefix, 0 for all. */
+    const char *after;      /**< Print only keys after this one, if any. */
+} Options;
+
+/**
+ * Block of input processed by a single thread.
+ */
+typedef struct {
+    Trie *trie;
+    TrieClient *client;     /**< Connection to the server if there is one. */
+    const Options *opts;
+    Buffer in;      /**< Complete keys, each followed by the delimiter. */
+    Buffer out;     /**< Results of the keys. */
+    const char *input;  /**< Input being searched by `run_match_job()`. */
+} Job;
+
+/**
+ * Append the results of the next request sent by `run_remote_job()`.
+ */
+static void receive_results(Job *job)
+{
+    TrieClientResponse res;
+    if (trie_client_recv(job->client, &res) < 0) {
+        perror("Failed to receive response");
+        exit(2);
+    }
+    if (res.status != 0) {
+        fprintf(stderr, "Server failed with status %u\n", res.status);
+        exit(2);
+    }
+    const TrieValue *value = res.values;
+    for (size_t i = 0; i < res.num_keys; ++i) {
+        if (res.counts[i] < 0) {
+            buffer_append(&job->out, job->opts->not_found,
+                          job->opts->not_found_len);
+        }
+        for (ssize_t j = 0; j < res.counts[i]; ++j, ++value) {
+            if (j > 0) {
+                buffer_append(&job->out, "\n", 1);
+            }
+            buffer_append(&job->out, value->data, value->len);
+        }
+        buffer_append(&job->out, &job->opts->delim, 1);
+    }
+}
+
+/**
+ * Look up all keys of the job on the server. Requests are pipelined and the
+ * responses come in the same order, so they are appended as they arrive.
+ */
+static void run_remote_job(Job *job)
+{
+    char delim = job->opts->delim;
+    const char *pos = job->in.data;
+    const char *end = job->in.data + job->in.len;
+    const char *keys[REMOTE_BATCH];
+    size_t lens[REMOTE_BATCH];
+    unsigned waiting = 0;
+
+    job->out.len = 0;
+    while (pos < end || waiting > 0) {
+        if (pos == end || waiting == REMOTE_WINDOW) {
+            receive_results(job);
+            --waiting;
+            continue;
+        }
+        size_t n = 0;
+        while (n < REMOTE_BATCH && pos < end) {
+            const char *eol = memchr(pos, delim, end - pos);
+            keys[n] = pos;
+            lens[n++] = eol - pos;
+            pos = eol + 1;
+        }
+        if (trie_client_send(job->client, job->opts->trie_index, keys, lens,
+                             n) < 0) {
+            perror("Failed to send request");
+            exit(2);
+        }
+        ++waiting;
+    }
+}
+
+/**
+ * Append a key found by fuzzy search as a line for each of its values.
+ */
+static int
+print_match(const char *key, size_t key_len, unsigned edits,
+            const TrieValue *values, size_t num_values, void *arg)
+{
+    Job *job = arg;
+    char distance[16];
+    int len = snprintf(distance, sizeof distance, "\t%u\t", edits);
+    for (size_t i = 0; i < num_values; ++i) {
+        buffer_append(&job->out, key, key_len);
+        buffer_append(&job->out, distance, len);
+        buffer_append(&job->out, values[i].data, values[i].len);
+        buffer_append(&job->out, &job->opts->delim, 1);
+    }
+    return 0;
+}
+
+/**
+ * Find keys close to each key of the job. Every match is printed as the key,
+ * its distance and a value separated by tabs, and the matches of each key
+ * are followed by an empty line.
+ */
+static void run_fuzzy_job(Job *job)
+{
+    char delim = job->opts->delim;
+    const char *pos = job->in.data;
+    const char *end = job->in.data + job->in.len;
+
+    job->out.len = 0;
+    while (pos < end) {
+        const char *eol = memchr(pos, delim, end - pos);
+        if (trie_fuzzy_search(job->trie, pos, eol - pos, job->opts->fuzzy,
+                              print_match, job) < 0) {
+            fprintf(stderr, "Out of memory\n");
+            exit(2);
+        }
+        buffer_append(&job->out, &delim, 1);
+        pos = eol + 1;
+    }
+}
+
+/**
+ * Find the keys starting with each input of the job. Every key is printed
+ * with a value, separated by a tab, and the keys of each prefix are followed
+ * by an empty line.
+ */
+static void run_prefix_job(Job *job)
+{
+    char delim = job->opts->delim;
+    const char *pos = job->in.data;
+    const char *end = job->in.data + job->in.len;
+    const char *after = job->opts->after;
+    size_t after_len = after ? strlen(after) : 0;
+    TrieIter *iter = trie_iter_prefix(job->trie, "", 0, NULL, 0);
+    if (!iter) {
+        fprintf(stderr, "Out of memory\n");
+        exit(2);
+    }
+
+    job->out.len = 0;
+    while (pos < end) {
+        const char *eol = memchr(pos, delim, end - pos);
+        if (trie_iter_restart(iter, pos, eol - pos, after, after_len) < 0) {
+            fprintf(stderr, "Out of memory\n");
+            exit(2);
+        }
+        const char *key;
+        size_t key_len, num_values;
+        const TrieValue *values;
+        size_t count = 0;
+        int ret = 0;
+        while ((job->opts->limit == 0 || count < job->opts->limit)
+               && (ret = trie_iter_next(iter, &key, &key_len, &values,
+                                        &num_values)) > 0) {
+            for (size_t i = 0; i < num_values; ++i) {
+                buffer_append(&job->out, key, key_len);
+                buffer_append(&job->out, "\t", 1);
+                buffer_append(&job->out, values[i].data, values[i].len);
+                buffer_append(&job->out, &delim, 1);
+            }
+            ++count;
+        }
+        if (ret < 0) {
+            fprintf(stderr, "Out of memory\n");
+            exit(2);
+        }
+        buffer_append(&job->out, &delim, 1);
+        pos = eol + 1;
+    }
+    trie_iter_free(iter);
+}
+
+/**
+ * Append a key found in the input as a line for each of its values, or with
+ * the not found string for parts of the input that are not keys.
+ */
+static int
+print_part(size_t offset, size_t len, const TrieValue *values,
+           ssize_t num_values, void *arg)
+{
+    Job *job = arg;
+    if (num_values < 0) {
+        buffer_append(&job->out, job->input + offset, len);
+        buffer_append(&job->out, "\t", 1);
+        buffer_append(&job->out, job->opts->not_found, job->opts->not_found_len);
+        buffer_append(&job->out, &job->opts->delim, 1);
+    }
+    for (ssize_t i = 0; i < num_values; ++i) {
+        buffer_append(&job->out, job->input + offset, len);
+        buffer_append(&job->out, "\t", 1);
+        buffer_append(&job->out, values[i].data, values[i].len);
+        buffer_append(&job->out, &job->opts->delim, 1);
+    }
+    return 0;
+}
+
+/**
+ * Find the keys each input of the job starts with, or split the inputs into
+ * keys. Every key is printed with a value, separated by a tab, and the keys
+ * of each input are followed by an empty line.
+ */
+static void run_match_job(Job *job)
+{
+    char delim = job->opts->delim;
+    const char *pos = job->in.data;
+    const char *end = job->in.data + job->in.len;
+
+    job->out.len = 0;
+    while (pos < end) {
+        const char *eol = memchr(pos, delim, end - pos);
+        job->input = pos;
+        ssize_t n = job->opts->mode == MODE_SEGMENT
+            ? trie_segment(job->trie, pos, eol - pos, print_part, job)
+            : trie_common_prefix_search(job->trie, pos, eol - pos, print_part,
+                                        job);
+        if (n < 0) {
+            fprintf(stderr, "Out of memory\n");
+            exit(2);
+        }
+        buffer_append(&job->out, &delim, 1);
+        pos = eol + 1;
+    }
+}
+
+/**
+ * Print one number or key for each input of the job, using the key counts of
+ * the trie.
+ */
+static void run_number_job(Job *job)
+{
+    char delim = job->opts->delim;
+    const char *pos = job->in.data;
+    const char *end = job->in.data + job->in.len;
+
+    job->out.len = 0;
+    while (pos < end) {
+        const char *eol = memchr(pos, delim, end - pos);
+        ssize_t n;
+        if (job->opts->mode == MODE_KEY_BY_ID) {
+            char *last;
+            unsigned long long id = strtoull(pos, &last, 10);
+            n = last == eol && last > pos
+                ? trie_key_by_id(job->trie, id, NULL, 0) : -1;
+            if (n >= 0) {
+                buffer_reserve(&job->out, job->out.len + n + 1);
+                trie_key_by_id(job->trie, id, job->out.data + job->out.len,
+                               n + 1);
+                job->out.len += n;
+            }
+        } else {
+            n = job->opts->mode == MODE_ID
+                ? trie_lookup_id(job->trie, pos, eol - pos)
+                : trie_count_prefix(job->trie, pos, eol - pos);
+            if (n >= 0) {
+                char number[32];
+                buffer_append(&job->out, number,
+                              snprintf(number, sizeof number, "%zd", n));
+            }
+        }
+        if (n < 0) {
+            buffer_append(&job->out, job->opts->not_found,
+                          job->opts->not_found_len);
+        }
+        buffer_append(&job->out, &delim, 1);
+        pos = eol + 1;
+    }
+}
 
-void run_loop(Trie *trie)
+/**
+ * Look up a group of keys and append their results to the output. The values
+ * are written directly into the output buffer and then moved apart, starting
+ * from the last one, to make room for the delimiters and the not found
+ * strings.
+ */
+static void
+lookup_keys(Job *job, const char *const *keys, const size_t *key_lens, size_t n)
 {
-    char buffer[1024];
-    while (fgets(buffer, sizeof buffer, stdin)) {
-        char *pch = strchr(buffer, '\n');
-        *pch = 0;
-        const char *data = trie_lookup(trie, buffer);
-        if (data) {
-            puts(data);
-            trie_result_free(trie, data);
+    Buffer *out = &job->out;
+    ssize_t lens[LOOKUP_BATCH];
+    size_t base = out->len;
+    size_t total;
+    for (;;) {
+        size_t avail = out->cap - base;
+        total = trie_lookup_batch_into(job->trie, keys, key_lens, n,
+                                       out->data + base, avail, lens);
+        if (total <= avail) {
+            break;
+        }
+        buffer_reserve(out, base + total);
+    }
+
+    size_t len = total;
+    for (size_t i = 0; i < n; ++i) {
+        len += 1 + (lens[i] < 0 ? job->opts->not_found_len : 0);
+    }
+    buffer_reserve(out, base + len);
+    size_t src = base + total, dst = base + len;
+    for (size_t i = n; i-- > 0;) {
+        out->data[--dst] = job->opts->delim;
+        if (lens[i] < 0) {
+            dst -= job->opts->not_found_len;
+            memcpy(out->data + dst, job->opts->not_found,
+                   job->opts->not_found_len);
         } else {
-            puts("Not found");
+            src -= lens[i];
+            dst -= lens[i];
+            memmove(out->data + dst, out->data + src, lens[i]);
         }
     }
+    out->len = base + len;
+}
+
+/**
+ * Look up all keys of the job. The results are written directly into the
+ * output buffer without any intermediate copies.
+ */
+static void * run_job(void *arg)
+{
+    Job *job = arg;
+    if (job->client) {
+        run_remote_job(job);
+        return NULL;
+    }
+    switch (job->opts->mode) {
+    case MODE_LOOKUP:
+        break;
+    case MODE_FUZZY:
+        run_fuzzy_job(job);
+        return NULL;
+    case MODE_PREFIX:
+        run_prefix_job(job);
+        return NULL;
+    case MODE_COMMON_PREFIXES:
+    case MODE_SEGMENT:
+        run_match_job(job);
+        return NULL;
+    case MODE_ID:
+    case MODE_KEY_BY_ID:
+    case MODE_COUNT:
+        run_number_job(job);
+        return NULL;
+    }
+    char delim = job->opts->delim;
+    const char *pos = job->in.data;
+    const char *end = job->in.data + job->in.len;
+
+    const char *keys[LOOKUP_BATCH];
+    size_t key_lens[LOOKUP_BATCH];
+    size_t n = 0;
+
+    job->out.len = 0;
+    while (pos < end) {
+        const char *eol = memchr(pos, delim, end - pos);
+        keys[n] = pos;
+        key_lens[n++] = eol - pos;
+        if (n == LOOKUP_BATCH) {
+            lookup_keys(job, keys, key_lens, n);
+            n = 0;
+        }
+        pos = eol + 1;
+    }
+    if (n > 0) {
+        lookup_keys(job, keys, key_lens, n);
+    }
+    return NULL;
+}
+
+/**
+ * Fill input of the job with whole keys. Bytes after the last complete key
+ * are moved to `rest`.
+ *
+ * @return  false if there is no more input
+ */
+static bool read_block(int fd, Job *job, Buffer *rest, char delim)
+{
+    job->in.len = 0;
+    buffer_append(&job->in, rest->data, rest->len);
+    rest->len = 0;
+
+    /* Position after the last delimiter, zero if there is none. */
+    size_t complete = 0;
+    for (size_t i = job->in.len; i > 0; --i) {
+        if (job->in.data[i - 1] == delim) {
+            complete = i;
+            break;
+        }
+    }
+
+    bool eof = false;
+    while (!eof && (job->in.len < BLOCK_SIZE || complete == 0)) {
+        buffer_reserve(&job->in, job->in.len + BLOCK_SIZE);
+        ssize_t n = read(fd, job->in.data + job->in.len, job->in.cap - job->in.len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            perror("read");
+            exit(2);
+        }
+        eof = n == 0;
+        for (size_t i = job->in.len + n; i > job->in.len; --i) {
+            if (job->in.data[i - 1] == delim) {
+                complete = i;
+                break;
+            }
+        }
+        job->in.len += n;
+    }
+
+    if (eof && complete < job->in.len) {
+        /* Last key is not terminated. */
+        buffer_append(&job->in, &delim, 1);
+    } else {
+        buffer_append(rest, job->in.data + complete, job->in.len - complete);
+        job->in.len = complete;
+    }
+    return job->in.len > 0;
+}
+
+static void write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            perror("write");
+            exit(2);
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+/**
+ * Look up all keys from standard input. In each round every thread gets one
+ * block of input, and the results are written in the order of the blocks.
+ */
+void run_loop(Trie *trie, const Options *opts, unsigned threads)
+{
+    Job jobs[threads];
+    pthread_t ids[threads];
+    Buffer rest = { NULL, 0, 0 };
+    bool more = true;
+
+    memset(jobs, 0, sizeof jobs);
+    for (unsigned i = 0; i < threads; ++i) {
+        jobs[i].trie = trie;
+        jobs[i].opts = opts;
+        if (opts->server) {
+            jobs[i].client = trie_client_connect(opts->server);
+            if (!jobs[i].client) {
+                perror(opts->server);
+                exit(2);
+            }
+        }
+    }
+
+    while (more) {
+        unsigned n = 0;
+        while (n < threads && (more = read_block(STDIN_FILENO, jobs + n, &rest,
+                                                 opts->delim))) {
+            ++n;
+        }
+        /* The first block is done by this thread. */
+        for (unsigned i = 1; i < n; ++i) {
+            if (pthread_create(ids + i, NULL, run_job, jobs + i) != 0) {
+                run_job(jobs + i);
+                ids[i] = pthread_self();
+            }
+        }
+        if (n > 0) {
+            run_job(jobs);
+        }
+        for (unsigned i = 0; i < n; ++i) {
+            if (i > 0 && !pthread_equal(ids[i], pthread_self())) {
+                pthread_join(ids[i], NULL);
+            }
+            write_all(STDOUT_FILENO, jobs[i].out.data, jobs[i].out.len);
+        }
+    }
+
+    for (unsigned i = 0; i < threads; ++i) {
+        trie_client_close(jobs[i].client);
+        free(jobs[i].in.data);
+        free(jobs[i].out.data);
+    }
+    free(rest.data);
+}
+
+static void usage(FILE *fh, const char *prog)
+{
+    fprintf(fh, "Usage: %s [OPTIONS...] FILE\n", prog);
+    fprintf(fh, "       %s [OPTIONS...] -S SOCKET\n", prog);
+}
+
+static void help(const char *prog)
+{
+    usage(stdout, prog);
+    puts("\nAvailable options:");
+    puts("  -p, --populate      read the whole file when loading it");
+    puts("  -l, --lock          lock the file in memory");
+    puts("  -r, --random        disable read ahead");
+    puts("  -w, --willneed      read the file in background");
+    puts("  -H, --hugepages     copy the file into huge pages");
+    puts("  -W, --prewarm=N     read top N levels of the trie before querying");
+    puts("  -j, --jobs=N        look up keys with N threads");
+    puts("  -n, --not-found=STR print STR for missing keys (default \"Not found\")");
+    puts("  -0, --null          keys and results are terminated by NUL, not newline");
+    puts("  -S, --server=PATH   query list-serve listening on socket PATH");
+    puts("  -t, --trie=N        query N-th trie of the server (from 0)");
+    puts("  -s, --stats         print lookup counters to stderr when done");
+    puts("  -f, --fuzzy=N       print all keys within N edits of each key");
+    puts("  -P, --prefix        print all keys starting with each input");
+    puts("  -L, --limit=N       print at most N keys per input with --prefix");
+    puts("  -A, --after=KEY     print only keys after KEY with --prefix");
+    puts("  -c, --common-prefixes print all keys each input starts with");
+    puts("  -g, --segment       split each input into longest keys");
+    puts("  -i, --id            print the number of each key in sorted order");
+    puts("  -K, --key-by-id     print the key with each number");
+    puts("  -C, --count         print the number of keys starting with each input");
+    puts("  -h, --help          print this help");
+    puts("");
+    puts("This is list-query from "PACKAGE" "VERSION".");
+    puts("File bug reports at <"PACKAGE_URL">.");
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s FILE\n", argv[0]);
+    unsigned flags = 0;
+    int prewarm = 0;
+    int threads = 1;
+    int stats = 0;
+    Options opts = { .delim = '\n', .not_found = "Not found" };
+    int modes = 0;
+
+    static const struct option long_options[] = {
+        { "populate", no_argument, NULL, 'p' },
+        { "lock", no_argument, NULL, 'l' },
+        { "random", no_argument, NULL, 'r' },
+        { "willneed", no_argument, NULL, 'w' },
+        { "hugepages", no_argument, NULL, 'H' },
+        { "prewarm", required_argument, NULL, 'W' },
+        { "jobs", required_argument, NULL, 'j' },
+        { "not-found", required_argument, NULL, 'n' },
+        { "null", no_argument, NULL, '0' },
+        { "server", required_argument, NULL, 'S' },
+        { "trie", required_argument, NULL, 't' },
+        { "stats", no_argument, NULL, 's' },
+        { "fuzzy", required_argument, NULL, 'f' },
+        { "prefix", no_argument, NULL, 'P' },
+        { "limit", required_argument, NULL, 'L' },
+        { "after", required_argument, NULL, 'A' },
+        { "common-prefixes", no_argument, NULL, 'c' },
+        { "segment", no_argument, NULL, 'g' },
+        { "id", no_argument, NULL, 'i' },
+        { "key-by-id", no_argument, NULL, 'K' },
+        { "count", no_argument, NULL, 'C' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "plrwHW:j:n:0S:t:sf:PL:A:cgiKCh", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'p':
+            flags |= TRIE_LOAD_POPULATE;
+            break;
+        case 'l':
+            flags |= TRIE_LOAD_LOCK;
+            break;
+        case 'r':
+            flags |= TRIE_LOAD_RANDOM;
+            break;
+        case 'w':
+            flags |= TRIE_LOAD_WILLNEED;
+            break;
+        case 'H':
+            flags |= TRIE_LOAD_HUGEPAGES;
+            break;
+        case 'W':
+            prewarm = atoi(optarg);
+            if (prewarm < 0) {
+                fprintf(stderr, "Number of levels must not be negative\n");
+                return 1;
+            }
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            if (threads < 1 || threads > MAX_JOBS) {
+                fprintf(stderr, "Number of jobs must be between 1 and %d\n",
+                        MAX_JOBS);
+                return 1;
+            }
+            break;
+        case 'n':
+            opts.not_found = optarg;
+            break;
+        case '0':
+            opts.delim = 0;
+            break;
+        case 'S':
+            opts.server = optarg;
+            break;
+        case 't':
+            opts.trie_index = atoi(optarg);
+            break;
+        case 's':
+            stats = 1;
+            break;
+        case 'f':
+            if (atoi(optarg) < 0) {
+                fprintf(stderr, "Number of edits must not be negative\n");
+                return 1;
+            }
+            opts.fuzzy = atoi(optarg);
+            opts.mode = MODE_FUZZY;
+            ++modes;
+            break;
+        case 'P':
+            opts.mode = MODE_PREFIX;
+            ++modes;
+            break;
+        case 'c':
+            opts.mode = MODE_COMMON_PREFIXES;
+            ++modes;
+            break;
+        case 'g':
+            opts.mode = MODE_SEGMENT;
+            ++modes;
+            break;
+        case 'i':
+            opts.mode = MODE_ID;
+            ++modes;
+            break;
+        case 'K':
+            opts.mode = MODE_KEY_BY_ID;
+            ++modes;
+            break;
+        case 'C':
+            opts.mode = MODE_COUNT;
+            ++modes;
+            break;
+        case 'L':
+            opts.limit = atol(optarg);
+            break;
+        case 'A':
+            opts.after = optarg;
+            break;
+        case 'h':
+            help(argv[0]);
+            return 0;
+        default:
+            usage(stderr, argv[0]);
+            return 1;
+        }
+    }
+
+    opts.not_found_len = strlen(opts.not_found);
+    if (opts.server && stats) {
+        fprintf(stderr, "Option --stats can not be combined with --server\n");
         return 1;
     }
-    if (strcmp(argv[1], "-h") == 0) {
-        printf("Usage: %s FILE\n", argv[0]);
-        puts("This program has no other options.");
-        puts("");
-        puts("This is list-query from "PACKAGE" "VERSION".");
-        puts("File bug reports at <"PACKAGE_URL">.");
+    if (modes > 1) {
+        fprintf(stderr, "Only one of --fuzzy, --prefix, --common-prefixes,"
+                " --segment, --id, --key-by-id and --count can be used\n");
+        return 1;
+    }
+    if (opts.server && opts.mode != MODE_LOOKUP) {
+        fprintf(stderr, "Searches can not be combined with --server\n");
+        return 1;
+    }
+    if (opts.server && optind == argc) {
+        run_loop(NULL, &opts, threads);
         return 0;
     }
-    Trie *trie = trie_load(argv[1]);
+    if (opts.server || optind != argc - 1) {
+        usage(stderr, argv[0]);
+        return 1;
+    }
+
+    Trie *trie = trie_load_ex(argv[optind], flags);
     if (!trie) {
-        fprintf(stderr, "Failed to load trie\n");
+        fprintf(stderr, "Failed to load trie: %s\n", trie_get_last_error());
         return 2;
     }
+    if (prewarm > 0) {
+        trie_prewarm(trie, prewarm);
+    }
+    if ((opts.mode == MODE_ID || opts.mode == MODE_KEY_BY_ID
+         || opts.mode == MODE_COUNT) && trie_count_prefix(trie, "", 0) < 0) {
+        fprintf(stderr, "The trie has no key counts, compile it with -k\n");
+        trie_free(trie);
+        return 1;
+    }
 
-    run_loop(trie);
+    if (stats) {
+        trie_set_counters(trie, 1);
+    }
+
+    run_loop(trie, &opts, threads);
+
+    if (stats) {
+        TrieCounters counters;
+        trie_get_counters(trie, &counters);
+        trie_counters_print(&counters, stderr);
+    }
 
     trie_free(trie);
 
@@ -0,0 +1,144 @@
+#include "trie-private.h"
+
+#include <string.h>
+
+/*
+ * Numbering of keys by their sorted order, using the counts of keys below
+ * each chunk stored with `TRIE_BUILD_KEY_COUNTS`. Keys with the same prefix
+ * get consecutive numbers, so a key is numbered by the keys in the subtrees
+ * to the left of its path.
+ */
+
+/**
+ * Number of keys in the subtree of a node, including its own key.
+ */
+static size_t subtree_keys(Trie *trie, const TrieNode *node)
+{
+    size_t keys = node->data != 0;
+    if (node->num_chunks > 0) {
+        keys += trie->key_counts[node->chunk + node->num_chunks - 1];
+    }
+    return keys;
+}
+
+/**
+ * Walk the key from the root and count the keys that sort before every key
+ * starting with it. The key may end inside the label of the last node.
+ *
+ * @param rank      (out) number of keys before the subtree of the node
+ * @param node_len  (out) length of the key of the found node
+ * @return          the node whose subtree holds the keys starting with `key`,
+ *                  or 0 if there are none
+ */
+static NodeId
+rank_walk(Trie *trie, const char *key, size_t key_len, size_t *rank,
+          size_t *node_len)
+{
+    NodeId current = 1;
+    size_t pos = 0;
+    *rank = 0;
+    while (pos < key_len) {
+        const TrieNode *node = trie->nodes + current;
+        int c = chunk_index(trie, node, key[pos]);
+        if (c < 0) {
+            return 0;
+        }
+        /* The key of the node and the subtrees of smaller chunks. */
+        *rank += node->data != 0;
+        if (c > 0) {
+            *rank += trie->key_counts[node->chunk + c - 1];
+        }
+        current = trie->chunk_values[node->chunk + c];
+        ++pos;
+        const unsigned char *label = node_label(trie, current);
+        if (label) {
+            size_t n = key_len - pos < label[0] ? key_len - pos : label[0];
+            if (memcmp(key + pos, label + 1, n) != 0) {
+                return 0;
+            }
+            pos += label[0];
+        }
+    }
+    *node_len = pos;
+    return current;
+}
+
+ssize_t trie_lookup_id(Trie *trie, const char *key, size_t key_len)
+{
+    if (!trie->base_mem || !trie->key_counts) {
+        return -1;
+    }
+    size_t rank, node_len;
+    NodeId node = rank_walk(trie, key, key_len, &rank, &node_len);
+    if (node == 0 || node_len != key_len || !trie->nodes[node].data) {
+        return -1;
+    }
+    return rank;
+}
+
+ssize_t trie_count_prefix(Trie *trie, const char *prefix, size_t prefix_len)
+{
+    if (!trie->base_mem || !trie->key_counts) {
+        return -1;
+    }
+    size_t rank, node_len;
+    NodeId node = rank_walk(trie, prefix, prefix_len, &rank, &node_len);
+    return node == 0 ? 0 : subtree_keys(trie, trie->nodes + node);
+}
+
+/**
+ * Store bytes of the key at `len` if they fit into the buffer, leaving space
+ * for the terminating NUL.
+ */
+static void
+put_key(char *buf, size_t buf_len, size_t len, const void *data, size_t n)
+{
+    if (len < buf_len) {
+        memcpy(buf + len, data, len + n < buf_len ? n : buf_len - 1 - len);
+    }
+}
+
+ssize_t trie_key_by_id(Trie *trie, size_t id, char *buf, size_t buf_len)
+{
+    if (!trie->base_mem || !trie->key_counts
+            || id >= subtree_keys(trie, trie->nodes + 1)) {
+        return -1;
+    }
+    NodeId current = 1;
+    size_t len = 0;
+    for (;;) {
+        const TrieNode *node = trie->nodes + current;
+        if (node->data) {
+            if (id == 0) {
+                break;
+            }
+            --id;
+        }
+        /* Find the first chunk whose running count is above the id. */
+        const uint32_t *counts = trie->key_counts + node->chunk;
+        unsigned lo = 0, hi = node->num_chunks - 1;
+        while (lo < hi) {
+            unsigned mid = (lo + hi) / 2;
+            if (counts[mid] > id) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+        if (lo > 0) {
+            id -= counts[lo - 1];
+        }
+        unsigned char byte = chunk_key(trie, node, lo);
+        put_key(buf, buf_len, len++, &byte, 1);
+        current = trie->chunk_values[node->chunk + lo];
+        const unsigned char *label = node_label(trie, current);
+        if (label) {
+            put_key(buf, buf_len, len, label + 1, label[0]);
+            len += label[0];
+        }
+    }
+    if (buf_len > 0) {
+        buf[len < buf_len ? len : buf_len - 1] = 0;
+    }
+    return len;
+}
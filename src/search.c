@@ -0,0 +1,687 @@
+#include "trie-private.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Searches that visit many keys of a loaded trie in one walk, instead of
+ * looking up candidate keys one by one.
+ */
+
+/**
+ * A node on the path to the current key of a depth first walk.
+ */
+typedef struct {
+    NodeId node;
+    size_t key_len;     /**< Length of the key of the node. */
+    unsigned next;      /**< Next chunk of the node to visit. */
+} SearchFrame;
+
+/**
+ * Space for the values of found keys. It grows until all values fit and is
+ * reused for all keys of a search.
+ */
+typedef struct {
+    TrieValue *values;
+    size_t max_values;
+    char *buf;
+    size_t buf_len;
+} ValueScratch;
+
+static void scratch_free(ValueScratch *s)
+{
+    free(s->values);
+    free(s->buf);
+}
+
+/**
+ * Get all values of a node with data into the scratch space.
+ *
+ * @return  number of values or -1 if memory ran out
+ */
+static ssize_t
+scratch_values(Trie *trie, NodeId node, const char *key, size_t key_len,
+               ValueScratch *s)
+{
+    for (;;) {
+        ssize_t n = node_values(trie, node, key, key_len, s->values,
+                                s->max_values, s->buf, s->buf_len);
+        if ((size_t) n > s->max_values) {
+            TrieValue *values = realloc(s->values, n * sizeof *values);
+            if (!values) {
+                return -1;
+            }
+            s->values = values;
+            s->max_values = n;
+            continue;
+        }
+        size_t total = 0;
+        bool missing = false;
+        for (ssize_t i = 0; i < n; ++i) {
+            total += s->values[i].len;
+            missing = missing || (s->values[i].data == NULL && s->values[i].len > 0);
+        }
+        if (!missing) {
+            return n;
+        }
+        char *buf = realloc(s->buf, total);
+        if (!buf) {
+            return -1;
+        }
+        s->buf = buf;
+        s->buf_len = total;
+    }
+}
+
+/**
+ * State of `trie_fuzzy_search()`.
+ */
+typedef struct {
+    Trie *trie;
+    const char *key;
+    size_t key_len;
+    unsigned max_edits;
+    /**
+     * Row `i` holds the distances between the first `i` bytes of the path
+     * and every prefix of the key, so each row has `key_len + 1` entries.
+     */
+    unsigned *rows;
+    char *found;            /**< The path, with space for the whole key. */
+    size_t *starts;         /**< Positions in the key for `fuzzy_finish()`. */
+    ValueScratch scratch;
+    TrieFuzzyCallback callback;
+    void *arg;
+    ssize_t count;          /**< Number of reported keys, -1 on failure. */
+} Fuzzy;
+
+/**
+ * Compute the row after row `i` for the next byte of the path.
+ *
+ * @return  the smallest entry of the new row; if it is over the limit, the
+ *          path can not lead to a match
+ */
+static unsigned fuzzy_step(Fuzzy *f, size_t i, unsigned char byte)
+{
+    size_t width = f->key_len + 1;
+    const unsigned *prev = f->rows + i * width;
+    unsigned *row = f->rows + (i + 1) * width;
+    row[0] = i + 1;
+    unsigned best = row[0];
+    for (size_t j = 1; j < width; ++j) {
+        unsigned d = prev[j - 1] + ((unsigned char) f->key[j - 1] != byte);
+        if (prev[j] + 1 < d) {
+            d = prev[j] + 1;
+        }
+        if (row[j - 1] + 1 < d) {
+            d = row[j - 1] + 1;
+        }
+        row[j] = d;
+        best = d < best ? d : best;
+    }
+    return best;
+}
+
+/**
+ * Pass the key of length `len` in `found` to the callback.
+ *
+ * @return  whether the search should go on
+ */
+static bool fuzzy_report(Fuzzy *f, NodeId node, size_t len, unsigned edits)
+{
+    f->found[len] = 0;
+    ssize_t n = scratch_values(f->trie, node, f->found, len, &f->scratch);
+    if (n < 0) {
+        f->count = -1;
+        return false;
+    }
+    ++f->count;
+    return f->callback(f->found, len, edits, f->scratch.values, n, f->arg) == 0;
+}
+
+/**
+ * Whether the rest of the key from position `a` sorts before the rest from
+ * position `b`.
+ */
+static bool suffix_less(const Fuzzy *f, size_t a, size_t b)
+{
+    size_t a_len = f->key_len - a, b_len = f->key_len - b;
+    int cmp = memcmp(f->key + a, f->key + b, a_len < b_len ? a_len : b_len);
+    return cmp < 0 || (cmp == 0 && a_len < b_len);
+}
+
+/**
+ * Report all matches in the subtree of a node whose row has used up all
+ * edits. Such a match continues the path with the rest of the key exactly,
+ * starting at a position where the row is at the limit, so each candidate is
+ * a plain walk instead of a visit of the whole subtree.
+ *
+ * @return  whether the search should go on
+ */
+static bool fuzzy_finish(Fuzzy *f, NodeId node, size_t len)
+{
+    const unsigned *row = f->rows + len * (f->key_len + 1);
+    size_t n = 0;
+    for (size_t j = 0; j <= f->key_len; ++j) {
+        if (row[j] != f->max_edits) {
+            continue;
+        }
+        /* Insertion sort keeps the reported keys in order. */
+        size_t i = n++;
+        for (; i > 0 && suffix_less(f, j, f->starts[i - 1]); --i) {
+            f->starts[i] = f->starts[i - 1];
+        }
+        f->starts[i] = j;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        size_t j = f->starts[i];
+        NodeId target = walk_from(f->trie, node, f->key + j, f->key_len - j);
+        if (target == 0 || !f->trie->nodes[target].data) {
+            continue;
+        }
+        memcpy(f->found + len, f->key + j, f->key_len - j);
+        if (!fuzzy_report(f, target, len + f->key_len - j, f->max_edits)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Continue the search below a node reached with `len` bytes of path.
+ *
+ * @param best  smallest entry of the row of the node
+ * @return      whether the node should be pushed to visit its children
+ */
+static bool fuzzy_enter(Fuzzy *f, NodeId node, size_t len, unsigned best,
+                        bool *go_on)
+{
+    if (best == f->max_edits) {
+        *go_on = fuzzy_finish(f, node, len);
+        return false;
+    }
+    unsigned edits = f->rows[len * (f->key_len + 1) + f->key_len];
+    *go_on = !f->trie->nodes[node].data || edits > f->max_edits
+        || fuzzy_report(f, node, len, edits);
+    return true;
+}
+
+ssize_t trie_fuzzy_search(Trie *trie, const char *key, size_t key_len,
+                          unsigned max_edits, TrieFuzzyCallback callback,
+                          void *arg)
+{
+    if (!trie->base_mem) {
+        return -1;
+    }
+    /* A path longer than this is farther from the key than allowed, so the
+     * buffers never grow during the walk. */
+    size_t max_depth = key_len + max_edits + 1;
+    size_t width = key_len + 1;
+    Fuzzy f = {
+        .trie = trie,
+        .key = key,
+        .key_len = key_len,
+        .max_edits = max_edits,
+        .callback = callback,
+        .arg = arg,
+        .count = -1,
+    };
+    f.rows = malloc((max_depth + 1) * width * sizeof *f.rows);
+    f.found = malloc(max_depth + key_len + 1);
+    f.starts = malloc(width * sizeof *f.starts);
+    SearchFrame *frames = malloc((max_depth + 1) * sizeof *frames);
+    if (!f.rows || !f.found || !f.starts || !frames) {
+        goto out;
+    }
+
+    for (size_t j = 0; j < width; ++j) {
+        f.rows[j] = j;
+    }
+    f.count = 0;
+    size_t depth = 0;
+    bool go_on = true;
+    if (fuzzy_enter(&f, 1, 0, 0, &go_on)) {
+        frames[depth++] = (SearchFrame) { 1, 0, 0 };
+    }
+
+    while (depth > 0 && go_on) {
+        SearchFrame *frame = frames + depth - 1;
+        const TrieNode *node = trie->nodes + frame->node;
+        if (frame->next == node->num_chunks) {
+            --depth;
+            continue;
+        }
+        unsigned c = frame->next++;
+        size_t len = frame->key_len;
+        f.found[len] = chunk_key(trie, node, c);
+        /* The child is only read when the path can still match, most of
+         * them are pruned right away. */
+        unsigned best = fuzzy_step(&f, len, f.found[len]);
+        ++len;
+        if (best > max_edits) {
+            continue;
+        }
+        NodeId child = trie->chunk_values[node->chunk + c];
+        const unsigned char *label = node_label(trie, child);
+        for (unsigned i = 0; best <= max_edits && label && i < label[0]; ++i) {
+            f.found[len] = label[1 + i];
+            best = fuzzy_step(&f, len, f.found[len]);
+            ++len;
+        }
+        if (best <= max_edits && fuzzy_enter(&f, child, len, best, &go_on)) {
+            frames[depth++] = (SearchFrame) { child, len, 0 };
+        }
+    }
+
+out:
+    scratch_free(&f.scratch);
+    free(frames);
+    free(f.starts);
+    free(f.found);
+    free(f.rows);
+    return f.count;
+}
+
+/**
+ * State of a walk over the keys with a given prefix. The buffers only grow
+ * when the walk goes deeper than before, so no memory is allocated per key.
+ */
+struct trie_iter {
+    Trie *trie;
+    SearchFrame *frames;
+    size_t depth;
+    size_t max_depth;
+    char *key;              /**< Key of the top frame, NUL terminated. */
+    size_t key_cap;
+    NodeId pending;         /**< Node whose own key comes before its
+                                 children, 0 if there is none. */
+    ValueScratch scratch;
+};
+
+/**
+ * Make space for a key of `len` bytes and one more frame.
+ */
+static bool iter_reserve(TrieIter *iter, size_t len)
+{
+    if (len + 1 > iter->key_cap) {
+        size_t cap = iter->key_cap ? iter->key_cap : 64;
+        while (cap < len + 1) {
+            cap *= 2;
+        }
+        char *key = realloc(iter->key, cap);
+        if (!key) {
+            return false;
+        }
+        iter->key = key;
+        iter->key_cap = cap;
+    }
+    if (iter->depth == iter->max_depth) {
+        size_t max_depth = iter->max_depth ? 2 * iter->max_depth : 16;
+        SearchFrame *frames = realloc(iter->frames, max_depth * sizeof *frames);
+        if (!frames) {
+            return false;
+        }
+        iter->frames = frames;
+        iter->max_depth = max_depth;
+    }
+    return true;
+}
+
+/**
+ * Append the key byte and label of a child to the key of length `len`.
+ *
+ * @return  length of the key of the child, 0 if memory ran out
+ */
+static size_t
+iter_append(TrieIter *iter, size_t len, unsigned char byte, NodeId child)
+{
+    const unsigned char *label = node_label(iter->trie, child);
+    size_t label_len = label ? label[0] : 0;
+    if (!iter_reserve(iter, len + 1 + label_len)) {
+        return 0;
+    }
+    iter->key[len] = byte;
+    if (label_len > 0) {
+        memcpy(iter->key + len + 1, label + 1, label_len);
+    }
+    return len + 1 + label_len;
+}
+
+/**
+ * Find the node whose subtree holds exactly the keys with the prefix. The
+ * prefix may end inside the label of that node, so its key is put into the
+ * key buffer.
+ *
+ * @return  the node, 0 if no key has the prefix and -1 if memory ran out
+ */
+static ssize_t
+iter_find(TrieIter *iter, const char *prefix, size_t prefix_len, size_t *len)
+{
+    NodeId node = 1;
+    *len = 0;
+    if (!iter_reserve(iter, prefix_len)) {
+        return -1;
+    }
+    while (*len < prefix_len) {
+        unsigned char byte = prefix[*len];
+        node = node_child(iter->trie, node, byte);
+        if (node == 0) {
+            return 0;
+        }
+        size_t child_len = iter_append(iter, *len, byte, node);
+        if (child_len == 0) {
+            return -1;
+        }
+        size_t n = child_len < prefix_len ? child_len : prefix_len;
+        if (memcmp(iter->key + *len, prefix + *len, n - *len) != 0) {
+            return 0;
+        }
+        *len = child_len;
+    }
+    return node;
+}
+
+/**
+ * Set up the walk to continue after the key `after` in the subtree of a node
+ * whose key of `len` bytes is a prefix of `after`. The frames along the path
+ * of `after` are pushed, each one pointing at its first child that sorts
+ * after `after`.
+ */
+static bool
+iter_seek(TrieIter *iter, NodeId node, size_t len, const char *after,
+          size_t after_len)
+{
+    Trie *trie = iter->trie;
+    for (;;) {
+        iter->frames[iter->depth++] = (SearchFrame) { node, len, 0 };
+        if (len == after_len) {
+            return true;
+        }
+        SearchFrame *frame = iter->frames + iter->depth - 1;
+        const TrieNode *n = trie->nodes + node;
+        unsigned char byte = after[len];
+        while (frame->next < n->num_chunks
+               && chunk_key(trie, n, frame->next) < byte) {
+            ++frame->next;
+        }
+        if (frame->next == n->num_chunks
+            || chunk_key(trie, n, frame->next) != byte) {
+            return true;
+        }
+        NodeId child = trie->chunk_values[n->chunk + frame->next];
+        size_t child_len = iter_append(iter, len, byte, child);
+        if (child_len == 0) {
+            return false;
+        }
+        size_t common = child_len < after_len ? child_len : after_len;
+        int cmp = memcmp(iter->key + len, after + len, common - len);
+        if (cmp > 0 || (cmp == 0 && child_len > after_len)) {
+            /* The whole subtree of the child sorts after `after`. */
+            return true;
+        }
+        /* The frames may have moved while growing. */
+        ++iter->frames[iter->depth - 1].next;
+        if (cmp < 0) {
+            return true;
+        }
+        /* The key of the child is a prefix of `after`, so it was already
+         * returned and only some of its children are left. */
+        if (!iter_reserve(iter, child_len)) {
+            return false;
+        }
+        node = child;
+        len = child_len;
+    }
+}
+
+int trie_iter_restart(TrieIter *iter, const char *prefix, size_t prefix_len,
+                      const char *after, size_t after_len)
+{
+    iter->depth = 0;
+    iter->pending = 0;
+    size_t len;
+    ssize_t node = iter_find(iter, prefix, prefix_len, &len);
+    if (node <= 0) {
+        return node;
+    }
+    if (!after) {
+        iter->pending = iter->trie->nodes[node].data ? node : 0;
+        iter->frames[iter->depth++] = (SearchFrame) { node, len, 0 };
+        return 0;
+    }
+    size_t common = len < after_len ? len : after_len;
+    int cmp = memcmp(iter->key, after, common);
+    if (cmp > 0 || (cmp == 0 && len > after_len)) {
+        /* Every key with the prefix sorts after `after`. */
+        iter->pending = iter->trie->nodes[node].data ? node : 0;
+        iter->frames[iter->depth++] = (SearchFrame) { node, len, 0 };
+        return 0;
+    }
+    if (cmp < 0) {
+        return 0;
+    }
+    return iter_seek(iter, node, len, after, after_len) ? 0 : -1;
+}
+
+TrieIter *
+trie_iter_prefix(Trie *trie, const char *prefix, size_t prefix_len,
+                 const char *after, size_t after_len)
+{
+    if (!trie->base_mem) {
+        return NULL;
+    }
+    TrieIter *iter = calloc(1, sizeof *iter);
+    if (!iter) {
+        return NULL;
+    }
+    iter->trie = trie;
+    if (trie_iter_restart(iter, prefix, prefix_len, after, after_len) < 0) {
+        trie_iter_free(iter);
+        return NULL;
+    }
+    return iter;
+}
+
+/**
+ * Return the key of length `len` in the key buffer and the values of its
+ * node.
+ */
+static int
+iter_found(TrieIter *iter, NodeId node, size_t len, const char **key,
+           size_t *key_len, const TrieValue **values, size_t *num_values)
+{
+    iter->key[len] = 0;
+    *key = iter->key;
+    *key_len = len;
+    if (values) {
+        ssize_t n = scratch_values(iter->trie, node, iter->key, len,
+                                   &iter->scratch);
+        if (n < 0) {
+            return -1;
+        }
+        *values = iter->scratch.values;
+        *num_values = n;
+    }
+    return 1;
+}
+
+int trie_iter_next(TrieIter *iter, const char **key, size_t *key_len,
+                   const TrieValue **values, size_t *num_values)
+{
+    Trie *trie = iter->trie;
+    if (iter->pending) {
+        NodeId node = iter->pending;
+        iter->pending = 0;
+        return iter_found(iter, node, iter->frames[0].key_len, key, key_len,
+                          values, num_values);
+    }
+    while (iter->depth > 0) {
+        SearchFrame *frame = iter->frames + iter->depth - 1;
+        const TrieNode *node = trie->nodes + frame->node;
+        if (frame->next == node->num_chunks) {
+            --iter->depth;
+            continue;
+        }
+        unsigned c = frame->next++;
+        NodeId child = trie->chunk_values[node->chunk + c];
+        size_t len = iter_append(iter, frame->key_len,
+                                 chunk_key(trie, node, c), child);
+        if (len == 0) {
+            return -1;
+        }
+        /* The frames may have moved while growing. */
+        iter->frames[iter->depth++] = (SearchFrame) { child, len, 0 };
+        if (trie->nodes[child].data) {
+            return iter_found(iter, child, len, key, key_len, values,
+                              num_values);
+        }
+    }
+    return 0;
+}
+
+void trie_iter_free(TrieIter *iter)
+{
+    if (iter) {
+        scratch_free(&iter->scratch);
+        free(iter->frames);
+        free(iter->key);
+        free(iter);
+    }
+}
+
+/**
+ * Go from a node to its child along the key at position `*pos`, matching the
+ * label of the child. The position is moved past the child.
+ *
+ * @return  the child, 0 if the key leaves the trie
+ */
+static NodeId
+prefix_step(Trie *trie, NodeId node, const char *key, size_t key_len,
+            size_t *pos)
+{
+    NodeId child = node_child(trie, node, key[*pos]);
+    if (child == 0) {
+        return 0;
+    }
+    const unsigned char *label = node_label(trie, child);
+    size_t label_len = label ? label[0] : 0;
+    if (key_len - *pos - 1 < label_len
+        || memcmp(key + *pos + 1, label + 1, label_len) != 0) {
+        return 0;
+    }
+    *pos += 1 + label_len;
+    return child;
+}
+
+/**
+ * Find the longest key that is a prefix of `key`.
+ *
+ * @return  its node, 0 if there is none
+ */
+static NodeId
+longest_prefix(Trie *trie, const char *key, size_t key_len, size_t *match_len)
+{
+    NodeId node = 1, found = 0;
+    size_t pos = 0;
+    while (pos < key_len) {
+        node = prefix_step(trie, node, key, key_len, &pos);
+        if (node == 0) {
+            break;
+        }
+        if (trie->nodes[node].data) {
+            found = node;
+            *match_len = pos;
+        }
+    }
+    return found;
+}
+
+ssize_t trie_common_prefix_search(Trie *trie, const char *key, size_t key_len,
+                                  TrieMatchCallback callback, void *arg)
+{
+    if (!trie->base_mem) {
+        return -1;
+    }
+    ValueScratch scratch = { NULL, 0, NULL, 0 };
+    ssize_t count = 0;
+    NodeId node = 1;
+    size_t pos = 0;
+    for (;;) {
+        if (trie->nodes[node].data) {
+            ssize_t n = scratch_values(trie, node, key, pos, &scratch);
+            if (n < 0) {
+                count = -1;
+                break;
+            }
+            ++count;
+            if (callback(0, pos, scratch.values, n, arg) != 0) {
+                break;
+            }
+        }
+        if (pos == key_len
+            || !(node = prefix_step(trie, node, key, key_len, &pos))) {
+            break;
+        }
+    }
+    scratch_free(&scratch);
+    return count;
+}
+
+ssize_t trie_longest_prefix(Trie *trie, const char *key, size_t key_len,
+                            size_t *prefix_len, TrieValue *values,
+                            size_t max_values, char *buf, size_t buf_len)
+{
+    if (!trie->base_mem) {
+        return -1;
+    }
+    size_t len = 0;
+    NodeId node = longest_prefix(trie, key, key_len, &len);
+    if (node == 0) {
+        return -1;
+    }
+    *prefix_len = len;
+    return node_values(trie, node, key, len, values, max_values, buf, buf_len);
+}
+
+ssize_t trie_segment(Trie *trie, const char *text, size_t text_len,
+                     TrieMatchCallback callback, void *arg)
+{
+    if (!trie->base_mem) {
+        return -1;
+    }
+    ValueScratch scratch = { NULL, 0, NULL, 0 };
+    ssize_t count = 0;
+    size_t pos = 0, unknown = 0;
+    while (pos < text_len) {
+        size_t len = 0;
+        NodeId node = longest_prefix(trie, text + pos, text_len - pos, &len);
+        if (node == 0) {
+            ++pos;
+            continue;
+        }
+        if (unknown < pos) {
+            ++count;
+            if (callback(unknown, pos - unknown, NULL, -1, arg) != 0) {
+                goto out;
+            }
+        }
+        ssize_t n = scratch_values(trie, node, text + pos, len, &scratch);
+        if (n < 0) {
+            count = -1;
+            goto out;
+        }
+        ++count;
+        if (callback(pos, len, scratch.values, n, arg) != 0) {
+            goto out;
+        }
+        pos += len;
+        unknown = pos;
+    }
+    if (unknown < pos) {
+        ++count;
+        callback(unknown, pos - unknown, NULL, -1, arg);
+    }
+
+out:
+    scratch_free(&scratch);
+    return count;
+}
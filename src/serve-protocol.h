@@ -0,0 +1,72 @@
+#ifndef SERVE_PROTOCOL_H
+#define SERVE_PROTOCOL_H
+
+/*
+ * Wire format used by `list-serve` and its clients. All integers are little
+ * endian.
+ *
+ * Request:
+ *      u32 length of the rest of the frame
+ *      u32 request id (copied to the response)
+ *      u16 index of the trie (order of files on the command line)
+ *      u16 number of keys
+ *      for each key: u32 length, bytes of the key
+ *
+ * Response:
+ *      u32 length of the rest of the frame
+ *      u32 request id
+ *      u16 status (`SERVE_*`)
+ *      u16 number of keys
+ *      for each key: i32 number of values (-1 if missing),
+ *                    for each value: u32 length, bytes of the value
+ *
+ * A client may send further requests without waiting for responses, but the
+ * server stops reading requests while too many responses wait to be sent, so
+ * the client has to keep reading them. Responses on a connection come in the
+ * order of requests.
+ */
+
+#include <stdint.h>
+
+#define SERVE_HEADER_LEN 12
+
+/**
+ * Longest frame accepted by either side. The server closes connections that
+ * send longer requests.
+ */
+#define SERVE_MAX_FRAME (64u << 20)
+
+#define SERVE_MAX_KEYS UINT16_MAX
+
+#define SERVE_OK        0   /**< All keys were looked up. */
+#define SERVE_NO_TRIE   1   /**< There is no trie with requested index. */
+#define SERVE_BAD_FRAME 2   /**< Request frame could not be parsed. */
+#define SERVE_NO_MEMORY 3   /**< Server ran out of memory for the answer. */
+#define SERVE_TOO_LARGE 4   /**< Answer would not fit into `SERVE_MAX_FRAME`. */
+
+static inline void serve_put_u16(unsigned char *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static inline void serve_put_u32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static inline uint16_t serve_get_u16(const unsigned char *p)
+{
+    return p[0] | (uint16_t) p[1] << 8;
+}
+
+static inline uint32_t serve_get_u32(const unsigned char *p)
+{
+    return p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16
+        | (uint32_t) p[3] << 24;
+}
+
+#endif /* end of include guard: SERVE_PROTOCOL_H */
@@ -0,0 +1,589 @@
+#include <config.h>
+#include "trie.h"
+#include "serve-protocol.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * Daemon answering lookups in loaded tries over a Unix domain socket, so that
+ * many processes on a host can share a single copy of the tries. The protocol
+ * is described in `serve-protocol.h`.
+ *
+ * Each worker thread runs its own epoll loop. All workers wait for new
+ * connections on the listening socket and a connection stays with the worker
+ * that accepted it.
+ */
+
+#define MAX_WORKERS 256
+#define MAX_EVENTS 64
+#define READ_SIZE (64 * 1024)
+
+/**
+ * When this many bytes of responses are waiting to be sent, no more requests
+ * are read from the connection until the client catches up.
+ */
+#define MAX_PENDING_OUTPUT (4 << 20)
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+} Buffer;
+
+static void buffer_reserve(Buffer *buf, size_t needed)
+{
+    if (needed <= buf->cap) {
+        return;
+    }
+    buf->cap = buf->cap ? buf->cap : READ_SIZE;
+    while (buf->cap < needed) {
+        buf->cap *= 2;
+    }
+    buf->data = realloc(buf->data, buf->cap);
+    if (!buf->data) {
+        perror("realloc");
+        exit(2);
+    }
+}
+
+static void buffer_append(Buffer *buf, const void *data, size_t len)
+{
+    buffer_reserve(buf, buf->len + len);
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+typedef struct {
+    int fd;
+    Buffer in;          /**< Received bytes not processed yet. */
+    Buffer out;         /**< Responses not sent yet. */
+    size_t out_sent;    /**< How much of the output was already sent. */
+    bool closing;       /**< Close once the output is sent. */
+    bool eof;           /**< Client will not send more requests. */
+} Connection;
+
+typedef struct {
+    TrieHandle **tries;
+    size_t num_tries;
+    int listen_fd;
+    int stop_fd;        /**< Becomes readable when the server should stop. */
+    int epoll_fd;
+
+    TrieValue *values;  /**< Scratch space for looking up values. */
+    size_t max_values;
+    char *buf;
+    size_t buf_len;
+} Worker;
+
+/**
+ * Look up all values of a key, growing the scratch space of the worker.
+ *
+ * @return  number of values, -1 if the key is missing or -2 if the scratch
+ *          space could not be grown
+ */
+static ssize_t find_values(Worker *w, Trie *trie, const char *key, size_t len)
+{
+    for (;;) {
+        ssize_t n = trie_lookup_values(trie, key, len, w->values, w->max_values,
+                                       w->buf, w->buf_len);
+        if (n < 0) {
+            return -1;
+        }
+        if ((size_t) n > w->max_values) {
+            TrieValue *values = realloc(w->values, n * sizeof *values);
+            if (!values) {
+                return -2;
+            }
+            w->values = values;
+            w->max_values = n;
+            continue;
+        }
+        size_t total = 0;
+        bool missing = false;
+        for (ssize_t i = 0; i < n; ++i) {
+            total += w->values[i].len;
+            missing = missing || (!w->values[i].data && w->values[i].len > 0);
+        }
+        if (!missing) {
+            return n;
+        }
+        char *buf = realloc(w->buf, total);
+        if (!buf) {
+            return -2;
+        }
+        w->buf = buf;
+        w->buf_len = total;
+    }
+}
+
+/**
+ * Answer a single request frame. Unless it succeeds, nothing is added to the
+ * output.
+ *
+ * @return  `SERVE_OK`, `SERVE_BAD_FRAME` if the request is malformed,
+ *          `SERVE_NO_MEMORY` or `SERVE_TOO_LARGE` if the response would be
+ *          longer than `SERVE_MAX_FRAME`
+ */
+static unsigned
+handle_request(Worker *w, Connection *conn, const unsigned char *frame,
+               size_t len)
+{
+    uint32_t id = serve_get_u32(frame);
+    unsigned trie = serve_get_u16(frame + 4);
+    unsigned num_keys = serve_get_u16(frame + 6);
+    const unsigned char *pos = frame + SERVE_HEADER_LEN - 4;
+    const unsigned char *end = frame + len;
+
+    size_t start = conn->out.len;
+    unsigned char header[SERVE_HEADER_LEN];
+    serve_put_u32(header + 4, id);
+    serve_put_u16(header + 8, trie < w->num_tries ? SERVE_OK : SERVE_NO_TRIE);
+    serve_put_u16(header + 10, num_keys);
+    buffer_append(&conn->out, header, sizeof header);
+
+    /* All keys of a request are answered from the same version of the trie,
+     * even if it is reloaded meanwhile. */
+    Trie *t = trie < w->num_tries ? trie_handle_acquire(w->tries[trie]) : NULL;
+    unsigned status = SERVE_OK;
+    for (unsigned i = 0; i < num_keys; ++i) {
+        if (end - pos < 4 || (size_t) (end - pos - 4) < serve_get_u32(pos)) {
+            status = SERVE_BAD_FRAME;
+            break;
+        }
+        size_t key_len = serve_get_u32(pos);
+        const char *key = (const char *) pos + 4;
+        pos += 4 + key_len;
+
+        ssize_t count = t ? find_values(w, t, key, key_len) : -1;
+        if (count == -2) {
+            status = SERVE_NO_MEMORY;
+            break;
+        }
+        size_t size = 4;
+        for (ssize_t j = 0; j < count; ++j) {
+            size += 4 + w->values[j].len;
+        }
+        if (conn->out.len - start - 4 + size > SERVE_MAX_FRAME) {
+            status = SERVE_TOO_LARGE;
+            break;
+        }
+        unsigned char num[4];
+        serve_put_u32(num, (uint32_t) (int32_t) count);
+        buffer_append(&conn->out, num, 4);
+        for (ssize_t j = 0; j < count; ++j) {
+            serve_put_u32(num, w->values[j].len);
+            buffer_append(&conn->out, num, 4);
+            buffer_append(&conn->out, w->values[j].data, w->values[j].len);
+        }
+    }
+    if (trie < w->num_tries) {
+        trie_handle_release(w->tries[trie]);
+    }
+    if (status == SERVE_OK && pos != end) {
+        status = SERVE_BAD_FRAME;
+    }
+    if (status != SERVE_OK) {
+        conn->out.len = start;
+        return status;
+    }
+    serve_put_u32(conn->out.data + start, conn->out.len - start - 4);
+    return SERVE_OK;
+}
+
+/**
+ * Answer all complete requests in the input buffer, unless too much output
+ * is waiting.
+ *
+ * @return  whether any request was processed
+ */
+static bool process_input(Worker *w, Connection *conn)
+{
+    size_t pos = 0;
+    while (!conn->closing && conn->out.len - conn->out_sent < MAX_PENDING_OUTPUT
+            && conn->in.len - pos >= 4) {
+        size_t len = serve_get_u32(conn->in.data + pos);
+        if (len < SERVE_HEADER_LEN - 4 || len > SERVE_MAX_FRAME) {
+            conn->closing = true;
+            break;
+        }
+        if (conn->in.len - pos - 4 < len) {
+            break;
+        }
+        unsigned status = handle_request(w, conn, conn->in.data + pos + 4, len);
+        if (status != SERVE_OK) {
+            unsigned char header[SERVE_HEADER_LEN];
+            serve_put_u32(header, SERVE_HEADER_LEN - 4);
+            memcpy(header + 4, conn->in.data + pos + 4, 4);
+            serve_put_u16(header + 8, status);
+            serve_put_u16(header + 10, 0);
+            buffer_append(&conn->out, header, sizeof header);
+            /* A client that runs the server out of memory may try again. */
+            conn->closing = status == SERVE_BAD_FRAME;
+        }
+        pos += 4 + len;
+    }
+    if (pos > 0) {
+        memmove(conn->in.data, conn->in.data + pos, conn->in.len - pos);
+        conn->in.len -= pos;
+    }
+    return pos > 0;
+}
+
+/**
+ * Send as much of the pending output as the socket takes.
+ *
+ * @return  false if the connection failed
+ */
+static bool flush_output(Connection *conn)
+{
+    while (conn->out_sent < conn->out.len) {
+        ssize_t n = send(conn->fd, conn->out.data + conn->out_sent,
+                         conn->out.len - conn->out_sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        conn->out_sent += n;
+    }
+    conn->out.len = conn->out_sent = 0;
+    return true;
+}
+
+static void close_connection(Worker *w, Connection *conn)
+{
+    epoll_ctl(w->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free(conn->in.data);
+    free(conn->out.data);
+    free(conn);
+}
+
+/**
+ * Read requests from a connection and answer them.
+ *
+ * @return  false if the connection should be closed
+ */
+static bool handle_connection(Worker *w, Connection *conn, uint32_t events)
+{
+    if (events & (EPOLLERR | EPOLLHUP) && !(events & EPOLLIN)) {
+        return false;
+    }
+    if ((events & EPOLLIN) && !conn->eof) {
+        for (;;) {
+            buffer_reserve(&conn->in, conn->in.len + READ_SIZE);
+            ssize_t n = recv(conn->fd, conn->in.data + conn->in.len,
+                             conn->in.cap - conn->in.len, 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (n < 0) {
+                return false;
+            }
+            if (n == 0) {
+                conn->eof = true;
+                break;
+            }
+            conn->in.len += n;
+            if (conn->in.len > 2 * (size_t) SERVE_MAX_FRAME) {
+                break;
+            }
+        }
+    }
+
+    /* Answer requests, sending responses as soon as the socket allows. */
+    for (;;) {
+        bool progress = process_input(w, conn);
+        if (!flush_output(conn)) {
+            return false;
+        }
+        if (!progress || conn->out.len > 0) {
+            break;
+        }
+    }
+    if ((conn->closing || conn->eof) && conn->out.len == 0) {
+        return false;
+    }
+
+    struct epoll_event ev = { .data.ptr = conn };
+    ev.events = conn->out.len > 0 ? EPOLLOUT : 0;
+    /* Stop reading while the client is not reading responses. */
+    if (!conn->closing && !conn->eof
+            && conn->out.len - conn->out_sent < MAX_PENDING_OUTPUT) {
+        ev.events |= EPOLLIN;
+    }
+    epoll_ctl(w->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+    return true;
+}
+
+static void accept_connections(Worker *w)
+{
+    for (;;) {
+        int fd = accept(w->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        Connection *conn = calloc(1, sizeof *conn);
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+        if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            free(conn);
+        }
+    }
+}
+
+static void * run_worker(void *arg)
+{
+    Worker *w = arg;
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = w };
+    epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->listen_fd, &ev);
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->stop_fd, &ev);
+
+    struct epoll_event events[MAX_EVENTS];
+    for (;;) {
+        int n = epoll_wait(w->epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.ptr == NULL) {
+                /* Connections are closed when the process exits. */
+                return NULL;
+            }
+            if (events[i].data.ptr == w) {
+                accept_connections(w);
+                continue;
+            }
+            Connection *conn = events[i].data.ptr;
+            if (!handle_connection(w, conn, events[i].events)) {
+                close_connection(w, conn);
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Create the listening socket. It is bound to a temporary name first and
+ * renamed once it accepts connections, so that clients can wait for the
+ * path to appear.
+ */
+static int listen_on(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int len = snprintf(addr.sun_path, sizeof addr.sun_path, "%s.%ld", path,
+                       (long) getpid());
+    if (len < 0 || (size_t) len >= sizeof addr.sun_path) {
+        fprintf(stderr, "Socket path is too long\n");
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    unlink(addr.sun_path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof addr) < 0
+            || listen(fd, SOMAXCONN) < 0
+            || rename(addr.sun_path, path) < 0) {
+        perror(path);
+        unlink(addr.sun_path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void usage(FILE *fh, const char *prog)
+{
+    fprintf(fh, "Usage: %s [OPTIONS...] -s SOCKET FILE...\n", prog);
+}
+
+static void help(const char *prog)
+{
+    usage(stdout, prog);
+    puts("\nAvailable options:");
+    puts("  -s, --socket=PATH   listen on Unix domain socket PATH");
+    puts("  -j, --jobs=N        answer requests with N threads");
+    puts("  -p, --populate      read the whole files when loading them");
+    puts("  -l, --lock          lock the files in memory");
+    puts("  -H, --hugepages     copy the files into huge pages");
+    puts("  -W, --prewarm=N     read top N levels of the tries before serving");
+    puts("  -h, --help          print this help");
+    puts("");
+    puts("Requests select the trie by its position among the FILE arguments.");
+    puts("On SIGHUP, all files are loaded again without stopping the server.");
+    puts("");
+    puts("This is list-serve from "PACKAGE" "VERSION".");
+    puts("File bug reports at <"PACKAGE_URL">.");
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned flags = 0;
+    int prewarm = 0;
+    int threads = 1;
+    const char *socket_path = NULL;
+
+    static const struct option long_options[] = {
+        { "socket", required_argument, NULL, 's' },
+        { "jobs", required_argument, NULL, 'j' },
+        { "populate", no_argument, NULL, 'p' },
+        { "lock", no_argument, NULL, 'l' },
+        { "hugepages", no_argument, NULL, 'H' },
+        { "prewarm", required_argument, NULL, 'W' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "s:j:plHW:h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 's':
+            socket_path = optarg;
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            if (threads < 1 || threads > MAX_WORKERS) {
+                fprintf(stderr, "Number of jobs must be between 1 and %d\n",
+                        MAX_WORKERS);
+                return 1;
+            }
+            break;
+        case 'p':
+            flags |= TRIE_LOAD_POPULATE;
+            break;
+        case 'l':
+            flags |= TRIE_LOAD_LOCK;
+            break;
+        case 'H':
+            flags |= TRIE_LOAD_HUGEPAGES;
+            break;
+        case 'W':
+            prewarm = atoi(optarg);
+            if (prewarm < 0) {
+                fprintf(stderr, "Number of levels must not be negative\n");
+                return 1;
+            }
+            break;
+        case 'h':
+            help(argv[0]);
+            return 0;
+        default:
+            usage(stderr, argv[0]);
+            return 1;
+        }
+    }
+
+    size_t num_tries = argc - optind;
+    if (!socket_path || num_tries == 0 || num_tries > UINT16_MAX) {
+        usage(stderr, argv[0]);
+        return 1;
+    }
+
+    TrieHandle **tries = calloc(num_tries, sizeof *tries);
+    for (size_t i = 0; i < num_tries; ++i) {
+        tries[i] = trie_handle_open(argv[optind + i], flags, prewarm);
+        if (!tries[i]) {
+            fprintf(stderr, "Failed to load trie %s: %s\n", argv[optind + i],
+                    trie_get_last_error());
+            return 2;
+        }
+    }
+
+    /* Signals are only handled by the main thread, see below. */
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    int listen_fd = listen_on(socket_path);
+    int stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (listen_fd < 0 || stop_fd < 0) {
+        return 2;
+    }
+
+    Worker workers[threads];
+    pthread_t ids[threads];
+    memset(workers, 0, sizeof workers);
+    for (int i = 0; i < threads; ++i) {
+        workers[i].tries = tries;
+        workers[i].num_tries = num_tries;
+        workers[i].listen_fd = listen_fd;
+        workers[i].stop_fd = stop_fd;
+        workers[i].epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (workers[i].epoll_fd < 0
+                || pthread_create(ids + i, NULL, run_worker, workers + i) != 0) {
+            perror("Failed to start worker");
+            return 2;
+        }
+    }
+
+    /* Workers keep answering from the old tries while they are reloaded. */
+    int sig;
+    while (sigwait(&signals, &sig) == 0 && sig == SIGHUP) {
+        for (size_t i = 0; i < num_tries; ++i) {
+            if (trie_handle_reload(tries[i], NULL) < 0) {
+                fprintf(stderr, "Failed to reload trie %s: %s\n",
+                        argv[optind + i], trie_get_last_error());
+            }
+        }
+    }
+    uint64_t one = 1;
+    if (write(stop_fd, &one, sizeof one) < 0) {
+        perror("write");
+    }
+    for (int i = 0; i < threads; ++i) {
+        pthread_join(ids[i], NULL);
+        close(workers[i].epoll_fd);
+        free(workers[i].values);
+        free(workers[i].buf);
+    }
+
+    unlink(socket_path);
+    close(listen_fd);
+    close(stop_fd);
+    for (size_t i = 0; i < num_tries; ++i) {
+        trie_handle_close(tries[i]);
+    }
+    free(tries);
+    return 0;
+}
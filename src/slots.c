@@ -0,0 +1,93 @@
+#include "trie-private.h"
+
+#include <stdlib.h>
+
+/*
+ * Lists of per-thread slots shared by lookup counters and reloadable
+ * handles. A thread finds its slot in a small thread local cache, and only
+ * on a miss walks the list of the object. A new slot is allocated only the
+ * first time a thread uses the object.
+ */
+
+/**
+ * How many slots a thread remembers. A thread that uses more objects at once
+ * finds the slot in the list of the object.
+ */
+#define SLOT_CACHE_SIZE 8
+
+/**
+ * Source of ids of slot lists. An id is never reused, so that a slot cached
+ * by a thread can not be mistaken for a slot of an object created later.
+ */
+static uint64_t next_id = 1;
+
+static __thread struct {
+    uint64_t id;
+    ThreadSlot *slot;
+} slot_cache[SLOT_CACHE_SIZE];
+
+static __thread unsigned slot_cache_next;
+
+/**
+ * Its address identifies the calling thread. A thread started after another
+ * one exited may get the same address and take over its slots, which only
+ * hold state between calls.
+ */
+static __thread char thread_token;
+
+void thread_slots_init(ThreadSlots *slots)
+{
+    slots->head = NULL;
+    slots->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+}
+
+void thread_slots_free(ThreadSlots *slots)
+{
+    while (slots->head) {
+        ThreadSlot *next = slots->head->next;
+        free(slots->head);
+        slots->head = next;
+    }
+}
+
+/**
+ * Remember the slot of the calling thread, replacing the oldest entry.
+ */
+static void cache_slot(ThreadSlots *slots, ThreadSlot *slot)
+{
+    unsigned i = slot_cache_next++ % SLOT_CACHE_SIZE;
+    slot_cache[i].id = slots->id;
+    slot_cache[i].slot = slot;
+}
+
+ThreadSlot * thread_slots_get(ThreadSlots *slots, size_t size)
+{
+    for (unsigned i = 0; i < SLOT_CACHE_SIZE; ++i) {
+        if (slot_cache[i].id == slots->id) {
+            return slot_cache[i].slot;
+        }
+    }
+
+    /* Only the owner adds its slot, so it can not appear meanwhile. */
+    for (ThreadSlot *slot = thread_slots_first(slots); slot; slot = slot->next) {
+        if (slot->owner == &thread_token) {
+            cache_slot(slots, slot);
+            return slot;
+        }
+    }
+    if (size == 0) {
+        return NULL;
+    }
+
+    ThreadSlot *slot = calloc(1, size);
+    if (!slot) {
+        return NULL;
+    }
+    slot->owner = &thread_token;
+    slot->next = __atomic_load_n(&slots->head, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&slots->head, &slot->next, slot, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    cache_slot(slots, slot);
+    return slot;
+}
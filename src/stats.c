@@ -0,0 +1,59 @@
+#include <config.h>
+#include "trie.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void usage(FILE *fh, const char *prog)
+{
+    fprintf(fh, "Usage: %s [OPTIONS...] FILE\n", prog);
+}
+
+static void help(const char *prog)
+{
+    usage(stdout, prog);
+    puts("\nPrint statistics about the structure of a compiled trie.");
+    puts("\nAvailable options:");
+    puts("  -h, --help      print this help");
+    puts("");
+    puts("This is list-stats from "PACKAGE" "VERSION".");
+    puts("File bug reports at <"PACKAGE_URL">.");
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            help(argv[0]);
+            return 0;
+        default:
+            usage(stderr, argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(stderr, argv[0]);
+        return 1;
+    }
+
+    Trie *trie = trie_load(argv[optind]);
+    if (!trie) {
+        fprintf(stderr, "Failed to load trie: %s\n", trie_get_last_error());
+        return 2;
+    }
+
+    TrieStats stats;
+    trie_stats(trie, &stats);
+    trie_stats_print(&stats, stdout);
+    trie_free(trie);
+    return 0;
+}
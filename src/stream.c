@@ -0,0 +1,377 @@
+#include "trie-private.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Builder for pre-sorted input. Since the keys come in order, a node can not
+ * get any new children once a key not starting with its prefix is inserted.
+ * At that point the node is finalized: its children are written to temporary
+ * files with the sections of the trie and only a small record describing the
+ * node is kept in its parent. The only nodes in memory are thus the ones on
+ * the path to the last inserted key and their finalized children.
+ *
+ * Children are numbered before their parents, the root is always node 1 and
+ * is written last.
+ */
+
+/**
+ * Node that was finalized, but its record was not written yet. The parent
+ * needs to know about the node to create the chunk pointing to it, and in
+ * radix mode the node might still be merged with its parent.
+ */
+typedef struct {
+    TrieNode node;                  /**< Record of the node itself. */
+    uint32_t keys;                  /**< Number of keys in the subtree. */
+    char key;                       /**< Key of chunk leading to the node. */
+    unsigned char label_len;        /**< Length of label of the node. */
+    unsigned char label[MAX_LABEL]; /**< Label of the node. */
+} PendingNode;
+
+/**
+ * Node on the path to last inserted key. New children can still be added to
+ * it.
+ */
+typedef struct {
+    char key;                   /**< Key of chunk leading to the node. */
+    bool has_data;              /**< Whether any data was inserted. */
+    char *data;                 /**< Data of the node. */
+    size_t data_len;            /**< Length of the data. */
+    size_t data_cap;            /**< Capacity of the data buffer. */
+    PendingNode *children;      /**< Finalized children of the node. */
+    unsigned num_children;      /**< Number of finalized children. */
+} OpenNode;
+
+/**
+ * Sections of the trie that are written to temporary files before they can be
+ * put into the final file.
+ */
+enum {
+    TMP_NODES,
+    TMP_CHUNK_VALUES,
+    TMP_CHUNK_KEYS,
+    TMP_LABEL_BLOCKS,
+    TMP_LABEL_OFFSETS,
+    TMP_LABEL_DATA,
+    TMP_KEY_COUNTS,
+    TMP_DATA,
+    NUM_TMP
+};
+
+struct stream_builder {
+    OpenNode *path;             /**< Open nodes, path[i] has prefix of length i. */
+    size_t path_len;            /**< Capacity of the path. */
+    char *last_key;             /**< Last inserted key. */
+    size_t last_key_len;        /**< Length of the last key. */
+    size_t last_key_cap;        /**< Capacity of buffer for last key. */
+    bool empty;                 /**< Whether nothing was inserted yet. */
+
+    FILE *tmp[NUM_TMP];         /**< Temporary files with sections. */
+
+    NodeId next_node;           /**< Number for next written node. */
+    ChunkId next_chunk;         /**< Position of next written chunk. */
+    uint32_t data_len;          /**< Size of data section. */
+    LabelBlock block;           /**< Currently built block of labels index. */
+    uint32_t num_blocks;        /**< Number of blocks already written. */
+    uint32_t label_count;       /**< Number of labelled nodes. */
+    uint32_t label_data_len;    /**< Size of label data. */
+};
+
+static void open_node_init(OpenNode *node, char key)
+{
+    node->key = key;
+    node->has_data = false;
+    node->data_len = 0;
+    node->num_children = 0;
+}
+
+StreamBuilder * stream_new(void)
+{
+    StreamBuilder *sb = calloc(1, sizeof *sb);
+    for (int i = 0; i < NUM_TMP; ++i) {
+        sb->tmp[i] = tmpfile();
+        if (!sb->tmp[i]) {
+            stream_free(sb);
+            return NULL;
+        }
+    }
+    sb->path_len = 16;
+    sb->path = calloc(sb->path_len, sizeof *sb->path);
+    open_node_init(sb->path, 0);
+    sb->empty = true;
+
+    /* Node 0 is a sentinel and node 1 is the root written at the end. */
+    TrieNode zero = { 0 };
+    fwrite(&zero, sizeof zero, 1, sb->tmp[TMP_NODES]);
+    fwrite(&zero, sizeof zero, 1, sb->tmp[TMP_NODES]);
+    sb->next_node = 2;
+    /* Chunk 0 and data offset 0 are not used either. */
+    NodeId no_node = 0;
+    fwrite(&no_node, sizeof no_node, 1, sb->tmp[TMP_CHUNK_VALUES]);
+    fputc(0, sb->tmp[TMP_CHUNK_KEYS]);
+    sb->next_chunk = 1;
+    fputc(0, sb->tmp[TMP_DATA]);
+    sb->data_len = 1;
+    fputc(0, sb->tmp[TMP_LABEL_DATA]);
+    sb->label_data_len = 1;
+    uint32_t no_keys = 0;
+    fwrite(&no_keys, sizeof no_keys, 1, sb->tmp[TMP_KEY_COUNTS]);
+
+    return sb;
+}
+
+void stream_free(StreamBuilder *sb)
+{
+    if (!sb) {
+        return;
+    }
+    for (size_t i = 0; i < sb->path_len; ++i) {
+        free(sb->path[i].data);
+        free(sb->path[i].children);
+    }
+    for (int i = 0; i < NUM_TMP; ++i) {
+        if (sb->tmp[i]) {
+            fclose(sb->tmp[i]);
+        }
+    }
+    free(sb->path);
+    free(sb->last_key);
+    free(sb);
+}
+
+static void flush_block(StreamBuilder *sb)
+{
+    fwrite(&sb->block, sizeof sb->block, 1, sb->tmp[TMP_LABEL_BLOCKS]);
+    sb->block.bits = 0;
+    sb->block.rank = sb->label_count;
+    sb->num_blocks++;
+}
+
+/**
+ * Write record of a finalized node, giving it a number.
+ */
+static NodeId emit_node(Trie *trie, const PendingNode *pending)
+{
+    StreamBuilder *sb = trie->stream;
+    NodeId id = sb->next_node++;
+    assert(id < UINT32_MAX - 1);
+    fwrite(&pending->node, sizeof pending->node, 1, sb->tmp[TMP_NODES]);
+
+    if (!(trie->flags & TRIE_BUILD_RADIX)) {
+        return id;
+    }
+    /* Flush all blocks of the label index before the one with this node. */
+    while (id / 64 > sb->num_blocks) {
+        flush_block(sb);
+    }
+    if (pending->label_len > 0) {
+        sb->block.bits |= UINT64_C(1) << (id % 64);
+        fwrite(&sb->label_data_len, sizeof sb->label_data_len, 1,
+               sb->tmp[TMP_LABEL_OFFSETS]);
+        fputc(pending->label_len, sb->tmp[TMP_LABEL_DATA]);
+        fwrite(pending->label, 1, pending->label_len, sb->tmp[TMP_LABEL_DATA]);
+        sb->label_data_len += pending->label_len + 1;
+        sb->label_count++;
+    }
+    return id;
+}
+
+/**
+ * Finalize an open node. Its children are written to the files and the
+ * record describing the node is returned.
+ *
+ * @param can_merge     whether the node can be merged into its parent
+ */
+static void
+finalize_node(Trie *trie, OpenNode *open, bool can_merge, PendingNode *result)
+{
+    StreamBuilder *sb = trie->stream;
+
+    result->key = open->key;
+    result->label_len = 0;
+    result->node.data = 0;
+    result->keys = open->has_data;
+    if (open->has_data && trie->with_content) {
+        result->node.data = sb->data_len;
+        unsigned char *record = malloc(open->data_len + MAX_RECORD_OVERHEAD);
+        size_t len = encode_record(record, (unsigned char *) open->data,
+                                   open->data_len, trie->use_compress);
+        fwrite(record, 1, len, sb->tmp[TMP_DATA]);
+        free(record);
+        sb->data_len += len;
+    } else if (open->has_data) {
+        result->node.data = 1;
+    }
+
+    if (can_merge && (trie->flags & TRIE_BUILD_RADIX) && !open->has_data
+            && open->num_children == 1
+            && open->children[0].label_len < MAX_LABEL) {
+        /* Skip this node, the only child takes its place with longer label. */
+        PendingNode *child = open->children;
+        result->node = child->node;
+        result->keys = child->keys;
+        result->label_len = child->label_len + 1;
+        result->label[0] = child->key;
+        memcpy(result->label + 1, child->label, child->label_len);
+        return;
+    }
+
+    unsigned n = open->num_children;
+    TrieNodeChunk chunks[UCHAR_MAX + 1];
+    for (unsigned i = 0; i < n; ++i) {
+        chunks[i].key = open->children[i].key;
+        chunks[i].value = emit_node(trie, open->children + i);
+        fwrite(&chunks[i].value, sizeof chunks[i].value, 1,
+               sb->tmp[TMP_CHUNK_VALUES]);
+        result->keys += open->children[i].keys;
+        if (trie->flags & TRIE_BUILD_KEY_COUNTS) {
+            /* The count of the node itself is added after the loop. */
+            uint32_t keys = result->keys - open->has_data;
+            fwrite(&keys, sizeof keys, 1, sb->tmp[TMP_KEY_COUNTS]);
+        }
+    }
+    /* A bitmap only fills its first bytes, the rest stays zero as in the
+     * chunk keys of the in-memory builder. */
+    unsigned char keys[UCHAR_MAX + 1] = { 0 };
+    encode_chunk_keys(chunks, n, keys);
+    fwrite(keys, 1, n, sb->tmp[TMP_CHUNK_KEYS]);
+
+    result->node.chunk = n > 0 ? sb->next_chunk : 0;
+    result->node.num_chunks = n;
+    sb->next_chunk += n;
+    assert(sb->next_chunk < UINT32_MAX - UCHAR_MAX);
+}
+
+/**
+ * Finalize all open nodes deeper than `depth`.
+ */
+static void close_path(Trie *trie, size_t depth)
+{
+    StreamBuilder *sb = trie->stream;
+    for (size_t i = sb->last_key_len; i > depth; --i) {
+        OpenNode *parent = sb->path + i - 1;
+        if (!parent->children) {
+            parent->children = malloc((UCHAR_MAX + 1) * sizeof *parent->children);
+        }
+        finalize_node(trie, sb->path + i, true,
+                      parent->children + parent->num_children++);
+    }
+}
+
+static void append_data(Trie *trie, OpenNode *node, const char *data, const char *key)
+{
+    node->has_data = true;
+    if (!trie->with_content) {
+        return;
+    }
+    size_t needed = node->data_len + strlen(data) + MAX_ENTRY_OVERHEAD;
+    if (needed > node->data_cap) {
+        node->data_cap = needed * 2;
+        node->data = realloc(node->data, node->data_cap);
+    }
+    node->data_len += encode_entry((unsigned char *) node->data + node->data_len,
+                                   data, key, trie->use_compress);
+}
+
+int stream_insert(Trie *trie, const char *key, const char *value)
+{
+    StreamBuilder *sb = trie->stream;
+    size_t key_len = strlen(key);
+
+    if (!sb->empty && strcmp(sb->last_key, key) > 0) {
+        set_last_error(ERROR_UNSORTED);
+        return -1;
+    }
+    sb->empty = false;
+
+    size_t common = 0;
+    while (common < sb->last_key_len && key[common] == sb->last_key[common]) {
+        ++common;
+    }
+    close_path(trie, common);
+
+    if (key_len + 1 > sb->path_len) {
+        size_t old_len = sb->path_len;
+        while (key_len + 1 > sb->path_len) {
+            sb->path_len *= 2;
+        }
+        sb->path = realloc(sb->path, sb->path_len * sizeof *sb->path);
+        memset(sb->path + old_len, 0, (sb->path_len - old_len) * sizeof *sb->path);
+    }
+    for (size_t i = common + 1; i <= key_len; ++i) {
+        open_node_init(sb->path + i, key[i - 1]);
+    }
+
+    if (key_len + 1 > sb->last_key_cap) {
+        sb->last_key_cap = 2 * (key_len + 1);
+        sb->last_key = realloc(sb->last_key, sb->last_key_cap);
+    }
+    memcpy(sb->last_key, key, key_len + 1);
+    sb->last_key_len = key_len;
+
+    append_data(trie, sb->path + key_len, value, key);
+    return 0;
+}
+
+/**
+ * Append contents of a temporary file as a new section of the output.
+ */
+static void copy_section(FILE *out, size_t *pos, FILE *in, size_t size)
+{
+    write_section(out, pos, NULL, 0);
+    rewind(in);
+    char buffer[BUFSIZ];
+    size_t len;
+    while ((len = fread(buffer, 1, sizeof buffer, in)) > 0) {
+        fwrite(buffer, 1, len, out);
+    }
+    *pos += size;
+}
+
+void stream_finish(Trie *trie, FILE *fh)
+{
+    StreamBuilder *sb = trie->stream;
+
+    close_path(trie, 0);
+    PendingNode root;
+    finalize_node(trie, sb->path, false, &root);
+    fseek(sb->tmp[TMP_NODES], sizeof root.node, SEEK_SET);
+    fwrite(&root.node, sizeof root.node, 1, sb->tmp[TMP_NODES]);
+
+    trie->idx = sb->next_node;
+    trie->chunks_idx = sb->next_chunk;
+    trie->data_idx = sb->data_len;
+    for (int i = 0; i < CHUNK_KEYS_PADDING; ++i) {
+        fputc(0, sb->tmp[TMP_CHUNK_KEYS]);
+    }
+    trie->label_count = sb->label_count;
+    trie->label_data_len = sb->label_data_len;
+    if (trie->flags & TRIE_BUILD_RADIX) {
+        while (sb->num_blocks <= trie->idx / 64) {
+            flush_block(sb);
+        }
+    }
+
+    size_t pos = 0;
+    write_header(fh, &pos, trie);
+    copy_section(fh, &pos, sb->tmp[TMP_NODES], sizeof (TrieNode) * trie->idx);
+    copy_section(fh, &pos, sb->tmp[TMP_CHUNK_VALUES],
+                 sizeof (NodeId) * trie->chunks_idx);
+    copy_section(fh, &pos, sb->tmp[TMP_CHUNK_KEYS],
+                 trie->chunks_idx + CHUNK_KEYS_PADDING);
+    if (trie->flags & TRIE_BUILD_RADIX) {
+        copy_section(fh, &pos, sb->tmp[TMP_LABEL_BLOCKS],
+                     sizeof (LabelBlock) * (trie->idx / 64 + 1));
+        copy_section(fh, &pos, sb->tmp[TMP_LABEL_OFFSETS],
+                     sizeof (uint32_t) * trie->label_count);
+        copy_section(fh, &pos, sb->tmp[TMP_LABEL_DATA], trie->label_data_len);
+    }
+    if (trie->flags & TRIE_BUILD_KEY_COUNTS) {
+        copy_section(fh, &pos, sb->tmp[TMP_KEY_COUNTS],
+                     sizeof (uint32_t) * trie->chunks_idx);
+    }
+    if (trie->with_content) {
+        copy_section(fh, &pos, sb->tmp[TMP_DATA], trie->data_idx);
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef TRIE_CLIENT_H
+#define TRIE_CLIENT_H
+
+#include "trie.h"
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Connection to a `list-serve` daemon. A client must not be used from
+ * multiple threads at the same time, but each thread can have its own.
+ */
+typedef struct trie_client TrieClient;
+
+/**
+ * Result of one request.
+ */
+typedef struct {
+    uint32_t id;            /**< Id returned by `trie_client_send()`. */
+    unsigned status;        /**< `0` on success, see `serve-protocol.h`. */
+    size_t num_keys;        /**< Number of keys in the request. */
+    const ssize_t *counts;  /**< Number of values for each key, -1 if missing. */
+    const TrieValue *values;/**< Values of all keys one after another. */
+} TrieClientResponse;
+
+/**
+ * Connect to the daemon listening on a Unix domain socket.
+ *
+ * @param path  path of the socket
+ * @return      new client or NULL with `errno` set
+ */
+TrieClient * trie_client_connect(const char *path);
+
+void trie_client_close(TrieClient *client);
+
+/**
+ * Send a request without waiting for the response. Multiple requests can be
+ * sent before reading their responses, but the socket buffers must be able
+ * to hold the responses that were not read yet.
+ *
+ * @param client    connection to use
+ * @param trie      index of the trie on the command line of the daemon
+ * @param keys      keys to look up
+ * @param key_lens  lengths of the keys
+ * @param n         number of keys (at most 65535)
+ * @return          id of the request or -1 on error
+ */
+int64_t trie_client_send(TrieClient *client, unsigned trie, const char **keys,
+                         const size_t *key_lens, size_t n);
+
+/**
+ * Wait for the response to the oldest request that was not received yet. The
+ * response points into memory of the client and is valid until the next call
+ * to `trie_client_recv()` or `trie_client_lookup()`.
+ *
+ * @return  0 on success, -1 on error or when the connection was closed
+ */
+int trie_client_recv(TrieClient *client, TrieClientResponse *response);
+
+/**
+ * Send a request and wait for its response.
+ *
+ * @return  0 on success, -1 on error
+ */
+int trie_client_lookup(TrieClient *client, unsigned trie, const char **keys,
+                       const size_t *key_lens, size_t n,
+                       TrieClientResponse *response);
+
+#endif /* end of include guard: TRIE_CLIENT_H */
@@ -0,0 +1,562 @@
+#ifndef TRIE_PRIVATE_H
+#define TRIE_PRIVATE_H
+
+/*
+ * Definitions shared by the source files of the library. Nothing here is part
+ * of the public interface.
+ */
+
+#include "trie.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Mark functions that are shared between source files of the library, but
+ * should not be exported from the shared object.
+ */
+#define INTERNAL __attribute__((visibility("hidden")))
+
+/*
+ * Add fallback for static assert if not provided by compiler.
+ */
+#ifndef static_assert
+# ifdef _Static_assert
+#  define static_assert(cond, err) _Static_assert(cond, err)
+# else
+#  define JOIN_(x,y) x##y
+#  define JOIN(x,y) JOIN_(x,y)
+#  define static_assert(cond, err) \
+        typedef char JOIN(static_assertion_, __COUNTER__)[(cond)?1:-1]
+# endif
+#endif
+
+#define VERSION 24
+
+#define INIT_SIZE 4096
+
+/**
+ * This is a length tagged string implementation. The data is not allocated
+ * separately, it directly follows the capacity and length.
+ *
+ * It is not safe to store these structures into arrays or embed them into
+ * other structures.
+ */
+typedef struct {
+    size_t len;     /**< Capacity of the string. */
+    size_t used;    /**< Actual length of the string. */
+    char data[];    /**< Data of the string. */
+} String;
+
+typedef struct arena_block ArenaBlock;
+
+struct arena_block {
+    ArenaBlock *next;
+    size_t size;    /**< Capacity of the block. */
+    size_t used;    /**< How many bytes are already allocated. */
+    char data[];
+};
+
+/**
+ * Memory for objects that live as long as the builder. Allocation only bumps
+ * a pointer and all objects are freed at once with `arena_free()`.
+ */
+typedef struct {
+    ArenaBlock *head;   /**< Block used for new allocations. */
+    size_t allocated;   /**< Total size of all blocks. */
+} Arena;
+
+typedef uint32_t NodeId;
+typedef uint32_t ChunkId;
+typedef uint32_t DataId;
+
+/**
+ * This is the linked list used during compilation to build the Trie.
+ */
+typedef struct {
+    ChunkId next;   /**< Next chunk in the linked list. */
+    NodeId value;   /**< Node associated with this chunk. */
+    char key;       /**< Key of this chunk. */
+} TrieNodeChunkBuilder;
+
+/**
+ * When consolidating, the linked list of chunks of a node is collected into an
+ * array of these and sorted.
+ */
+typedef struct {
+    NodeId value;   /**< Index of the node linked from this chunk. **/
+    char key;       /**< Key for this chunk. **/
+} __attribute__((__packed__)) TrieNodeChunk;
+
+static_assert(sizeof(TrieNodeChunk) == 5, "TrieNodeChunk has wrong size");
+
+/**
+ * Nodes with at least this many children do not store the keys of the chunks,
+ * but a bitmap of 256 bits instead. A set bit means there is a chunk for that
+ * key, and the number of set bits before it gives the position of the chunk.
+ * The bitmap fits into the space the keys would otherwise take.
+ */
+#define BITMAP_THRESHOLD 32
+#define BITMAP_WORDS (256 / 64)
+
+static_assert(BITMAP_THRESHOLD * sizeof(uint8_t) >= BITMAP_WORDS * sizeof(uint64_t),
+              "Bitmap does not fit in the chunk keys");
+
+/**
+ * How many bytes after the end of the chunk keys are guaranteed to be
+ * readable. This allows searching keys of small nodes with vector
+ * instructions without caring about the end of the mapped file.
+ */
+#define CHUNK_KEYS_PADDING 32
+
+/**
+ * In the serialized file, the chunks of a node are stored as two parallel
+ * arrays. The keys are sorted as unsigned bytes and directly follow each
+ * other, so that they can be searched with a single vector comparison. Nodes
+ * with many children use the bitmap encoding for keys instead.
+ */
+typedef struct {
+    ChunkId chunk;              /**< Index of first chunk of the node. */
+    DataId data;                /**< Data associated with this node. */
+    unsigned char num_chunks;   /**< Number chunks associated with this node. */
+} __attribute__((packed)) TrieNode;
+
+static_assert(sizeof(TrieNode) == 9, "TrieNodeChunk has wrong size");
+
+/**
+ * Only a small fraction of nodes has a label. To avoid storing an offset for
+ * each node, there is a bitmap of labelled nodes. The offset of the label is
+ * found by the number of labelled nodes before the node in question. To make
+ * this fast, the bitmap is split into blocks with precomputed counts.
+ */
+typedef struct {
+    uint64_t bits;  /**< Which of the 64 nodes in this block have a label. */
+    uint32_t rank;  /**< Number of labelled nodes in previous blocks. */
+    uint32_t pad;
+} LabelBlock;
+
+/**
+ * Longest label a node can have. Longer chains of single child nodes are
+ * split into multiple nodes.
+ */
+#define MAX_LABEL UCHAR_MAX
+
+/**
+ * The root table maps the first two bytes of a key directly to the node at
+ * depth two, so that lookups skip the two most shared levels. It is only
+ * built when the root has at least `ROOT_TABLE_MIN_FANOUT` children, the trie
+ * has at least as many nodes as the table has entries and no node at depth
+ * one has a label.
+ */
+#define ROOT_TABLE_ENTRIES (1 << 16)
+#define ROOT_TABLE_MIN_FANOUT 16
+
+/**
+ * Flag stored in the header when the file contains the root table. It is not
+ * part of the public `TRIE_BUILD_*` flags.
+ */
+#define TRIE_FLAG_ROOT_TABLE (1 << 7)
+
+/**
+ * With `TRIE_BUILD_BLOCK_VALUES`, the unique values are sorted and stored in
+ * blocks of this many strings. Each string only stores what differs from the
+ * previous one in its block, so a value can be decoded from its block alone.
+ */
+#define VALUE_BLOCK_SIZE 16
+
+/**
+ * Lengths in records are stored as variable length integers with seven bits
+ * in each byte. A 32 bit number takes at most this many bytes.
+ */
+#define MAX_VARINT_LEN 5
+
+/**
+ * How much longer than the value an encoded entry can be: the length of the
+ * prefix shared with the key and the length of the rest.
+ */
+#define MAX_ENTRY_OVERHEAD (2 * MAX_VARINT_LEN)
+
+/**
+ * How much longer than its entries a record can be: the number of values.
+ */
+#define MAX_RECORD_OVERHEAD MAX_VARINT_LEN
+
+typedef struct stream_builder StreamBuilder;
+
+typedef struct thread_slot ThreadSlot;
+
+/**
+ * Header of the state a thread keeps for an object, at the start of the slot
+ * types of `ThreadSlots`.
+ */
+struct thread_slot {
+    ThreadSlot *next;
+    const void *owner;      /**< Identifies the thread using the slot. */
+};
+
+/**
+ * Slots of all threads that used an object. Slots are only added, and all of
+ * them are freed with the object. The id is unique among all lists ever
+ * created, so that threads can cache their slots by it.
+ */
+typedef struct {
+    ThreadSlot *head;
+    uint64_t id;
+} ThreadSlots;
+
+typedef struct counter_slot CounterSlot;
+
+/**
+ * Counters of a single thread. Only the owning thread writes them, other
+ * threads may read them at any time.
+ */
+struct counter_slot {
+    ThreadSlot base;
+    TrieCounters counts;
+};
+
+/**
+ * Lookup counters of a loaded trie, see `trie_set_counters()`.
+ */
+typedef struct {
+    bool enabled;           /**< Whether lookups should count. */
+    pthread_mutex_t lock;   /**< Protects the base. */
+    ThreadSlots slots;      /**< Slots of all threads that counted. */
+    TrieCounters base;      /**< Sum of the slots at the last reset. */
+} Counters;
+
+struct trie {
+    uint8_t version;        /**< Version of trie. */
+    uint8_t with_content;   /**< Whether the trie stores data. */
+    uint8_t use_compress;   /**< Whether to use the compression. */
+    uint8_t flags;          /**< Combination of `TRIE_BUILD_*` flags. */
+    TrieNode *nodes;        /**< Array of all trie nodes. */
+    uint32_t len;           /**< Capacity of the node array. */
+    uint32_t idx;           /**< Number of nodes used. */
+
+    TrieNodeChunkBuilder *chunks;
+    uint32_t chunks_len;
+    uint32_t chunks_idx;
+
+    NodeId *chunk_values;           /**< Target nodes of all chunks. */
+    unsigned char *chunk_keys;      /**< Keys of all chunks or bitmaps. */
+
+    /**
+     * In radix mode, chains of nodes with a single child and no data are
+     * collapsed into the last node of the chain. That node gets a label with
+     * the skipped keys. The label must match the key before continuing the
+     * search in the node. Each label is stored as a length byte followed by
+     * the keys.
+     */
+    uint32_t *labels;               /**< Label offset for each node (builder). */
+    LabelBlock *label_blocks;       /**< Which nodes have labels. */
+    uint32_t *label_offsets;        /**< Offsets of labels of labelled nodes. */
+    uint32_t label_count;           /**< Number of labelled nodes. */
+    unsigned char *label_data;      /**< Data of all labels. */
+    uint32_t label_data_len;        /**< Size of label data. */
+
+    NodeId *root_table;     /**< Nodes at depth two, indexed by two bytes. */
+
+    /**
+     * With `TRIE_BUILD_KEY_COUNTS`, the number of keys in the subtrees of
+     * a chunk and all chunks before it in the same node. The keys below a
+     * node are its own key and the count of its last chunk, and the keys
+     * before a child are the count of the previous chunk, so ranks are found
+     * without visiting siblings.
+     */
+    uint32_t *key_counts;
+
+    char *data;
+    uint32_t *value_blocks;     /**< Offsets of blocks of values in data. */
+    uint32_t value_count;       /**< Number of values stored in blocks. */
+    String **data_builder;
+    Arena arena;            /**< Storage of strings in data builder. */
+    uint32_t data_idx;
+    uint32_t data_len;
+
+    StreamBuilder *stream;  /**< Builder for sorted input. */
+    unsigned threads;       /**< Number of threads used for serializing. */
+
+    void *base_mem;     /**< Address of the memory mapped file. */
+    size_t file_len;    /**< Size of the file on disk. */
+    Counters *counters; /**< Lookup counters or NULL. */
+};
+
+/**
+ * Find the label of a node in a loaded trie.
+ *
+ * @return  the label (length byte followed by keys) or NULL
+ */
+static inline const unsigned char *
+node_label(Trie *trie, NodeId node)
+{
+    if (!trie->label_blocks) {
+        return NULL;
+    }
+    const LabelBlock *block = trie->label_blocks + node / 64;
+    uint64_t bit = UINT64_C(1) << (node % 64);
+    if (!(block->bits & bit)) {
+        return NULL;
+    }
+    uint32_t rank = block->rank + __builtin_popcountll(block->bits & (bit - 1));
+    return trie->label_data + trie->label_offsets[rank];
+}
+
+#define ERROR_STAT      1
+#define ERROR_OPEN      2
+#define ERROR_MMAP      3
+#define ERROR_VERSION   4
+#define ERROR_TRUNCATED 5
+#define ERROR_UNSORTED  6
+#define ERROR_FLAGS     7
+#define ERROR_LOCK      8
+#define ERROR_NOMEM     9
+
+/**
+ * Sections of the file are aligned to this many bytes.
+ */
+#define SECTION_ALIGN 8
+
+/**
+ * Remember an error code so that `trie_get_last_error()` can describe it.
+ */
+INTERNAL void set_last_error(int error);
+
+/**
+ * Encode a value inserted under a key as an entry: with compression, the
+ * length of the prefix it shares with the key, then the length and bytes of
+ * the rest. The buffer must be `MAX_ENTRY_OVERHEAD` bytes longer than value.
+ *
+ * @return  number of bytes written
+ */
+INTERNAL size_t encode_entry(unsigned char *buf, const char *value,
+                             const char *key, bool compress);
+
+/**
+ * Turn entries of a single key into the record stored in the file: number of
+ * values, table of their lengths and bytes of all values. The output must be
+ * `MAX_RECORD_OVERHEAD` bytes longer than the entries.
+ *
+ * @return  number of bytes written
+ */
+INTERNAL size_t encode_record(unsigned char *out, const unsigned char *entries,
+                              size_t len, bool compress);
+
+/**
+ * Encode keys of sorted chunks of a node into `n` bytes starting at `keys`.
+ * Small nodes get the keys themselves, big nodes a bitmap.
+ */
+INTERNAL void
+encode_chunk_keys(const TrieNodeChunk *chunks, unsigned n, unsigned char *keys);
+
+INTERNAL size_t align_up(size_t size);
+
+/**
+ * Write a section of the file, preceded by padding to align it.
+ *
+ * @param pos   (in/out) current position in the file
+ */
+INTERNAL void
+write_section(FILE *fh, size_t *pos, const void *data, size_t size);
+
+/**
+ * Write the header of the file. Only fields describing the file are written,
+ * everything else is zeroed so that the output does not depend on addresses
+ * of memory used by the builder.
+ */
+INTERNAL void write_header(FILE *fh, size_t *pos, const Trie *trie);
+
+/**
+ * Sort an array like `qsort()`, splitting the work between threads.
+ */
+INTERNAL void parallel_sort(void *base, size_t n, size_t size,
+                            int (*compare)(const void *, const void *),
+                            unsigned threads);
+
+/**
+ * Call `fn` on disjoint ranges covering [start, end) from multiple threads.
+ * Returns when all calls are finished.
+ */
+INTERNAL void parallel_for(size_t start, size_t end, unsigned threads,
+                           void (*fn)(size_t, size_t, void *), void *arg);
+
+/**
+ * Prepare an empty list of slots with a new id.
+ */
+INTERNAL void thread_slots_init(ThreadSlots *slots);
+
+/**
+ * Free all slots of the list. No thread may use them any more.
+ */
+INTERNAL void thread_slots_free(ThreadSlots *slots);
+
+/**
+ * Find the slot of the calling thread. If the thread has none and `size` is
+ * not zero, a zeroed slot of `size` bytes is added to the list.
+ *
+ * @return  the slot, or NULL if there is none or it could not be allocated
+ */
+INTERNAL ThreadSlot * thread_slots_get(ThreadSlots *slots, size_t size);
+
+/**
+ * First slot of the list for walking all slots. Slots added meanwhile may be
+ * missed.
+ */
+static inline ThreadSlot * thread_slots_first(ThreadSlots *slots)
+{
+    return __atomic_load_n(&slots->head, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Allocate `size` bytes from the arena. The memory is not initialized.
+ * Returns NULL if memory runs out.
+ */
+INTERNAL void * arena_alloc(Arena *arena, size_t size);
+
+/**
+ * Make an allocation bigger, moving it if it can not be extended in place.
+ * Returns NULL if memory runs out, the old allocation is then kept.
+ */
+INTERNAL void * arena_grow(Arena *arena, void *ptr, size_t old_size,
+                           size_t new_size);
+
+/**
+ * Move all memory from `other` into `arena`, leaving `other` empty.
+ */
+INTERNAL void arena_merge(Arena *arena, Arena *other);
+
+INTERNAL void arena_free(Arena *arena);
+
+/**
+ * Create a builder for sorted input. Sections of the trie are stored in
+ * temporary files until the trie is serialized.
+ *
+ * @return  new builder or NULL if temporary files could not be created
+ */
+INTERNAL StreamBuilder * stream_new(void);
+
+INTERNAL void stream_free(StreamBuilder *sb);
+
+/**
+ * Insert a key into trie built from sorted input.
+ *
+ * @return  0 on success, -1 if the key is not sorted
+ */
+INTERNAL int stream_insert(Trie *trie, const char *key, const char *value);
+
+/**
+ * Finalize the trie built from sorted input and write it to a file.
+ */
+INTERNAL void stream_finish(Trie *trie, FILE *fh);
+
+/**
+ * Write the values of a node of a loaded trie like `trie_lookup_values()`.
+ * The node must have data and `key` must be its key.
+ */
+INTERNAL ssize_t node_values(Trie *trie, NodeId node, const char *key,
+                             size_t key_len, TrieValue *values,
+                             size_t max_values, char *buf, size_t buf_len);
+
+/**
+ * Find the child of a node of a loaded trie reached by a byte. The label of
+ * the child is not matched.
+ *
+ * @return  the child or 0
+ */
+INTERNAL NodeId node_child(Trie *trie, NodeId node, unsigned char key);
+
+/**
+ * Find the position of the chunk of a node of a loaded trie for a byte.
+ *
+ * @return  index of the chunk relative to the first chunk of the node or -1
+ */
+INTERNAL int chunk_index(Trie *trie, const TrieNode *node, unsigned char key);
+
+/**
+ * Follow the key from a node of a loaded trie like a lookup does from the
+ * root, without using the root table. The label of the starting node must
+ * already be matched.
+ *
+ * @return  node for the whole key or 0 if there is no such node
+ */
+INTERNAL NodeId walk_from(Trie *trie, NodeId node, const char *key,
+                          size_t key_len);
+
+/**
+ * Find the key of the `index`-th chunk of a node of a loaded trie.
+ */
+INTERNAL unsigned char chunk_key(Trie *trie, const TrieNode *node,
+                                 unsigned index);
+
+/**
+ * Function called by `walk_keys()` for every key. The key is NUL terminated.
+ * A non-zero return value stops the walk.
+ */
+typedef int (*KeyVisitor)(const char *key, size_t key_len, NodeId node, void *arg);
+
+/**
+ * Visit all keys of a loaded trie in sorted order.
+ *
+ * @return  the value that stopped the walk or 0
+ */
+INTERNAL int walk_keys(Trie *trie, KeyVisitor visit, void *arg);
+
+/**
+ * Create counters with no slots.
+ */
+INTERNAL Counters * counters_new(void);
+
+INTERNAL void counters_free(Counters *counters);
+
+/**
+ * Turn counting on or off. Lookups check this before timing themselves.
+ */
+INTERNAL void counters_set_enabled(Counters *counters, bool enabled);
+
+/**
+ * Return the counters of a loaded trie if counting is enabled.
+ */
+static inline Counters * counters_active(Trie *trie)
+{
+    Counters *counters = __atomic_load_n(&trie->counters, __ATOMIC_ACQUIRE);
+    if (__builtin_expect(counters == NULL, 1)) {
+        return NULL;
+    }
+    return __atomic_load_n(&counters->enabled, __ATOMIC_RELAXED) ? counters : NULL;
+}
+
+/**
+ * Find the slot of the calling thread, creating it on first use.
+ *
+ * @return  the slot or NULL if it could not be allocated
+ */
+INTERNAL CounterSlot * counters_slot(Counters *counters);
+
+INTERNAL void counters_sum(Counters *counters, TrieCounters *sum);
+
+INTERNAL void counters_reset(Counters *counters);
+
+/**
+ * Add to a counter of the calling thread. Only the owner writes a slot, so
+ * this is a plain load and store that other threads never see torn.
+ */
+static inline void counter_add(uint64_t *counter, uint64_t n)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELAXED);
+}
+
+/**
+ * Current time in nanoseconds for timing lookups.
+ */
+INTERNAL uint64_t counters_now(void);
+
+/**
+ * Record `n` lookups that each took `ns` nanoseconds.
+ */
+INTERNAL void counters_add_latency(CounterSlot *slot, uint64_t ns, uint64_t n);
+
+#endif /* end of include guard: TRIE_PRIVATE_H */
@@ -1,8 +1,6 @@
-#include "trie.h"
+#include "trie-private.h"
 
-#include <limits.h>
 #include <assert.h>
-#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
@@ -10,98 +8,13 @@
 #include <unistd.h>
 #include <sys/mman.h>
 #include <fcntl.h>
-#include <stdint.h>
-
-/*
- * Add fallback for static assert if not provided by compiler.
- */
-#ifndef static_assert
-# ifdef _Static_assert
-#  define static_assert(cond, err) _Static_assert(cond, err)
-# else
-#  define JOIN_(x,y) x##y
-#  define JOIN(x,y) JOIN_(x,y)
-#  define static_assert(cond, err) \
-        typedef char JOIN(static_assertion_, __COUNTER__)[(cond)?1:-1]
-# endif
-#endif
-
-#define VERSION 16
-
-#define INIT_SIZE 4096
-
-/**
- * This is a length tagged string implementation. The data is not allocated
- * separately, it directly follows the capacity and length.
- *
- * It is not safe to store these structures into arrays or embed them into
- * other structures.
- */
-typedef struct {
-    size_t len;     /**< Capacity of the string. */
-    size_t used;    /**< Actual length of the string. */
-    char data[];    /**< Data of the string. */
-} String;
-
-typedef uint32_t NodeId;
-typedef uint32_t ChunkId;
-typedef uint32_t DataId;
-
-/**
- * This is the linked list used during compilation to build the Trie.
- */
-typedef struct {
-    ChunkId next;   /**< Next chunk in the linked list. */
-    NodeId value;   /**< Node associated with this chunk. */
-    char key;       /**< Key of this chunk. */
-} TrieNodeChunkBuilder;
-
-/**
- * The actual chunk will be used after consolidating. Next chunk in the list is
- * following directly after it.
- */
-typedef struct {
-    NodeId value;   /**< Index of the node linked from this chunk. **/
-    char key;       /**< Key for this chunk. **/
-} __attribute__((__packed__)) TrieNodeChunk;
-
-static_assert(sizeof(TrieNodeChunk) == 5, "TrieNodeChunk has wrong size");
-
-typedef struct {
-    ChunkId chunk;              /**< First chunk of the linked list of children. */
-    DataId data;                /**< Data associated with this node. */
-    unsigned char num_chunks;   /**< Number chunks associated with this node. */
-} __attribute__((packed)) TrieNode;
-
-static_assert(sizeof(TrieNode) == 9, "TrieNodeChunk has wrong size");
-
-struct trie {
-    uint8_t version;        /**< Version of trie. */
-    uint8_t with_content;   /**< Whether the trie stores data. */
-    uint8_t use_compress;   /**< Whether to use the compression. */
-    TrieNode *nodes;        /**< Array of all trie nodes. */
-    uint32_t len;           /**< Capacity of the node array. */
-    uint32_t idx;           /**< Number of nodes used. */
-
-    TrieNodeChunkBuilder *chunks;
-    uint32_t chunks_len;
-    uint32_t chunks_idx;
-
-    TrieNodeChunk *real_chunks;
-
-    char *data;
-    String **data_builder;
-    uint32_t data_idx;
-    uint32_t data_len;
-
-    void *base_mem;     /**< Address of the memory mapped file. */
-    size_t file_len;    /**< Size of the file on disk. */
-};
 
-#define ERROR_STAT      1
-#define ERROR_OPEN      2
-#define ERROR_MMAP      3
-#define ERROR_VERSION   4
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+# include <immintrin.h>
+#endif
 
 static int last_error = 0;
 static const char *errors[] = {
@@ -109,7 +22,12 @@ static const char *errors[] = {
     "Failed to stat the file",
     "Failed to open file",
     "Mapping file to memory failed",
-    "File has bad version"
+    "File has bad version",
+    "File is truncated",
+    "Keys are not sorted",
+    "Unsupported combination of flags",
+    "Locking file in memory failed",
+    "Out of memory"
 };
 
 static ChunkId chunk_alloc(Trie *t)
@@ -140,9 +58,32 @@ static NodeId node_alloc(Trie *t)
 
 Trie * trie_new(int with_content, int use_compress)
 {
+    return trie_new_ex(with_content, use_compress, 0);
+}
+
+Trie * trie_new_ex(int with_content, int use_compress, unsigned flags)
+{
+    if ((flags & TRIE_BUILD_SORTED)
+            && (flags & (TRIE_BUILD_MINIMIZE | TRIE_BUILD_BLOCK_VALUES))) {
+        last_error = ERROR_FLAGS;
+        return NULL;
+    }
     Trie *t = calloc(sizeof *t, 1);
     t->version = VERSION;
+    t->flags = flags;
     t->with_content = with_content;
+    t->use_compress = use_compress;
+    t->threads = 1;
+
+    if (flags & TRIE_BUILD_SORTED) {
+        t->stream = stream_new();
+        if (!t->stream) {
+            free(t);
+            last_error = ERROR_OPEN;
+            return NULL;
+        }
+        return t;
+    }
     t->nodes = calloc(sizeof t->nodes[0], INIT_SIZE);
     t->len = INIT_SIZE;
     t->idx = 1;
@@ -157,94 +98,368 @@ Trie * trie_new(int with_content, int use_compress)
         t->data_idx = 1;
     }
 
-    t->use_compress = use_compress;
-
     node_alloc(t);
     chunk_alloc(t);
 
     return t;
 }
 
+void trie_set_threads(Trie *trie, unsigned threads)
+{
+    trie->threads = threads > 0 ? threads : 1;
+}
+
 void trie_free(Trie *trie)
 {
     if (!trie)
         return;
     if (trie->base_mem) {
         munmap(trie->base_mem, trie->file_len);
+        counters_free(trie->counters);
         free(trie);
     } else {
+        stream_free(trie->stream);
         free(trie->nodes);
         free(trie->chunks);
-        free(trie->real_chunks);
+        free(trie->chunk_values);
+        free(trie->chunk_keys);
+        free(trie->labels);
+        free(trie->label_blocks);
+        free(trie->label_offsets);
+        free(trie->label_data);
+        free(trie->root_table);
+        free(trie->key_counts);
+        free(trie->value_blocks);
         free(trie->data);
+        free(trie->data_builder);
+        arena_free(&trie->arena);
         free(trie);
     }
 }
 
-static void
-compress(char *buffer, const char *data, const char *key)
+static size_t varint_encode(unsigned char *buf, uint32_t value)
 {
-    size_t key_len = strlen(key);
-    size_t data_len = strlen(data);
+    size_t len = 0;
+    while (value >= 0x80) {
+        buf[len++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    buf[len++] = value;
+    return len;
+}
+
+static uint32_t varint_decode(const unsigned char **pos)
+{
+    uint32_t value = 0;
+    unsigned shift = 0;
+    while (**pos & 0x80) {
+        value |= (uint32_t) (*(*pos)++ & 0x7f) << shift;
+        shift += 7;
+    }
+    return value | (uint32_t) *(*pos)++ << shift;
+}
+
+size_t encode_entry(unsigned char *buf, const char *value, const char *key,
+                    bool compress)
+{
+    size_t len = strlen(value);
     size_t common = 0;
-    while (common < key_len && common < data_len && key[common] == data[common]) {
-        ++common;
+    size_t pos = 0;
+    if (compress) {
+        while (key[common] && key[common] == value[common]) {
+            ++common;
+        }
+        pos += varint_encode(buf + pos, common);
+    }
+    pos += varint_encode(buf + pos, len - common);
+    memcpy(buf + pos, value + common, len - common);
+    return pos + len - common;
+}
+
+size_t encode_record(unsigned char *out, const unsigned char *entries,
+                     size_t len, bool compress)
+{
+    const unsigned char *end = entries + len;
+    const unsigned char *pos;
+    uint32_t count = 0;
+    for (pos = entries; pos < end; ++count) {
+        if (compress) {
+            varint_decode(&pos);
+        }
+        uint32_t n = varint_decode(&pos);
+        pos += n;
+    }
+
+    size_t written = varint_encode(out, count);
+    for (pos = entries; pos < end; ) {
+        const unsigned char *start = pos;
+        if (compress) {
+            varint_decode(&pos);
+        }
+        uint32_t n = varint_decode(&pos);
+        memcpy(out + written, start, pos - start);
+        written += pos - start;
+        pos += n;
+    }
+    for (pos = entries; pos < end; ) {
+        if (compress) {
+            varint_decode(&pos);
+        }
+        uint32_t n = varint_decode(&pos);
+        memcpy(out + written, pos, n);
+        written += n;
+        pos += n;
+    }
+    return written;
+}
+
+/**
+ * Output buffer that silently drops everything that does not fit, but keeps
+ * counting how much space would be needed.
+ */
+typedef struct {
+    char *buf;      /**< Where to write. */
+    size_t cap;     /**< Size of the buffer including the terminating NUL. */
+    size_t used;    /**< Total length of the output so far. */
+} OutBuf;
+
+static void
+out_append(OutBuf *out, const char *data, size_t len)
+{
+    if (out->used + 1 < out->cap) {
+        size_t avail = out->cap - 1 - out->used;
+        memcpy(out->buf + out->used, data, len < avail ? len : avail);
+    }
+    out->used += len;
+}
+
+static void
+out_finish(OutBuf *out)
+{
+    if (out->cap > 0) {
+        out->buf[out->used < out->cap ? out->used : out->cap - 1] = 0;
+    }
+}
+
+/**
+ * A stored record split into pieces that follow each other. Records stored
+ * in blocks are reassembled from suffixes of several records of the block.
+ */
+typedef struct {
+    const char *ptr[VALUE_BLOCK_SIZE];
+    size_t len[VALUE_BLOCK_SIZE];
+    unsigned n;
+} Pieces;
+
+/**
+ * Sequential reader of bytes split into pieces.
+ */
+typedef struct {
+    const Pieces *pieces;
+    unsigned piece;     /**< Current piece. */
+    size_t offset;      /**< Position in the current piece. */
+} Reader;
+
+static void reader_init(Reader *r, const Pieces *pieces)
+{
+    r->pieces = pieces;
+    r->piece = 0;
+    r->offset = 0;
+}
+
+static unsigned char reader_byte(Reader *r)
+{
+    while (r->offset == r->pieces->len[r->piece]) {
+        ++r->piece;
+        r->offset = 0;
+    }
+    return r->pieces->ptr[r->piece][r->offset++];
+}
+
+static uint32_t reader_varint(Reader *r)
+{
+    uint32_t value = 0;
+    unsigned shift = 0;
+    unsigned char byte;
+    do {
+        byte = reader_byte(r);
+        value |= (uint32_t) (byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return value;
+}
+
+/**
+ * Return pointer to the next `len` bytes if they are in a single piece and
+ * move past them. Otherwise return NULL and do not move.
+ */
+static const char * reader_view(Reader *r, size_t len)
+{
+    while (r->piece < r->pieces->n && r->offset == r->pieces->len[r->piece]) {
+        ++r->piece;
+        r->offset = 0;
+    }
+    if (len == 0) {
+        return "";
+    }
+    if (r->piece == r->pieces->n || r->pieces->len[r->piece] - r->offset < len) {
+        return NULL;
+    }
+    const char *ptr = r->pieces->ptr[r->piece] + r->offset;
+    r->offset += len;
+    return ptr;
+}
+
+/**
+ * Append the next `len` bytes to the output.
+ */
+static void reader_read(Reader *r, size_t len, OutBuf *out)
+{
+    while (len > 0) {
+        size_t avail = r->pieces->len[r->piece] - r->offset;
+        if (avail == 0) {
+            ++r->piece;
+            r->offset = 0;
+            continue;
+        }
+        size_t n = len < avail ? len : avail;
+        out_append(out, r->pieces->ptr[r->piece] + r->offset, n);
+        r->offset += n;
+        len -= n;
     }
-    buffer[0] = (char) common + '0';
-    memcpy(buffer + 1, data + common, data_len - common + 1);
 }
 
-static char *
-decompress(const char *data, const char *key)
+/**
+ * Find the pieces of a record stored in a block. Each record in the block is
+ * stored as the length of the prefix it shares with the previous record,
+ * followed by the length and bytes of the rest. Going backwards from the
+ * wanted record, every record contributes the part of its suffix that is not
+ * covered by the prefixes shared with previous records.
+ */
+static void
+block_value(Trie *trie, DataId id, Pieces *pieces)
 {
-    char tmp[strlen(data) + 1];
-    strcpy(tmp, data);
+    uint32_t index = id - 1;
+    const unsigned char *pos = (const unsigned char *) trie->data
+        + trie->value_blocks[index / VALUE_BLOCK_SIZE];
+    unsigned wanted = index % VALUE_BLOCK_SIZE;
+    uint32_t shared[VALUE_BLOCK_SIZE];
+    const char *suffix[VALUE_BLOCK_SIZE];
+
+    for (unsigned i = 0; i <= wanted; ++i) {
+        shared[i] = varint_decode(&pos);
+        uint32_t len = varint_decode(&pos);
+        suffix[i] = (const char *) pos;
+        pos += len;
+    }
+
+    size_t len = shared[wanted] + ((const char *) pos - suffix[wanted]);
+    unsigned n = 0;
+    for (unsigned i = wanted + 1; i-- > 0 && len > 0; ) {
+        if (len > shared[i]) {
+            pieces->ptr[n] = suffix[i];
+            pieces->len[n++] = len - shared[i];
+            len = shared[i];
+        }
+    }
+    /* The pieces were found from the end of the record. */
+    for (unsigned i = 0; i < n / 2; ++i) {
+        const char *ptr = pieces->ptr[i];
+        size_t piece_len = pieces->len[i];
+        pieces->ptr[i] = pieces->ptr[n - 1 - i];
+        pieces->len[i] = pieces->len[n - 1 - i];
+        pieces->ptr[n - 1 - i] = ptr;
+        pieces->len[n - 1 - i] = piece_len;
+    }
+    pieces->n = n;
+}
 
-    size_t len = 1024;
-    size_t used = 0;
-    char *buffer = malloc(len);
+/**
+ * Values of a single node. A record starts with the number of values and a
+ * table with the length of each value (preceded by the length of the prefix
+ * shared with the key when compression is used). The bytes of all values
+ * follow the table.
+ */
+typedef struct {
+    Pieces pieces;
+    Reader table;       /**< Position in the table of lengths. */
+    Reader bytes;       /**< Position in the bytes of values. */
+    uint32_t count;     /**< Number of values. */
+} Record;
 
-    char *line = strtok(tmp, "\n");
-    int counter = 0;
-    while (line) {
-        size_t line_len = strlen(line);
-        while (used + 1 + line[0] - '0' + line_len >= len) {
-            len *= 2;
-            buffer = realloc(buffer, len);
+static void
+record_open(Trie *trie, NodeId node, Record *rec)
+{
+    DataId data = trie->nodes[node].data;
+    if (trie->value_blocks) {
+        block_value(trie, data, &rec->pieces);
+    } else {
+        rec->pieces.ptr[0] = trie->data + data;
+        rec->pieces.len[0] = trie->data_idx - data;
+        rec->pieces.n = 1;
+    }
+    reader_init(&rec->table, &rec->pieces);
+    rec->count = reader_varint(&rec->table);
+    rec->bytes = rec->table;
+    for (uint32_t i = 0; i < rec->count; ++i) {
+        if (trie->use_compress) {
+            reader_varint(&rec->bytes);
         }
-        if (counter++ > 0) {
-            buffer[used++] = '\n';
+        reader_varint(&rec->bytes);
+    }
+}
+
+/**
+ * Read the lengths of the next value in the record.
+ *
+ * @param common    (out) length of the prefix taken from the key
+ * @return          length of the rest of the value stored in the record
+ */
+static uint32_t
+record_next(Trie *trie, Record *rec, size_t key_len, size_t *common)
+{
+    *common = trie->use_compress ? reader_varint(&rec->table) : 0;
+    assert(*common <= key_len);
+    (void) key_len;
+    return reader_varint(&rec->table);
+}
+
+/**
+ * Write all values of a node into the output buffer, one per line.
+ */
+static void
+record_join(Trie *trie, NodeId node, OutBuf *out, const char *key, size_t key_len)
+{
+    Record rec;
+    record_open(trie, node, &rec);
+    for (uint32_t i = 0; i < rec.count; ++i) {
+        size_t common;
+        uint32_t len = record_next(trie, &rec, key_len, &common);
+        if (i > 0) {
+            out_append(out, "\n", 1);
         }
-        memcpy(buffer + used, key, line[0] - '0');
-        memcpy(buffer + used + line[0] - '0', line + 1, line_len);
-        used += line[0] - '0' + line_len - 1;
-        line = strtok(NULL, "\n");
+        out_append(out, key, common);
+        reader_read(&rec.bytes, len, out);
     }
-    return buffer;
 }
 
 /**
  * @param trie  trie that is being inserted to
  * @param node  to which node we are inserting
  * @param data  actual inserted data
+ * @return      0 on success, -1 if memory ran out
  */
-static void
+static int
 insert_data(Trie *trie, TrieNode *node, const char *data, const char *key)
 {
     assert(trie->base_mem == NULL);
 
     if (!trie->with_content) {
         node->data = 1;
-        return;
+        return 0;
     }
 
-    size_t len = strlen(data);
-    char buffer[len+1];
-    strcpy(buffer, data);
-    if (trie->use_compress) {
-        compress(buffer, data, key);
-    }
-    len = strlen(buffer);
+    size_t len = strlen(data) + MAX_ENTRY_OVERHEAD;
 
     /* No string exists for this node yet. */
     if (node->data == 0) {
@@ -254,20 +469,31 @@ insert_data(Trie *trie, TrieNode *node, const char *data, const char *key)
             trie->data_builder = realloc(trie->data_builder,
                     trie->data_len * sizeof *trie->data_builder);
         }
+        String *s = arena_alloc(&trie->arena, sizeof *s + len);
+        if (!s) {
+            set_last_error(ERROR_NOMEM);
+            return -1;
+        }
         node->data = trie->data_idx++;
-        trie->data_builder[node->data] = calloc(256, 1);
-        trie->data_builder[node->data]->len = 256;
+        s->len = len;
+        s->used = 0;
+        trie->data_builder[node->data] = s;
     }
     String *s = trie->data_builder[node->data];
-    if (s->used + len + 1 >= s->len - 16) {
-        s->len *= 2;
-        trie->data_builder[node->data] = s = realloc(s, s->len);
-    }
-    if (s->used > 0) {
-        s->data[s->used++] = '\n';
+    size_t needed = s->used + len;
+    if (needed > s->len) {
+        size_t capacity = 2 * s->len > needed ? 2 * s->len : needed;
+        s = arena_grow(&trie->arena, s, sizeof *s + s->len, sizeof *s + capacity);
+        if (!s) {
+            set_last_error(ERROR_NOMEM);
+            return -1;
+        }
+        s->len = capacity;
+        trie->data_builder[node->data] = s;
     }
-    strcpy(s->data + s->used, buffer);
-    s->used += len;
+    s->used += encode_entry((unsigned char *) s->data + s->used, data, key,
+                            trie->use_compress);
+    return 0;
 }
 
 /**
@@ -302,10 +528,13 @@ static NodeId find_or_create_node(Trie *trie, NodeId current, char key)
     return next->value;
 }
 
-void trie_insert(Trie *trie, const char *key, const char *value)
+int trie_insert(Trie *trie, const char *key, const char *value)
 {
     if (trie->base_mem) {
-        return;
+        return -1;
+    }
+    if (trie->stream) {
+        return stream_insert(trie, key, value);
     }
     NodeId current = 1;
     const char *orig_key = key;
@@ -314,38 +543,198 @@ void trie_insert(Trie *trie, const char *key, const char *value)
         current = find_or_create_node(trie, current, *key);
         ++key;
     }
-    insert_data(trie, trie->nodes + current, value, orig_key);
+    return insert_data(trie, trie->nodes + current, value, orig_key);
 }
 
 static int chunk_compare(const void *a, const void *b)
 {
     const TrieNodeChunk *c1 = (const TrieNodeChunk *) a;
     const TrieNodeChunk *c2 = (const TrieNodeChunk *) b;
-    return c1->key - c2->key;
+    return (unsigned char) c1->key - (unsigned char) c2->key;
+}
+
+/**
+ * Find position of a key in a bitmap encoded node.
+ *
+ * @return  index of the chunk relative to the first chunk of node or -1
+ */
+static int bitmap_search(const unsigned char *keys, unsigned char key)
+{
+    uint64_t bitmap[BITMAP_WORDS];
+    memcpy(bitmap, keys, sizeof bitmap);
+
+    unsigned word = key / 64;
+    uint64_t bit = UINT64_C(1) << (key % 64);
+    if (!(bitmap[word] & bit)) {
+        return -1;
+    }
+    int rank = __builtin_popcountll(bitmap[word] & (bit - 1));
+    for (unsigned i = 0; i < word; ++i) {
+        rank += __builtin_popcountll(bitmap[i]);
+    }
+    return rank;
+}
+
+/**
+ * Find position of a key in the list of keys of a small node. There must be
+ * fewer than `BITMAP_THRESHOLD` keys, but the memory must be readable up to
+ * `BITMAP_THRESHOLD` bytes.
+ *
+ * @return  index of the key or -1
+ */
+static int keys_search(const unsigned char *keys, unsigned n, unsigned char key)
+{
+    static_assert(BITMAP_THRESHOLD <= 32, "Small nodes do not fit a 32 bit mask");
+    uint32_t valid = (UINT32_C(1) << n) - 1;
+#if defined(__AVX2__)
+    __m256i needle = _mm256_set1_epi8(key);
+    __m256i hay = _mm256_loadu_si256((const __m256i *) keys);
+    uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(needle, hay)) & valid;
+    return mask ? __builtin_ctz(mask) : -1;
+#elif defined(__SSE2__)
+    __m128i needle = _mm_set1_epi8(key);
+    __m128i lo = _mm_loadu_si128((const __m128i *) keys);
+    __m128i hi = _mm_loadu_si128((const __m128i *) (keys + 16));
+    uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(needle, lo))
+        | (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(needle, hi)) << 16;
+    mask &= valid;
+    return mask ? __builtin_ctz(mask) : -1;
+#else
+    (void) valid;
+    const unsigned char *found = memchr(keys, key, n);
+    return found ? found - keys : -1;
+#endif
+}
+
+static inline int
+chunk_search(Trie *trie, const TrieNode *node, unsigned char key)
+{
+    const unsigned char *keys = trie->chunk_keys + node->chunk;
+    if (node->num_chunks >= BITMAP_THRESHOLD) {
+        return bitmap_search(keys, key);
+    }
+    return keys_search(keys, node->num_chunks, key);
 }
 
 static NodeId find_trie_node(Trie *trie, NodeId current, char key)
 {
     assert(current < trie->idx);
-    TrieNodeChunk key_chunk = { .value = 0, .key = key };
-    TrieNodeChunk *chunk = bsearch(&key_chunk,
-            trie->real_chunks + trie->nodes[current].chunk,
-            trie->nodes[current].num_chunks, sizeof(*trie->real_chunks),
-            chunk_compare);
-    return chunk ? chunk->value : 0;
+    const TrieNode *node = trie->nodes + current;
+    int pos = chunk_search(trie, node, key);
+    return pos < 0 ? 0 : trie->chunk_values[node->chunk + pos];
 }
 
-const char * trie_lookup(Trie *trie, const char *key)
+NodeId node_child(Trie *trie, NodeId node, unsigned char key)
 {
-    if (!trie->base_mem) {
-        return NULL;
+    return find_trie_node(trie, node, key);
+}
+
+int chunk_index(Trie *trie, const TrieNode *node, unsigned char key)
+{
+    return chunk_search(trie, node, key);
+}
+
+/**
+ * Check that the label of a node matches the beginning of the rest of the key.
+ * If it does, the key is advanced past it.
+ *
+ * @param pos   (in/out) position in the key
+ * @param end   end of the key
+ * @return      whether the search should continue in the node
+ */
+static inline bool
+match_label(Trie *trie, NodeId node, const char **pos, const char *end)
+{
+    const unsigned char *label = node_label(trie, node);
+    if (!label) {
+        return true;
     }
+    size_t len = label[0];
+    if ((size_t) (end - *pos) < len || memcmp(*pos, label + 1, len) != 0) {
+        return false;
+    }
+    *pos += len;
+    return true;
+}
+
+static inline unsigned root_table_index(const char *key)
+{
+    return (unsigned char) key[0] << 8 | (unsigned char) key[1];
+}
+
+/**
+ * Work done by a single lookup, collected while counting is enabled.
+ */
+typedef struct {
+    uint64_t nodes;     /**< Nodes reached below the root. */
+    uint64_t chunks;    /**< Chunks compared, a bitmap counts as one. */
+    NodeId node;        /**< Node for the whole key, 0 if there is none. */
+} WalkStats;
+
+static inline uint64_t compared_chunks(const TrieNode *node)
+{
+    return node->num_chunks >= BITMAP_THRESHOLD ? 1 : node->num_chunks;
+}
+
+/**
+ * Follow the key from the root as far as possible. Callers that do not count
+ * pass NULL as `stats`, which the compiler removes from the inlined walk.
+ *
+ * @param stats (out) work done by the walk, or NULL
+ * @return      node for the whole key or 0 if there is no such node
+ */
+static inline NodeId
+walk(Trie *trie, const char *key, size_t key_len, WalkStats *stats)
+{
     NodeId current = 1;
-    const char *orig_key = key;
+    const char *end = key + key_len;
+    if (trie->root_table && key_len >= 2) {
+        current = trie->root_table[root_table_index(key)];
+        key += 2;
+        if (stats) {
+            stats->nodes += current > 0;
+        }
+        if (current && !match_label(trie, current, &key, end)) {
+            current = 0;
+        }
+    }
+    while (key < end && current > 0) {
+        if (stats) {
+            stats->chunks += compared_chunks(trie->nodes + current);
+        }
+        current = find_trie_node(trie, current, *key++);
+        if (stats) {
+            stats->nodes += current > 0;
+        }
+        if (current && !match_label(trie, current, &key, end)) {
+            current = 0;
+        }
+    }
+    if (stats) {
+        stats->node = current;
+    }
+    return current;
+}
 
-    while (*key && current < trie->idx) {
+NodeId walk_from(Trie *trie, NodeId current, const char *key, size_t key_len)
+{
+    const char *end = key + key_len;
+    while (key < end && current > 0) {
         current = find_trie_node(trie, current, *key++);
+        if (current && !match_label(trie, current, &key, end)) {
+            return 0;
+        }
     }
+    return current;
+}
+
+/**
+ * Convert a node reached by looking up the key into the result returned to the
+ * caller.
+ */
+static const char *
+node_result(Trie *trie, NodeId current, const char *key, size_t key_len)
+{
     assert(current < trie->idx);
     if (current == 0 || trie->nodes[current].data == 0) {
         return NULL;
@@ -354,94 +743,508 @@ const char * trie_lookup(Trie *trie, const char *key)
         char *result = malloc(64);
         return strcpy(result, "Found");
     }
-    char *data = trie->data + trie->nodes[current].data;
-    if (trie->use_compress) {
-        return decompress(data, orig_key);
+    /* The table of lengths gives the size without decoding any value. */
+    Record rec;
+    record_open(trie, current, &rec);
+    size_t size = rec.count > 0 ? rec.count - 1 : 0;
+    for (uint32_t i = 0; i < rec.count; ++i) {
+        size_t common;
+        uint32_t len = record_next(trie, &rec, key_len, &common);
+        size += common + len;
     }
-    return data;
-}
-
-static int string_compare(const void *a, const void *b)
-{
-    const char *s1 = * (char * const *) a;
-    const char *s2 = * (char * const *) b;
-    return strcmp(s1, s2);
+    OutBuf out = { .buf = malloc(size + 1), .cap = size + 1, .used = 0 };
+    if (!out.buf) {
+        set_last_error(ERROR_NOMEM);
+        return NULL;
+    }
+    record_join(trie, current, &out, key, key_len);
+    out_finish(&out);
+    return out.buf;
 }
 
 /**
- * Find index of a string in the data section of the trie.
+ * Add the work of a finished lookup to the slot of the calling thread.
  */
-static DataId
-search_string(Trie *trie, char **strings, size_t len, const char *string)
+static void
+count_stats(Trie *trie, CounterSlot *slot, const WalkStats *stats,
+            size_t key_len)
 {
-    char **ptr = bsearch(&string, strings, len, sizeof *strings, string_compare);
-    assert(ptr);
-    return *ptr - trie->data;
+    TrieCounters *c = &slot->counts;
+    NodeId current = stats->node;
+    counter_add(&c->lookups, 1);
+    counter_add(&c->nodes, stats->nodes);
+    counter_add(&c->chunks, stats->chunks);
+
+    bool found = current > 0 && trie->nodes[current].data != 0;
+    counter_add(found ? &c->hits : &c->misses, 1);
+    if (found && trie->with_content) {
+        uint64_t decoded = 0;
+        Record rec;
+        record_open(trie, current, &rec);
+        for (uint32_t i = 0; i < rec.count; ++i) {
+            size_t common;
+            uint32_t len = record_next(trie, &rec, key_len, &common);
+            decoded += common + (trie->value_blocks ? len : 0);
+        }
+        counter_add(&c->decoded_bytes, decoded);
+    }
 }
 
 /**
- * Move all unique strings from the array to data section of a trie. This
- * function assumes the data section is already allocated and is big enough.
- * The array will be changed to only have a single copy of each string.
- * @return new length of the array
+ * Count a single lookup that started at time `start`.
  */
-static size_t
-strings_deduplicate(Trie *trie, char **arr, size_t len)
+static void
+count_lookup(Trie *trie, Counters *counters, const WalkStats *stats,
+             size_t key_len, uint64_t start, bool allocated)
 {
-    size_t read = 0;
-    size_t write = 0;
-    trie->data_idx = 1;
+    uint64_t elapsed = counters_now() - start;
+    CounterSlot *slot = counters_slot(counters);
+    if (!slot) {
+        return;
+    }
+    counters_add_latency(slot, elapsed, 1);
+    count_stats(trie, slot, stats, key_len);
+    counter_add(&slot->counts.allocations, allocated);
+}
 
-    while (read < len) {
-        while (read < len - 1 && strcmp(arr[read], arr[read+1]) == 0) {
-            ++read;
-        }
-        size_t string_length = strlen(arr[read]) + 1;
-        arr[write++] = memcpy(trie->data + trie->data_idx, arr[read++], string_length);
-        trie->data_idx += string_length;
+const char * trie_lookup(Trie *trie, const char *key)
+{
+    if (!trie->base_mem) {
+        return NULL;
     }
-    return write;
+    size_t key_len = strlen(key);
+    Counters *counters = counters_active(trie);
+    if (counters) {
+        WalkStats stats = { 0 };
+        uint64_t start = counters_now();
+        NodeId current = walk(trie, key, key_len, &stats);
+        const char *result = node_result(trie, current, key, key_len);
+        count_lookup(trie, counters, &stats, key_len, start, result != NULL);
+        return result;
+    }
+    return node_result(trie, walk(trie, key, key_len, NULL), key, key_len);
 }
 
-/**
- * Move all strings from data builders into the data section of the trie.
- * @param len   (out) length of returned array
- * @return      (transfer container) ordered array of strings
- */
-static char **
-create_strings(Trie *trie, size_t *len)
+static inline ssize_t
+lookup_into(Trie *trie, const char *key, size_t key_len, char *buf,
+            size_t buf_len, WalkStats *stats)
 {
-    char **strings = malloc(trie->data_idx * sizeof *strings);
-    trie->data_len = 1;
-    for (size_t idx = 1; idx < trie->data_idx; ++idx) {
-        strings[idx - 1] = trie->data_builder[idx]->data;
-        trie->data_len += strlen(strings[idx - 1]) + 1;
+    NodeId current = walk(trie, key, key_len, stats);
+    if (current == 0 || trie->nodes[current].data == 0) {
+        return -1;
     }
-    trie->data = calloc(1, trie->data_len);
 
-    qsort(strings, trie->data_idx - 1, sizeof *strings, string_compare);
-    *len = strings_deduplicate(trie, strings, trie->data_idx - 1);
-    return strings;
+    OutBuf out = { .buf = buf, .cap = buf_len, .used = 0 };
+    if (!trie->with_content) {
+        out_append(&out, "Found", 5);
+    } else {
+        record_join(trie, current, &out, key, key_len);
+    }
+    out_finish(&out);
+    return out.used;
 }
 
-static void squash_list(Trie *trie, ChunkId idx, ChunkId *pos)
+ssize_t trie_lookup_into(Trie *trie, const char *key, size_t key_len,
+                         char *buf, size_t buf_len)
 {
-    ChunkId start_pos = *pos;
-    while (idx > 0) {
-        trie->real_chunks[*pos].value = trie->chunks[idx].value;
-        trie->real_chunks[*pos].key = trie->chunks[idx].key;
-        ++(*pos);
-        idx = trie->chunks[idx].next;
+    if (!trie->base_mem) {
+        return -1;
     }
-
-    qsort(trie->real_chunks + start_pos, *pos - start_pos,
-            sizeof(*trie->real_chunks), chunk_compare);
+    Counters *counters = counters_active(trie);
+    if (counters) {
+        WalkStats stats = { 0 };
+        uint64_t start = counters_now();
+        ssize_t len = lookup_into(trie, key, key_len, buf, buf_len, &stats);
+        count_lookup(trie, counters, &stats, key_len, start, false);
+        return len;
+    }
+    return lookup_into(trie, key, key_len, buf, buf_len, NULL);
 }
 
-static void reorder_chunks(Trie *trie)
+static inline ssize_t
+lookup_values(Trie *trie, const char *key, size_t key_len,
+              TrieValue *values, size_t max_values, char *buf, size_t buf_len,
+              WalkStats *stats)
+{
+    NodeId current = walk(trie, key, key_len, stats);
+    if (current == 0 || trie->nodes[current].data == 0) {
+        return -1;
+    }
+    return node_values(trie, current, key, key_len, values, max_values,
+                       buf, buf_len);
+}
+
+ssize_t node_values(Trie *trie, NodeId current, const char *key, size_t key_len,
+                    TrieValue *values, size_t max_values,
+                    char *buf, size_t buf_len)
+{
+    if (!trie->with_content) {
+        if (max_values > 0) {
+            values[0].data = "Found";
+            values[0].len = 5;
+        }
+        return 1;
+    }
+
+    Record rec;
+    record_open(trie, current, &rec);
+    /* The buffer is never NUL terminated, so all of it can be used. */
+    OutBuf out = { .buf = buf, .cap = buf_len + 1, .used = 0 };
+    for (uint32_t i = 0; i < rec.count && i < max_values; ++i) {
+        size_t common;
+        uint32_t len = record_next(trie, &rec, key_len, &common);
+        values[i].len = common + len;
+        values[i].data = common == 0 ? reader_view(&rec.bytes, len) : NULL;
+        if (values[i].data) {
+            continue;
+        }
+        size_t start = out.used;
+        out_append(&out, key, common);
+        reader_read(&rec.bytes, len, &out);
+        values[i].data = out.used <= buf_len ? buf + start : NULL;
+    }
+    return rec.count;
+}
+
+ssize_t trie_lookup_values(Trie *trie, const char *key, size_t key_len,
+                           TrieValue *values, size_t max_values,
+                           char *buf, size_t buf_len)
+{
+    if (!trie->base_mem) {
+        return -1;
+    }
+    Counters *counters = counters_active(trie);
+    if (counters) {
+        WalkStats stats = { 0 };
+        uint64_t start = counters_now();
+        ssize_t count = lookup_values(trie, key, key_len, values, max_values,
+                                      buf, buf_len, &stats);
+        count_lookup(trie, counters, &stats, key_len, start, false);
+        return count;
+    }
+    return lookup_values(trie, key, key_len, values, max_values, buf, buf_len,
+                         NULL);
+}
+
+#ifdef __GNUC__
+# define prefetch(addr) __builtin_prefetch((addr), 0, 1)
+#else
+# define prefetch(addr) ((void) (addr))
+#endif
+
+/**
+ * How many keys are walked at the same time by `trie_lookup_batch()`. It
+ * should be big enough to hide the latency of a cache miss behind the work on
+ * the other keys.
+ */
+#define BATCH_WIDTH 16
+
+/**
+ * State of a single key in the interleaved lookup.
+ */
+typedef struct {
+    const char *pos;    /**< Next character of the key to be consumed. */
+    const char *end;    /**< End of the key. */
+    NodeId node;        /**< Node reached so far. */
+    bool chunks_ready;  /**< Whether chunks of the node were prefetched. */
+} BatchCursor;
+
+/**
+ * Look up at most `BATCH_WIDTH` keys in lock step. Each key alternates
+ * between two stages: first the node (and its label) is read and its chunk
+ * list is prefetched, then the chunk list is searched and the next node is
+ * prefetched.
+ * Other keys are processed while the memory is being loaded.
+ *
+ * @param nodes     (out) node of each key, 0 if the key is not in the trie
+ * @param stats     (out) work done for each key, or NULL
+ */
+static void
+lookup_group(Trie *trie, const char *const *keys, const size_t *key_lens,
+             size_t n, NodeId *nodes, WalkStats *stats)
+{
+    BatchCursor cursors[BATCH_WIDTH];
+    size_t active = n;
+
+    if (stats) {
+        memset(stats, 0, n * sizeof *stats);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        cursors[i].pos = keys[i];
+        cursors[i].end = keys[i] + key_lens[i];
+        cursors[i].node = 1;
+        cursors[i].chunks_ready = false;
+        if (trie->root_table && cursors[i].end - cursors[i].pos >= 2) {
+            cursors[i].node = trie->root_table[root_table_index(keys[i])];
+            cursors[i].pos += 2;
+            prefetch(trie->nodes + cursors[i].node);
+            if (stats) {
+                stats[i].nodes += cursors[i].node > 0;
+            }
+        }
+    }
+    prefetch(trie->nodes + 1);
+
+    while (active > 0) {
+        for (size_t i = 0; i < n; ++i) {
+            BatchCursor *c = cursors + i;
+            if (c->pos == NULL) {
+                continue;
+            }
+            if (c->chunks_ready) {
+                if (stats) {
+                    stats[i].chunks += compared_chunks(trie->nodes + c->node);
+                }
+                c->node = find_trie_node(trie, c->node, *c->pos++);
+                if (stats) {
+                    stats[i].nodes += c->node > 0;
+                }
+                prefetch(trie->nodes + c->node);
+                if (trie->label_blocks) {
+                    prefetch(trie->label_blocks + c->node / 64);
+                }
+                c->chunks_ready = false;
+                continue;
+            }
+            if (c->node && !match_label(trie, c->node, &c->pos, c->end)) {
+                c->node = 0;
+            }
+            if (c->node == 0 || c->pos == c->end) {
+                nodes[i] = c->node;
+                if (stats) {
+                    stats[i].node = c->node;
+                }
+                c->pos = NULL;
+                --active;
+            } else {
+                prefetch(trie->chunk_keys + trie->nodes[c->node].chunk);
+                prefetch(trie->chunk_values + trie->nodes[c->node].chunk);
+                c->chunks_ready = true;
+            }
+        }
+    }
+}
+
+void trie_lookup_batch(Trie *trie, const char **keys, size_t n,
+                       const char **results)
+{
+    if (!trie->base_mem) {
+        memset(results, 0, n * sizeof *results);
+        return;
+    }
+    Counters *counters = counters_active(trie);
+    CounterSlot *slot = counters ? counters_slot(counters) : NULL;
+    uint64_t elapsed = 0;
+    for (size_t start = 0; start < n; start += BATCH_WIDTH) {
+        size_t count = n - start < BATCH_WIDTH ? n - start : BATCH_WIDTH;
+        size_t key_lens[BATCH_WIDTH];
+        NodeId nodes[BATCH_WIDTH];
+        WalkStats stats[BATCH_WIDTH];
+        uint64_t begin = slot ? counters_now() : 0;
+        for (size_t i = 0; i < count; ++i) {
+            key_lens[i] = strlen(keys[start + i]);
+        }
+        lookup_group(trie, keys + start, key_lens, count, nodes,
+                     slot ? stats : NULL);
+        for (size_t i = 0; i < count; ++i) {
+            results[start + i] = node_result(trie, nodes[i], keys[start + i],
+                                             key_lens[i]);
+        }
+        if (!slot) {
+            continue;
+        }
+        elapsed += counters_now() - begin;
+        for (size_t i = 0; i < count; ++i) {
+            count_stats(trie, slot, stats + i, key_lens[i]);
+            counter_add(&slot->counts.allocations, results[start + i] != NULL);
+        }
+    }
+    if (slot && n > 0) {
+        counters_add_latency(slot, elapsed / n, n);
+    }
+}
+
+ssize_t trie_lookup_batch_into(Trie *trie, const char *const *keys,
+                               const size_t *key_lens, size_t n,
+                               char *buf, size_t buf_len, ssize_t *lens)
+{
+    if (!trie->base_mem) {
+        return -1;
+    }
+    Counters *counters = counters_active(trie);
+    CounterSlot *slot = counters ? counters_slot(counters) : NULL;
+    uint64_t elapsed = 0;
+    /* The buffer is never NUL terminated, so all of it can be used. */
+    OutBuf out = { .buf = buf, .cap = buf_len + 1, .used = 0 };
+    for (size_t start = 0; start < n; start += BATCH_WIDTH) {
+        size_t count = n - start < BATCH_WIDTH ? n - start : BATCH_WIDTH;
+        NodeId nodes[BATCH_WIDTH];
+        WalkStats stats[BATCH_WIDTH];
+        uint64_t begin = slot ? counters_now() : 0;
+        lookup_group(trie, keys + start, key_lens + start, count, nodes,
+                     slot ? stats : NULL);
+        for (size_t i = 0; i < count; ++i) {
+            if (nodes[i] == 0 || trie->nodes[nodes[i]].data == 0) {
+                lens[start + i] = -1;
+                continue;
+            }
+            size_t used = out.used;
+            if (!trie->with_content) {
+                out_append(&out, "Found", 5);
+            } else {
+                record_join(trie, nodes[i], &out, keys[start + i],
+                            key_lens[start + i]);
+            }
+            lens[start + i] = out.used - used;
+        }
+        if (!slot) {
+            continue;
+        }
+        elapsed += counters_now() - begin;
+        for (size_t i = 0; i < count; ++i) {
+            count_stats(trie, slot, stats + i, key_lens[start + i]);
+        }
+    }
+    if (slot && n > 0) {
+        counters_add_latency(slot, elapsed / n, n);
+    }
+    return out.used;
+}
+
+static int string_compare(const void *a, const void *b)
+{
+    const String *s1 = * (String * const *) a;
+    const String *s2 = * (String * const *) b;
+    int res = memcmp(s1->data, s2->data, s1->used < s2->used ? s1->used : s2->used);
+    if (res != 0) {
+        return res;
+    }
+    return s1->used < s2->used ? -1 : s1->used > s2->used;
+}
+
+/**
+ * Find where a record is stored in the data section of the trie. With value
+ * blocks, this is the index of the record plus one.
+ */
+static DataId
+search_string(Trie *trie, String **strings, const DataId *offsets, size_t len,
+              const String *string)
+{
+    String **ptr = bsearch(&string, strings, len, sizeof *strings, string_compare);
+    assert(ptr);
+    if (trie->flags & TRIE_BUILD_BLOCK_VALUES) {
+        return ptr - strings + 1;
+    }
+    return offsets[ptr - strings];
+}
+
+/**
+ * Move all unique records from the sorted array to data section of a trie.
+ * This function assumes the data section is already allocated and is big
+ * enough. The array will be changed to only have a single copy of each record.
+ * @param offsets   (out) where each unique record is stored
+ * @return new length of the array
+ */
+static size_t
+strings_deduplicate(Trie *trie, String **arr, DataId *offsets, size_t len)
+{
+    size_t read = 0;
+    size_t write = 0;
+    trie->data_idx = 1;
+
+    while (read < len) {
+        while (read < len - 1 && string_compare(arr + read, arr + read + 1) == 0) {
+            ++read;
+        }
+        memcpy(trie->data + trie->data_idx, arr[read]->data, arr[read]->used);
+        offsets[write] = trie->data_idx;
+        trie->data_idx += arr[read]->used;
+        arr[write++] = arr[read++];
+    }
+    return write;
+}
+
+/**
+ * Turn the values collected for each node into records and move them into
+ * the data section of the trie.
+ * @param offsets   (out) where each unique record is stored
+ * @param len       (out) length of returned array
+ * @return          (transfer container) ordered array of unique records
+ */
+static String **
+create_strings(Trie *trie, DataId **offsets, size_t *len)
+{
+    String **strings = malloc(trie->data_idx * sizeof *strings);
+    trie->data_len = 1;
+    for (size_t idx = 1; idx < trie->data_idx; ++idx) {
+        String *entries = trie->data_builder[idx];
+        String *record = arena_alloc(&trie->arena,
+                                     sizeof *record + entries->used + MAX_RECORD_OVERHEAD);
+        record->used = encode_record((unsigned char *) record->data,
+                                     (unsigned char *) entries->data,
+                                     entries->used, trie->use_compress);
+        record->len = record->used;
+        trie->data_builder[idx] = strings[idx - 1] = record;
+        trie->data_len += record->used;
+    }
+    trie->data = calloc(1, trie->data_len);
+
+    parallel_sort(strings, trie->data_idx - 1, sizeof *strings, string_compare,
+                  trie->threads);
+    *offsets = malloc(trie->data_idx * sizeof **offsets);
+    *len = strings_deduplicate(trie, strings, *offsets, trie->data_idx - 1);
+    return strings;
+}
+
+void encode_chunk_keys(const TrieNodeChunk *chunks, unsigned n, unsigned char *keys)
+{
+    if (n < BITMAP_THRESHOLD) {
+        for (unsigned i = 0; i < n; ++i) {
+            keys[i] = chunks[i].key;
+        }
+        return;
+    }
+    uint64_t bitmap[BITMAP_WORDS] = { 0 };
+    for (unsigned i = 0; i < n; ++i) {
+        unsigned char key = chunks[i].key;
+        bitmap[key / 64] |= UINT64_C(1) << (key % 64);
+    }
+    memcpy(keys, bitmap, sizeof bitmap);
+}
+
+/**
+ * Store the sorted chunks of a node into the chunk arrays.
+ */
+static void
+write_chunks(Trie *trie, const TrieNodeChunk *chunks, unsigned n, ChunkId pos)
+{
+    for (unsigned i = 0; i < n; ++i) {
+        trie->chunk_values[pos + i] = chunks[i].value;
+    }
+    encode_chunk_keys(chunks, n, trie->chunk_keys + pos);
+}
+
+static void squash_list(Trie *trie, ChunkId idx, ChunkId *pos)
+{
+    TrieNodeChunk chunks[UCHAR_MAX + 1];
+    unsigned n = 0;
+    while (idx > 0) {
+        chunks[n].value = trie->chunks[idx].value;
+        chunks[n].key = trie->chunks[idx].key;
+        ++n;
+        idx = trie->chunks[idx].next;
+    }
+
+    qsort(chunks, n, sizeof *chunks, chunk_compare);
+    write_chunks(trie, chunks, n, *pos);
+    *pos += n;
+}
+
+static void reorder_chunks(Trie *trie)
 {
     assert(trie->base_mem == NULL);
-    trie->real_chunks = calloc(2 * trie->chunks_idx * sizeof *trie->real_chunks, 1);
+    trie->chunk_values = calloc(trie->chunks_idx, sizeof *trie->chunk_values);
+    trie->chunk_keys = calloc(trie->chunks_idx + CHUNK_KEYS_PADDING, 1);
     ChunkId chunk_position = 1;
 
     for (NodeId idx = 1; idx < trie->idx; ++idx) {
@@ -457,22 +1260,547 @@ static void reorder_chunks(Trie *trie)
     trie->chunks_len = 0;
 }
 
+typedef struct {
+    Trie *trie;
+    String **strings;
+    DataId *offsets;
+    size_t s_len;
+} ConsolidateJob;
+
+/**
+ * Replace data indices of nodes in given range by offsets into data section.
+ */
+static void consolidate_nodes(size_t start, size_t end, void *arg)
+{
+    ConsolidateJob *job = arg;
+    Trie *trie = job->trie;
+    for (NodeId idx = start; idx < end; ++idx) {
+        if (trie->nodes[idx].data) {
+            String *s = trie->data_builder[trie->nodes[idx].data];
+            trie->nodes[idx].data = search_string(trie, job->strings, job->offsets,
+                                                  job->s_len, s);
+        }
+    }
+}
+
+/**
+ * Replace the data section by front coded blocks of the sorted unique records.
+ * Nodes refer to the records by their index plus one.
+ */
+static void encode_value_blocks(Trie *trie, String **strings, size_t len)
+{
+    size_t num_blocks = (len + VALUE_BLOCK_SIZE - 1) / VALUE_BLOCK_SIZE;
+    trie->value_blocks = malloc((num_blocks + 1) * sizeof *trie->value_blocks);
+    trie->value_count = len;
+
+    /* Each record needs at most two varints on top of its bytes. */
+    unsigned char *data = malloc(trie->data_idx + 2 * MAX_VARINT_LEN * len);
+    size_t pos = 0;
+    const String *prev = NULL;
+    for (size_t i = 0; i < len; ++i) {
+        const String *cur = strings[i];
+        size_t shared = 0;
+        if (i % VALUE_BLOCK_SIZE == 0) {
+            trie->value_blocks[i / VALUE_BLOCK_SIZE] = pos;
+        } else {
+            while (shared < prev->used && shared < cur->used
+                    && prev->data[shared] == cur->data[shared]) {
+                ++shared;
+            }
+        }
+        size_t rest = cur->used - shared;
+        pos += varint_encode(data + pos, shared);
+        pos += varint_encode(data + pos, rest);
+        memcpy(data + pos, cur->data + shared, rest);
+        pos += rest;
+        prev = cur;
+    }
+    trie->value_blocks[num_blocks] = pos;
+
+    free(trie->data);
+    trie->data = (char *) data;
+    trie->data_idx = pos;
+}
+
 static void trie_consolidate(Trie *trie)
 {
     assert(trie->base_mem == NULL);
 
-    size_t s_len;
-    char **strings = create_strings(trie, &s_len);
+    ConsolidateJob job = { .trie = trie };
+    job.strings = create_strings(trie, &job.offsets, &job.s_len);
+    parallel_for(1, trie->idx, trie->threads, consolidate_nodes, &job);
+    if (trie->flags & TRIE_BUILD_BLOCK_VALUES) {
+        encode_value_blocks(trie, job.strings, job.s_len);
+    }
+
+    free(job.strings);
+    free(job.offsets);
+    free(trie->data_builder);
+    trie->data_builder = NULL;
+    arena_free(&trie->arena);
+}
+
+/**
+ * Give new numbers to nodes while the chunks are still in linked lists. Nodes
+ * mapped to 0 are dropped.
+ *
+ * @param new_ids   new number for each node
+ * @param count     number of nodes after renumbering (including node 0)
+ */
+static void renumber_nodes(Trie *trie, const NodeId *new_ids, NodeId count)
+{
+    TrieNode *nodes = calloc(count, sizeof *nodes);
+    uint32_t *labels = trie->labels ? calloc(count, sizeof *labels) : NULL;
 
     for (NodeId idx = 1; idx < trie->idx; ++idx) {
-        if (trie->nodes[idx].data) {
-            String *s = trie->data_builder[trie->nodes[idx].data];
-            trie->nodes[idx].data = search_string(trie, strings, s_len, s->data);
-            free(s);
+        NodeId new_idx = new_ids[idx];
+        if (new_idx == 0) {
+            continue;
+        }
+        nodes[new_idx] = trie->nodes[idx];
+        if (labels) {
+            labels[new_idx] = trie->labels[idx];
+        }
+        for (ChunkId c = trie->nodes[idx].chunk; c > 0; c = trie->chunks[c].next) {
+            trie->chunks[c].value = new_ids[trie->chunks[c].value];
         }
     }
-    free(strings);
-    free(trie->data_builder);
+
+    free(trie->nodes);
+    free(trie->labels);
+    trie->nodes = nodes;
+    trie->labels = labels;
+    trie->idx = trie->len = count;
+}
+
+/**
+ * Check if a node can be skipped by putting its key into a label.
+ */
+static bool is_chain_node(Trie *trie, NodeId node)
+{
+    ChunkId chunk = trie->nodes[node].chunk;
+    return trie->nodes[node].data == 0 && chunk > 0 && trie->chunks[chunk].next == 0;
+}
+
+/**
+ * Replace every chain of nodes that have no data and a single child by the
+ * last node of the chain with a label. This must be run before the chunks are
+ * reordered.
+ */
+static void collapse_chains(Trie *trie)
+{
+    assert(trie->base_mem == NULL);
+    NodeId *new_ids = calloc(trie->idx, sizeof *new_ids);
+    trie->labels = calloc(trie->idx, sizeof *trie->labels);
+    size_t label_cap = INIT_SIZE;
+    trie->label_data = malloc(label_cap);
+    trie->label_data[0] = 0;
+    trie->label_data_len = 1;
+
+    for (NodeId idx = 1; idx < trie->idx; ++idx) {
+        new_ids[idx] = 1;
+    }
+
+    for (NodeId idx = 1; idx < trie->idx; ++idx) {
+        if (new_ids[idx] == 0) {
+            continue;
+        }
+        for (ChunkId c = trie->nodes[idx].chunk; c > 0; c = trie->chunks[c].next) {
+            NodeId target = trie->chunks[c].value;
+            unsigned char label[MAX_LABEL];
+            size_t len = 0;
+            while (len < MAX_LABEL && is_chain_node(trie, target)) {
+                ChunkId only = trie->nodes[target].chunk;
+                label[len++] = trie->chunks[only].key;
+                new_ids[target] = 0;
+                target = trie->chunks[only].value;
+            }
+            trie->chunks[c].value = target;
+            if (len == 0) {
+                continue;
+            }
+            while (trie->label_data_len + len + 1 > label_cap) {
+                label_cap *= 2;
+                trie->label_data = realloc(trie->label_data, label_cap);
+            }
+            trie->labels[target] = trie->label_data_len;
+            trie->label_data[trie->label_data_len] = len;
+            memcpy(trie->label_data + trie->label_data_len + 1, label, len);
+            trie->label_data_len += len + 1;
+        }
+    }
+
+    NodeId count = 1;
+    for (NodeId idx = 1; idx < trie->idx; ++idx) {
+        if (new_ids[idx]) {
+            new_ids[idx] = count++;
+        }
+    }
+    renumber_nodes(trie, new_ids, count);
+    free(new_ids);
+}
+
+/**
+ * Sort the linked list of chunks of a node by key.
+ */
+static void sort_chunk_list(Trie *trie, NodeId node)
+{
+    TrieNodeChunk chunks[UCHAR_MAX + 1];
+    ChunkId ids[UCHAR_MAX + 1];
+    unsigned n = 0;
+    for (ChunkId c = trie->nodes[node].chunk; c > 0; c = trie->chunks[c].next) {
+        chunks[n].key = trie->chunks[c].key;
+        chunks[n].value = trie->chunks[c].value;
+        ids[n++] = c;
+    }
+    qsort(chunks, n, sizeof *chunks, chunk_compare);
+    for (unsigned i = 0; i < n; ++i) {
+        trie->chunks[ids[i]].key = chunks[i].key;
+        trie->chunks[ids[i]].value = chunks[i].value;
+    }
+}
+
+static const unsigned char *
+builder_label(Trie *trie, NodeId node)
+{
+    if (!trie->labels || trie->labels[node] == 0) {
+        return NULL;
+    }
+    return trie->label_data + trie->labels[node];
+}
+
+static uint32_t node_hash(Trie *trie, NodeId node)
+{
+    uint32_t hash = 2166136261u;
+#define HASH_ADD(x) hash = (hash ^ (uint32_t) (x)) * 16777619u
+    HASH_ADD(trie->nodes[node].data);
+    const unsigned char *label = builder_label(trie, node);
+    if (label) {
+        for (unsigned i = 0; i <= label[0]; ++i) {
+            HASH_ADD(label[i]);
+        }
+    }
+    for (ChunkId c = trie->nodes[node].chunk; c > 0; c = trie->chunks[c].next) {
+        HASH_ADD((unsigned char) trie->chunks[c].key);
+        HASH_ADD(trie->chunks[c].value);
+    }
+#undef HASH_ADD
+    return hash;
+}
+
+/**
+ * Check if two nodes recognize the same set of suffixes with the same data.
+ * Children of both nodes must already be replaced by their representatives
+ * and the chunk lists must be sorted.
+ */
+static bool node_equal(Trie *trie, NodeId a, NodeId b)
+{
+    if (trie->nodes[a].data != trie->nodes[b].data) {
+        return false;
+    }
+    const unsigned char *la = builder_label(trie, a);
+    const unsigned char *lb = builder_label(trie, b);
+    if ((la == NULL) != (lb == NULL) || (la && memcmp(la, lb, la[0] + 1) != 0)) {
+        return false;
+    }
+    ChunkId ca = trie->nodes[a].chunk;
+    ChunkId cb = trie->nodes[b].chunk;
+    while (ca > 0 && cb > 0) {
+        if (trie->chunks[ca].key != trie->chunks[cb].key
+                || trie->chunks[ca].value != trie->chunks[cb].value) {
+            return false;
+        }
+        ca = trie->chunks[ca].next;
+        cb = trie->chunks[cb].next;
+    }
+    return ca == cb;
+}
+
+/**
+ * Merge all equivalent subtrees so that the trie becomes a minimal directed
+ * acyclic word graph. Nodes are processed from the leaves up (children always
+ * have a higher number than their parent), so when a node is visited, all its
+ * children are already replaced by representatives of their classes. This
+ * must be run before the chunks are reordered.
+ */
+static void minimize(Trie *trie)
+{
+    assert(trie->base_mem == NULL);
+    size_t table_len = 2;
+    while (table_len < 2 * (size_t) trie->idx) {
+        table_len *= 2;
+    }
+    NodeId *table = calloc(table_len, sizeof *table);
+    NodeId *new_ids = calloc(trie->idx, sizeof *new_ids);
+
+    for (NodeId idx = trie->idx - 1; idx > 0; --idx) {
+        sort_chunk_list(trie, idx);
+        for (ChunkId c = trie->nodes[idx].chunk; c > 0; c = trie->chunks[c].next) {
+            trie->chunks[c].value = new_ids[trie->chunks[c].value];
+        }
+
+        size_t slot = node_hash(trie, idx) & (table_len - 1);
+        while (table[slot] && !node_equal(trie, table[slot], idx)) {
+            slot = (slot + 1) & (table_len - 1);
+        }
+        if (table[slot] && idx != 1) {
+            new_ids[idx] = table[slot];
+        } else {
+            new_ids[idx] = idx;
+            if (!table[slot]) {
+                table[slot] = idx;
+            }
+        }
+    }
+    free(table);
+
+    /* Only representatives are still reachable, give them new numbers. */
+    NodeId count = 1;
+    for (NodeId idx = 1; idx < trie->idx; ++idx) {
+        new_ids[idx] = new_ids[idx] == idx ? count++ : 0;
+    }
+    renumber_nodes(trie, new_ids, count);
+    free(new_ids);
+}
+
+/**
+ * How many nodes at the top of the trie are stored in breadth first order.
+ * With 9 bytes per node, they fit into a few pages.
+ */
+#define LAYOUT_TOP_NODES 4096
+
+/**
+ * Push children of a node onto a stack or queue, in order of their keys.
+ */
+static void push_children(Trie *trie, NodeId node, NodeId **array,
+                          size_t *len, size_t *end)
+{
+    sort_chunk_list(trie, node);
+    unsigned n = 0;
+    for (ChunkId c = trie->nodes[node].chunk; c > 0; c = trie->chunks[c].next) {
+        ++n;
+    }
+    if (*end + n > *len) {
+        *len = 2 * (*end + n);
+        *array = realloc(*array, *len * sizeof **array);
+    }
+    for (ChunkId c = trie->nodes[node].chunk; c > 0; c = trie->chunks[c].next) {
+        (*array)[(*end)++] = trie->chunks[c].value;
+    }
+}
+
+/**
+ * Renumber the nodes so that lookups touch few pages of the file. The top of
+ * the trie is numbered in breadth first order, so that it is stored in a few
+ * contiguous pages. Each subtree below it is then numbered in depth first
+ * order, so that the rest of a path is close together as well. Children are
+ * always visited in order of their keys, which makes the serialized trie
+ * independent of the order in which the keys were inserted.
+ *
+ * The chunks are later stored in the order of their nodes, so they follow the
+ * same layout.
+ */
+static void layout_order(Trie *trie)
+{
+    NodeId *new_ids = calloc(trie->idx, sizeof *new_ids);
+    size_t queue_len = INIT_SIZE, head = 0, tail = 0;
+    NodeId *queue = malloc(queue_len * sizeof *queue);
+    size_t stack_len = INIT_SIZE, top = 0;
+    NodeId *stack = malloc(stack_len * sizeof *stack);
+    NodeId count = 1;
+
+    queue[tail++] = 1;
+    while (head < tail && count < LAYOUT_TOP_NODES) {
+        NodeId node = queue[head++];
+        if (new_ids[node]) {
+            continue;
+        }
+        new_ids[node] = count++;
+        push_children(trie, node, &queue, &queue_len, &tail);
+    }
+
+    /* Remaining nodes of the queue are roots of depth first subtrees. */
+    for (; head < tail; ++head) {
+        stack[top++] = queue[head];
+        while (top > 0) {
+            NodeId node = stack[--top];
+            if (new_ids[node]) {
+                continue;
+            }
+            new_ids[node] = count++;
+            size_t first = top;
+            push_children(trie, node, &stack, &stack_len, &top);
+            /* Reverse the children so that the smallest key is popped first. */
+            for (size_t i = first, j = top; i + 1 < j; ++i) {
+                NodeId tmp = stack[i];
+                stack[i] = stack[--j];
+                stack[j] = tmp;
+            }
+        }
+    }
+    free(stack);
+    free(queue);
+
+    renumber_nodes(trie, new_ids, count);
+    free(new_ids);
+}
+
+/**
+ * Build the table of nodes at depth two if it is worth it. It must be called
+ * on the final arrays of nodes, chunks and labels.
+ */
+static void build_root_table(Trie *trie)
+{
+    if (trie->nodes[1].num_chunks < ROOT_TABLE_MIN_FANOUT
+            || trie->idx < ROOT_TABLE_ENTRIES) {
+        return;
+    }
+    for (unsigned first = 0; first <= UCHAR_MAX; ++first) {
+        NodeId child = find_trie_node(trie, 1, first);
+        if (child && node_label(trie, child)) {
+            return;
+        }
+    }
+    trie->root_table = calloc(ROOT_TABLE_ENTRIES, sizeof *trie->root_table);
+    for (unsigned first = 0; first <= UCHAR_MAX; ++first) {
+        NodeId child = find_trie_node(trie, 1, first);
+        for (unsigned second = 0; child && second <= UCHAR_MAX; ++second) {
+            trie->root_table[first << 8 | second] =
+                find_trie_node(trie, child, second);
+        }
+    }
+    trie->flags |= TRIE_FLAG_ROOT_TABLE;
+}
+
+/**
+ * Count the keys below each chunk for `TRIE_BUILD_KEY_COUNTS`. It must be
+ * called on the final arrays of nodes and chunks. Nodes of a minimized trie
+ * are counted once and the count is reused by all their parents.
+ */
+static void build_key_counts(Trie *trie)
+{
+    typedef struct {
+        NodeId node;
+        unsigned next;  /**< Next chunk whose child must be counted. */
+    } Item;
+    uint32_t *keys = calloc(trie->idx, sizeof *keys);
+    bool *done = calloc(trie->idx, sizeof *done);
+    size_t len = INIT_SIZE, top = 0;
+    Item *stack = malloc(len * sizeof *stack);
+    trie->key_counts = calloc(trie->chunks_idx, sizeof *trie->key_counts);
+
+    stack[top++] = (Item) { 1, 0 };
+    while (top > 0) {
+        Item *item = stack + top - 1;
+        const TrieNode *node = trie->nodes + item->node;
+        if (item->next < node->num_chunks) {
+            NodeId child = trie->chunk_values[node->chunk + item->next++];
+            if (!done[child]) {
+                if (top == len) {
+                    len *= 2;
+                    stack = realloc(stack, len * sizeof *stack);
+                }
+                stack[top++] = (Item) { child, 0 };
+            }
+            continue;
+        }
+        uint32_t sum = 0;
+        for (unsigned c = 0; c < node->num_chunks; ++c) {
+            sum += keys[trie->chunk_values[node->chunk + c]];
+            trie->key_counts[node->chunk + c] = sum;
+        }
+        keys[item->node] = sum + (node->data != 0);
+        done[item->node] = true;
+        --top;
+    }
+    free(stack);
+    free(done);
+    free(keys);
+}
+
+/**
+ * Build the compact index of labels from offsets of labels of all nodes.
+ */
+static void index_labels(Trie *trie)
+{
+    size_t num_blocks = trie->idx / 64 + 1;
+    trie->label_blocks = calloc(num_blocks, sizeof *trie->label_blocks);
+    trie->label_offsets = malloc(trie->idx * sizeof *trie->label_offsets);
+    trie->label_count = 0;
+
+    /* Labels are also copied so that they are stored in order of nodes. */
+    unsigned char *label_data = malloc(trie->label_data_len);
+    label_data[0] = 0;
+    uint32_t label_data_len = 1;
+
+    for (NodeId idx = 0; idx < trie->idx; ++idx) {
+        LabelBlock *block = trie->label_blocks + idx / 64;
+        if (idx % 64 == 0) {
+            block->rank = trie->label_count;
+        }
+        if (trie->labels[idx]) {
+            const unsigned char *label = trie->label_data + trie->labels[idx];
+            block->bits |= UINT64_C(1) << (idx % 64);
+            trie->label_offsets[trie->label_count++] = label_data_len;
+            memcpy(label_data + label_data_len, label, label[0] + 1);
+            label_data_len += label[0] + 1;
+        }
+    }
+    free(trie->label_data);
+    trie->label_data = label_data;
+    trie->label_data_len = label_data_len;
+}
+
+static size_t value_block_count(const Trie *trie)
+{
+    return (trie->value_count + VALUE_BLOCK_SIZE - 1) / VALUE_BLOCK_SIZE;
+}
+
+size_t align_up(size_t size)
+{
+    return (size + SECTION_ALIGN - 1) / SECTION_ALIGN * SECTION_ALIGN;
+}
+
+void write_section(FILE *fh, size_t *pos, const void *data, size_t size)
+{
+    static const char zeros[SECTION_ALIGN];
+    fwrite(zeros, 1, align_up(*pos) - *pos, fh);
+    fwrite(data, 1, size, fh);
+    *pos = align_up(*pos) + size;
+}
+
+void write_header(FILE *fh, size_t *pos, const Trie *trie)
+{
+    Trie header;
+    memset(&header, 0, sizeof header);
+    header.version = trie->version;
+    header.with_content = trie->with_content;
+    header.use_compress = trie->use_compress;
+    header.flags = trie->flags;
+    header.idx = trie->idx;
+    header.chunks_idx = trie->chunks_idx;
+    header.label_count = trie->label_count;
+    header.label_data_len = trie->label_data_len;
+    header.data_idx = trie->data_idx;
+    header.value_count = trie->value_count;
+    write_section(fh, pos, &header, sizeof header);
+}
+
+/**
+ * Find where a section written by `write_section()` is in the mapped file.
+ *
+ * @param pos   (in/out) current position in the file
+ * @return      pointer to the section or NULL if the file is too short
+ */
+static void *
+map_section(Trie *trie, size_t *pos, size_t size)
+{
+    size_t start = align_up(*pos);
+    if (start + size > trie->file_len) {
+        return NULL;
+    }
+    *pos = start + size;
+    return (char *) trie->base_mem + start;
 }
 
 void trie_serialize(Trie *trie, const char *filename)
@@ -485,20 +1813,133 @@ void trie_serialize(Trie *trie, const char *filename)
         perror("Failed to open output file");
         return;
     }
-    reorder_chunks(trie);
+    if (trie->stream) {
+        stream_finish(trie, fh);
+        fclose(fh);
+        return;
+    }
     if (trie->with_content) {
         trie_consolidate(trie);
     }
-    fwrite(trie, sizeof *trie, 1, fh);
-    fwrite(trie->nodes, sizeof *trie->nodes, trie->idx, fh);
-    fwrite(trie->real_chunks, sizeof *trie->real_chunks, trie->chunks_idx, fh);
+    if (trie->flags & TRIE_BUILD_RADIX) {
+        collapse_chains(trie);
+    }
+    if (trie->flags & TRIE_BUILD_MINIMIZE) {
+        minimize(trie);
+    }
+    layout_order(trie);
+    reorder_chunks(trie);
+    if (trie->flags & TRIE_BUILD_RADIX) {
+        index_labels(trie);
+    }
+    build_root_table(trie);
+    if (trie->flags & TRIE_BUILD_KEY_COUNTS) {
+        build_key_counts(trie);
+    }
+
+    size_t pos = 0;
+    write_header(fh, &pos, trie);
+    write_section(fh, &pos, trie->nodes, sizeof *trie->nodes * trie->idx);
+    write_section(fh, &pos, trie->chunk_values,
+                  sizeof *trie->chunk_values * trie->chunks_idx);
+    write_section(fh, &pos, trie->chunk_keys, trie->chunks_idx + CHUNK_KEYS_PADDING);
+    if (trie->root_table) {
+        write_section(fh, &pos, trie->root_table,
+                      sizeof *trie->root_table * ROOT_TABLE_ENTRIES);
+    }
+    if (trie->flags & TRIE_BUILD_RADIX) {
+        write_section(fh, &pos, trie->label_blocks,
+                      sizeof *trie->label_blocks * (trie->idx / 64 + 1));
+        write_section(fh, &pos, trie->label_offsets,
+                      sizeof *trie->label_offsets * trie->label_count);
+        write_section(fh, &pos, trie->label_data, trie->label_data_len);
+    }
+    if (trie->key_counts) {
+        write_section(fh, &pos, trie->key_counts,
+                      sizeof *trie->key_counts * trie->chunks_idx);
+    }
+    if (trie->value_blocks) {
+        write_section(fh, &pos, trie->value_blocks,
+                      sizeof *trie->value_blocks * (value_block_count(trie) + 1));
+    }
     if (trie->with_content) {
-        fwrite(trie->data, 1, trie->data_idx, fh);
+        write_section(fh, &pos, trie->data, trie->data_idx);
     }
     fclose(fh);
 }
 
+/**
+ * Copy the file into anonymous memory backed by transparent huge pages.
+ *
+ * @return  the memory or MAP_FAILED
+ */
+static void * copy_to_hugepages(int fd, size_t len)
+{
+    void *mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return mem;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(mem, len, MADV_HUGEPAGE);
+#endif
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, (char *) mem + done, len - done, done);
+        if (n <= 0) {
+            munmap(mem, len);
+            return MAP_FAILED;
+        }
+        done += n;
+    }
+    mprotect(mem, len, PROT_READ);
+    return mem;
+}
+
+/**
+ * Map the file into memory as requested by `TRIE_LOAD_*` flags.
+ *
+ * @return  the memory or MAP_FAILED with error set
+ */
+static void * map_file(int fd, size_t len, unsigned flags)
+{
+    void *mem;
+    if (flags & TRIE_LOAD_HUGEPAGES) {
+        mem = copy_to_hugepages(fd, len);
+    } else {
+        int map_flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+        if (flags & TRIE_LOAD_POPULATE) {
+            map_flags |= MAP_POPULATE;
+        }
+#endif
+        mem = mmap(NULL, len, PROT_READ, map_flags, fd, 0);
+    }
+    if (mem == MAP_FAILED) {
+        last_error = ERROR_MMAP;
+        return mem;
+    }
+
+    if (flags & TRIE_LOAD_RANDOM) {
+        madvise(mem, len, MADV_RANDOM);
+    }
+    if (flags & TRIE_LOAD_WILLNEED) {
+        madvise(mem, len, MADV_WILLNEED);
+    }
+    if ((flags & TRIE_LOAD_LOCK) && mlock(mem, len) < 0) {
+        munmap(mem, len);
+        last_error = ERROR_LOCK;
+        return MAP_FAILED;
+    }
+    return mem;
+}
+
 Trie * trie_load(const char *filename)
+{
+    return trie_load_ex(filename, 0);
+}
+
+Trie * trie_load_ex(const char *filename, unsigned flags)
 {
     struct stat info;
     if (stat(filename, &info) < 0) {
@@ -512,31 +1953,87 @@ Trie * trie_load(const char *filename)
         return NULL;
     }
 
-    void *mem = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    void *mem = map_file(fd, info.st_size, flags);
     close(fd);
 
     if (mem == MAP_FAILED) {
-        last_error = ERROR_MMAP;
         return NULL;
     }
 
     Trie *trie = malloc(sizeof *trie);
 
+    if ((size_t) info.st_size < sizeof *trie) {
+        last_error = ERROR_VERSION;
+        goto err;
+    }
     memcpy(trie, mem, sizeof *trie);
     if (trie->version != VERSION) {
         last_error = ERROR_VERSION;
         goto err;
     }
-    trie->nodes = (TrieNode *) ((char *)mem + sizeof *trie);
-    trie->real_chunks = (TrieNodeChunk *) ((char *)trie->nodes +
-                                            sizeof *trie->nodes * trie->idx);
-    if (trie->with_content) {
-        trie->data = (char *)trie->real_chunks + sizeof *trie->real_chunks * trie->chunks_idx;
-    } else {
-        trie->data = NULL;
-    }
     trie->file_len = info.st_size;
     trie->base_mem = mem;
+    trie->counters = NULL;
+
+    size_t pos = sizeof *trie;
+    trie->nodes = map_section(trie, &pos, sizeof *trie->nodes * trie->idx);
+    trie->chunk_values = map_section(trie, &pos,
+                                     sizeof *trie->chunk_values * trie->chunks_idx);
+    trie->chunk_keys = map_section(trie, &pos, trie->chunks_idx + CHUNK_KEYS_PADDING);
+    if (!trie->nodes || !trie->chunk_values || !trie->chunk_keys) {
+        last_error = ERROR_TRUNCATED;
+        goto err;
+    }
+    trie->root_table = NULL;
+    if (trie->flags & TRIE_FLAG_ROOT_TABLE) {
+        trie->root_table = map_section(trie, &pos,
+                sizeof *trie->root_table * ROOT_TABLE_ENTRIES);
+        if (!trie->root_table) {
+            last_error = ERROR_TRUNCATED;
+            goto err;
+        }
+    }
+    trie->labels = NULL;
+    trie->label_blocks = NULL;
+    trie->label_offsets = NULL;
+    trie->label_data = NULL;
+    if (trie->flags & TRIE_BUILD_RADIX) {
+        trie->label_blocks = map_section(trie, &pos,
+                sizeof *trie->label_blocks * (trie->idx / 64 + 1));
+        trie->label_offsets = map_section(trie, &pos,
+                sizeof *trie->label_offsets * trie->label_count);
+        trie->label_data = map_section(trie, &pos, trie->label_data_len);
+        if (!trie->label_blocks || !trie->label_offsets || !trie->label_data) {
+            last_error = ERROR_TRUNCATED;
+            goto err;
+        }
+    }
+    trie->key_counts = NULL;
+    if (trie->flags & TRIE_BUILD_KEY_COUNTS) {
+        trie->key_counts = map_section(trie, &pos,
+                sizeof *trie->key_counts * trie->chunks_idx);
+        if (!trie->key_counts) {
+            last_error = ERROR_TRUNCATED;
+            goto err;
+        }
+    }
+    trie->value_blocks = NULL;
+    if (trie->with_content && (trie->flags & TRIE_BUILD_BLOCK_VALUES)) {
+        trie->value_blocks = map_section(trie, &pos,
+                sizeof *trie->value_blocks * (value_block_count(trie) + 1));
+        if (!trie->value_blocks) {
+            last_error = ERROR_TRUNCATED;
+            goto err;
+        }
+    }
+    trie->data = NULL;
+    if (trie->with_content) {
+        trie->data = map_section(trie, &pos, trie->data_idx);
+        if (!trie->data) {
+            last_error = ERROR_TRUNCATED;
+            goto err;
+        }
+    }
     return trie;
 
 err:
@@ -545,6 +2042,349 @@ err:
     return NULL;
 }
 
+size_t trie_prewarm(Trie *trie, unsigned levels)
+{
+    if (!trie->base_mem) {
+        return 0;
+    }
+    unsigned char *seen = calloc(trie->idx / 8 + 1, 1);
+    size_t len = INIT_SIZE, level_start = 0, level_end = 1, tail = 1;
+    NodeId *queue = malloc(len * sizeof *queue);
+    volatile unsigned char sink = 0;
+    if (!seen || !queue) {
+        free(seen);
+        free(queue);
+        return 0;
+    }
+
+    if (trie->root_table && levels > 0) {
+        for (size_t i = 0; i < ROOT_TABLE_ENTRIES; i += 64 / sizeof *trie->root_table) {
+            sink += trie->root_table[i];
+        }
+    }
+    queue[0] = 1;
+    for (unsigned level = 0; level <= levels && level_start < level_end; ++level) {
+        for (size_t i = level_start; i < level_end; ++i) {
+            const TrieNode *node = trie->nodes + queue[i];
+            const unsigned char *label = node_label(trie, queue[i]);
+            if (label) {
+                sink += label[0];
+            }
+            unsigned n = node->num_chunks;
+            unsigned keys = n >= BITMAP_THRESHOLD ? BITMAP_WORDS * 8 : n;
+            for (unsigned k = 0; k < keys; ++k) {
+                sink += trie->chunk_keys[node->chunk + k];
+            }
+            for (unsigned c = 0; c < n && level < levels; ++c) {
+                NodeId child = trie->chunk_values[node->chunk + c];
+                /* Nodes of a minimized trie can be reached more than once. */
+                if (seen[child / 8] & (1 << (child % 8))) {
+                    continue;
+                }
+                seen[child / 8] |= 1 << (child % 8);
+                if (tail == len) {
+                    NodeId *bigger = realloc(queue, 2 * len * sizeof *queue);
+                    if (!bigger) {
+                        /* The nodes read so far stay warm. */
+                        free(queue);
+                        free(seen);
+                        return tail;
+                    }
+                    queue = bigger;
+                    len *= 2;
+                }
+                queue[tail++] = child;
+            }
+        }
+        level_start = level_end;
+        level_end = tail;
+    }
+    free(queue);
+    free(seen);
+    return tail;
+}
+
+unsigned char chunk_key(Trie *trie, const TrieNode *node, unsigned index)
+{
+    const unsigned char *keys = trie->chunk_keys + node->chunk;
+    if (node->num_chunks < BITMAP_THRESHOLD) {
+        return keys[index];
+    }
+    uint64_t bitmap[BITMAP_WORDS];
+    memcpy(bitmap, keys, sizeof bitmap);
+    unsigned word = 0;
+    while (index >= (unsigned) __builtin_popcountll(bitmap[word])) {
+        index -= __builtin_popcountll(bitmap[word]);
+        ++word;
+    }
+    uint64_t bits = bitmap[word];
+    for (; index > 0; --index) {
+        bits &= bits - 1;
+    }
+    return word * 64 + __builtin_ctzll(bits);
+}
+
+/**
+ * A node on the path to the current key in `walk_keys()`.
+ */
+typedef struct {
+    NodeId node;
+    size_t key_len;     /**< Length of the key of the node. */
+    unsigned next;      /**< Next chunk of the node to visit. */
+} KeyFrame;
+
+int walk_keys(Trie *trie, KeyVisitor visit, void *arg)
+{
+    size_t key_cap = INIT_SIZE, frames_cap = 64, depth = 1;
+    char *key = malloc(key_cap);
+    KeyFrame *frames = malloc(frames_cap * sizeof *frames);
+    int ret = 0;
+
+    frames[0] = (KeyFrame) { 1, 0, 0 };
+    if (trie->nodes[1].data) {
+        key[0] = 0;
+        ret = visit(key, 0, 1, arg);
+    }
+    while (depth > 0 && ret == 0) {
+        KeyFrame *frame = frames + depth - 1;
+        const TrieNode *node = trie->nodes + frame->node;
+        if (frame->next == node->num_chunks) {
+            --depth;
+            continue;
+        }
+        unsigned c = frame->next++;
+        NodeId child = trie->chunk_values[node->chunk + c];
+        const unsigned char *label = node_label(trie, child);
+        size_t len = frame->key_len + 1 + (label ? label[0] : 0);
+        if (len + 1 > key_cap) {
+            key_cap = 2 * (len + 1);
+            key = realloc(key, key_cap);
+        }
+        key[frame->key_len] = chunk_key(trie, node, c);
+        if (label) {
+            memcpy(key + frame->key_len + 1, label + 1, label[0]);
+        }
+        key[len] = 0;
+
+        if (depth == frames_cap) {
+            frames_cap *= 2;
+            frames = realloc(frames, frames_cap * sizeof *frames);
+        }
+        frames[depth++] = (KeyFrame) { child, len, 0 };
+        if (trie->nodes[child].data) {
+            ret = visit(key, len, child, arg);
+        }
+    }
+    free(frames);
+    free(key);
+    return ret;
+}
+
+/**
+ * Account for a section placed like `map_section()` does.
+ */
+static void
+add_section(TrieStats *stats, size_t *pos, const char *name, size_t size)
+{
+    assert(stats->num_sections < TRIE_STATS_MAX_SECTIONS);
+    stats->padding_bytes += align_up(*pos) - *pos;
+    *pos = align_up(*pos) + size;
+    stats->sections[stats->num_sections].name = name;
+    stats->sections[stats->num_sections].bytes = size;
+    ++stats->num_sections;
+}
+
+static void stats_sections(Trie *trie, TrieStats *stats)
+{
+    size_t pos = 0;
+    add_section(stats, &pos, "header", sizeof *trie);
+    add_section(stats, &pos, "nodes", sizeof *trie->nodes * trie->idx);
+    add_section(stats, &pos, "chunk values",
+                sizeof *trie->chunk_values * trie->chunks_idx);
+    add_section(stats, &pos, "chunk keys", trie->chunks_idx + CHUNK_KEYS_PADDING);
+    if (trie->root_table) {
+        add_section(stats, &pos, "root table", trie_root_table_size(trie));
+    }
+    if (trie->label_blocks) {
+        add_section(stats, &pos, "label blocks",
+                    sizeof *trie->label_blocks * (trie->idx / 64 + 1));
+        add_section(stats, &pos, "label offsets",
+                    sizeof *trie->label_offsets * trie->label_count);
+        add_section(stats, &pos, "label data", trie->label_data_len);
+    }
+    if (trie->key_counts) {
+        add_section(stats, &pos, "key counts",
+                    sizeof *trie->key_counts * trie->chunks_idx);
+    }
+    if (trie->value_blocks) {
+        add_section(stats, &pos, "value blocks",
+                    sizeof *trie->value_blocks * (value_block_count(trie) + 1));
+    }
+    if (trie->with_content) {
+        add_section(stats, &pos, "data", trie->data_idx);
+    }
+    if (trie->file_len > pos) {
+        stats->padding_bytes += trie->file_len - pos;
+    }
+}
+
+/**
+ * Count the keys and values under every path from the root. Nodes of a
+ * minimized trie are visited once for each path leading to them, so that the
+ * numbers describe the keys and not the stored nodes.
+ */
+static void stats_keys(Trie *trie, TrieStats *stats)
+{
+    typedef struct {
+        NodeId node;
+        size_t depth;
+    } Item;
+    size_t len = INIT_SIZE, top = 0;
+    Item *stack = malloc(len * sizeof *stack);
+
+    stack[top++] = (Item) { 1, 0 };
+    while (top > 0) {
+        Item item = stack[--top];
+        const TrieNode *node = trie->nodes + item.node;
+
+        if (node->data) {
+            ++stats->keys;
+            ++stats->depth[item.depth < TRIE_STATS_MAX_DEPTH ? item.depth
+                                                             : TRIE_STATS_MAX_DEPTH];
+            if (item.depth > stats->max_depth) {
+                stats->max_depth = item.depth;
+            }
+            stats->key_bytes += item.depth;
+            if (trie->with_content) {
+                Record rec;
+                record_open(trie, item.node, &rec);
+                stats->values += rec.count;
+                for (uint32_t i = 0; i < rec.count; ++i) {
+                    size_t common;
+                    uint32_t rest = record_next(trie, &rec, item.depth, &common);
+                    stats->value_bytes += common + rest;
+                    /* The key, delimiter, value and newline. */
+                    stats->input_bytes += item.depth + common + rest + 2;
+                }
+            } else {
+                stats->input_bytes += item.depth + 1;
+            }
+        }
+
+        if (top + node->num_chunks > len) {
+            len = 2 * (top + node->num_chunks);
+            stack = realloc(stack, len * sizeof *stack);
+        }
+        for (unsigned c = node->num_chunks; c-- > 0; ) {
+            NodeId child = trie->chunk_values[node->chunk + c];
+            const unsigned char *label = node_label(trie, child);
+            stack[top++] = (Item) { child, item.depth + 1 + (label ? label[0] : 0) };
+        }
+    }
+    free(stack);
+}
+
+int trie_stats(Trie *trie, TrieStats *stats)
+{
+    memset(stats, 0, sizeof *stats);
+    if (!trie->base_mem) {
+        return -1;
+    }
+    stats->flags = trie->flags & ~TRIE_FLAG_ROOT_TABLE;
+    stats->with_content = trie->with_content;
+    stats->use_compress = trie->use_compress;
+    stats->nodes = trie->idx - 1;
+    stats->stored_value_bytes = trie->with_content ? trie->data_idx : 0;
+    stats->file_bytes = trie->file_len;
+
+    for (NodeId n = 1; n < trie->idx; ++n) {
+        const TrieNode *node = trie->nodes + n;
+        stats->chunks += node->num_chunks;
+        ++stats->fanout[node->num_chunks];
+        const unsigned char *label = node_label(trie, n);
+        if (label) {
+            ++stats->labels;
+            stats->label_bytes += label[0];
+        }
+        /* The root can not be part of a chain. */
+        if (n > 1 && node->num_chunks == 1 && node->data == 0) {
+            ++stats->chain_nodes;
+            NodeId child = trie->chunk_values[node->chunk];
+            if (trie->nodes[child].num_chunks != 1 || trie->nodes[child].data) {
+                ++stats->chains;
+            }
+        }
+    }
+
+    stats_sections(trie, stats);
+    stats_keys(trie, stats);
+    return 0;
+}
+
+static double ratio(size_t a, size_t b)
+{
+    return b ? (double) a / b : 0;
+}
+
+void trie_stats_print(const TrieStats *stats, FILE *fh)
+{
+    fprintf(fh, "Flags:%s%s%s%s%s%s%s\n",
+            stats->with_content ? "" : " no-content",
+            stats->use_compress ? " compress" : "",
+            stats->flags & TRIE_BUILD_RADIX ? " radix" : "",
+            stats->flags & TRIE_BUILD_MINIMIZE ? " minimize" : "",
+            stats->flags & TRIE_BUILD_SORTED ? " sorted" : "",
+            stats->flags & TRIE_BUILD_BLOCK_VALUES ? " block-values" : "",
+            stats->flags & TRIE_BUILD_KEY_COUNTS ? " key-counts" : "");
+    fprintf(fh, "Nodes: %zu\n", stats->nodes);
+    fprintf(fh, "Chunks: %zu\n", stats->chunks);
+    fprintf(fh, "Keys: %zu (%zu bytes)\n", stats->keys, stats->key_bytes);
+    fprintf(fh, "Values: %zu\n", stats->values);
+    fprintf(fh, "Single-child chains: %zu (%zu nodes)\n",
+            stats->chains, stats->chain_nodes);
+    fprintf(fh, "Labels: %zu (%zu bytes)\n", stats->labels, stats->label_bytes);
+    fprintf(fh, "Value bytes: %zu before deduplication, %zu stored (%.2fx)\n",
+            stats->value_bytes, stats->stored_value_bytes,
+            ratio(stats->value_bytes, stats->stored_value_bytes));
+    fprintf(fh, "File bytes: %zu for %zu bytes of input (compression ratio %.2f)\n",
+            stats->file_bytes, stats->input_bytes,
+            ratio(stats->input_bytes, stats->file_bytes));
+
+    fprintf(fh, "Sections:\n");
+    for (size_t i = 0; i < stats->num_sections; ++i) {
+        fprintf(fh, "  %-14s %12zu  %5.1f%%\n", stats->sections[i].name,
+                stats->sections[i].bytes,
+                100 * ratio(stats->sections[i].bytes, stats->file_bytes));
+    }
+    fprintf(fh, "  %-14s %12zu  %5.1f%%\n", "padding", stats->padding_bytes,
+            100 * ratio(stats->padding_bytes, stats->file_bytes));
+
+    fprintf(fh, "Fanout (children: nodes):\n");
+    for (size_t i = 0; i < sizeof stats->fanout / sizeof stats->fanout[0]; ++i) {
+        if (stats->fanout[i]) {
+            fprintf(fh, "  %3zu: %zu\n", i, stats->fanout[i]);
+        }
+    }
+    fprintf(fh, "Depth (key length: keys):\n");
+    for (size_t i = 0; i <= TRIE_STATS_MAX_DEPTH; ++i) {
+        if (stats->depth[i]) {
+            fprintf(fh, "  %s%2zu: %zu\n", i == TRIE_STATS_MAX_DEPTH ? ">=" : "  ",
+                    i, stats->depth[i]);
+        }
+    }
+    fprintf(fh, "Longest key: %zu\n", stats->max_depth);
+}
+
+size_t trie_root_table_size(Trie *trie)
+{
+    return trie->root_table ? ROOT_TABLE_ENTRIES * sizeof *trie->root_table : 0;
+}
+
+void set_last_error(int error)
+{
+    last_error = error;
+}
+
 const char * trie_get_last_error(void)
 {
     return errors[last_error];
@@ -552,7 +2392,6 @@ const char * trie_get_last_error(void)
 
 void trie_result_free(Trie *trie, const char *data)
 {
-    if (trie->use_compress) {
-        free((void *)data);
-    }
+    (void) trie;
+    free((void *)data);
 }
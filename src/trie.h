@@ -1,7 +1,9 @@
 #ifndef TRIE_H
 #define TRIE_H
 
+#include <stdint.h>
 #include <stdio.h>
+#include <sys/types.h>
 
 /**
  * Opaque type for the trie. Do not access any members directly.
@@ -16,6 +18,14 @@
  */
 typedef struct trie Trie;
 
+/**
+ * One of the values stored under a key. The data is not NUL terminated.
+ */
+typedef struct {
+    const char *data;   /**< Bytes of the value. */
+    size_t len;         /**< Length of the value. */
+} TrieValue;
+
 /**
  * Create new empty write-only trie. Free with `trie_free()` when no longer
  * needed.
@@ -26,6 +36,84 @@ typedef struct trie Trie;
  */
 Trie * trie_new(int with_content, int use_compress);
 
+/**
+ * Flags modifying how the trie is built and stored. They can be combined with
+ * bitwise or and passed to `trie_new_ex()`.
+ */
+enum {
+    /**
+     * Collapse chains of nodes with a single child into one node with a
+     * label. This makes the file smaller and lookups faster when the keys
+     * have long unique suffixes.
+     */
+    TRIE_BUILD_RADIX = 1 << 0,
+    /**
+     * Merge identical subtrees, turning the trie into a minimal directed
+     * acyclic word graph. Two subtrees are identical when they contain the
+     * same suffixes with the same stored data, so this works best for tries
+     * without data (or with data that does not depend on the key).
+     */
+    TRIE_BUILD_MINIMIZE = 1 << 1,
+    /**
+     * The keys will be inserted in sorted order (as compared by `strcmp()`).
+     * Each subtree is written to disk as soon as no more keys can be inserted
+     * into it, so the memory used does not depend on the number of keys.
+     * Values are not deduplicated in this mode. This can not be combined with
+     * `TRIE_BUILD_MINIMIZE`.
+     */
+    TRIE_BUILD_SORTED = 1 << 2,
+    /**
+     * Sort the unique values and store them in small blocks where each value
+     * only keeps the part that differs from the previous one. A lookup only
+     * decodes the block of its value. This makes the data much smaller when
+     * the values are similar to each other. This can not be combined with
+     * `TRIE_BUILD_SORTED`.
+     */
+    TRIE_BUILD_BLOCK_VALUES = 1 << 3,
+    /**
+     * Store the number of keys below each chunk, which numbers the keys by
+     * their sorted order. This enables `trie_lookup_id()`, `trie_key_by_id()`
+     * and `trie_count_prefix()` and takes four bytes per chunk.
+     */
+    TRIE_BUILD_KEY_COUNTS = 1 << 4,
+};
+
+/**
+ * Create new empty write-only trie with non-default options. The `flags`
+ * argument is a combination of `TRIE_BUILD_*` flags. Free with `trie_free()`
+ * when no longer needed.
+ *
+ * @param with_content  whether there will be data associated with nodes
+ * @param use_compress  whether to use the prefix compression for data
+ * @param flags         how to build the trie
+ * @return              new empty trie or NULL on failure
+ */
+Trie * trie_new_ex(int with_content, int use_compress, unsigned flags);
+
+/**
+ * Set how many threads may be used when the trie is serialized. The default
+ * is to use a single thread. The resulting file does not depend on this
+ * setting.
+ *
+ * @param trie      trie being built
+ * @param threads   maximum number of threads to use
+ */
+void trie_set_threads(Trie *trie, unsigned threads);
+
+/**
+ * Combine multiple write-only tries into one. Each key must start with a byte
+ * that only occurs as the first byte of keys in a single part, so that the
+ * parts only share the root node. This allows building the parts in separate
+ * threads. None of the parts can be built with `TRIE_BUILD_SORTED`.
+ *
+ * The parts are consumed: the first one is returned and all others are freed.
+ *
+ * @param parts     array of tries created by `trie_new_ex()`
+ * @param count     number of tries in the array
+ * @return          combined trie
+ */
+Trie * trie_join(Trie **parts, size_t count);
+
 /**
  * Free all memory held by the trie.
  *
@@ -38,23 +126,313 @@ void trie_free(Trie *trie);
  * If the keys is already present in the trie, the data will be appended to the
  * current data (delimited by a new line.
  *
+ * If the trie was created with `TRIE_BUILD_SORTED`, the key must not be
+ * smaller than the previously inserted one.
+ *
  * @param trie  trie to insert into
  * @param key   under which key to insert the data
  * @param value data to be inserted
+ * @return      0 on success, -1 on failure
  */
-void trie_insert(Trie *trie, const char *key, const char *value);
+int trie_insert(Trie *trie, const char *key, const char *value);
 
 /**
  * Look up a value under given key. The trie must have been loaded from a file.
  * The result is dynamically allocated and it is the caller's responsibility to
  * free it using the `trie_result_free()`.
  *
+ * Values are stored without a terminating NUL, so every found key costs one
+ * allocation and a copy of its values, even for an uncompressed trie. The size
+ * is taken from the table of value lengths stored with the node. Use
+ * `trie_lookup_into()` to avoid the allocation.
+ *
  * @param trie  trie to search
  * @param key   what key is wanted
  * @return      associated value or NULL
  */
 const char * trie_lookup(Trie *trie, const char *key);
 
+/**
+ * Look up a value under given key and write it into a caller provided buffer.
+ * No memory is allocated and there is nothing to be freed afterwards. The key
+ * is given with explicit length and may contain NUL bytes.
+ *
+ * Like with `snprintf()`, the return value is the full length of the value. If
+ * it is not smaller than `buf_len`, the output was truncated and the lookup
+ * should be repeated with a bigger buffer. Unless `buf_len` is zero, the
+ * buffer is always NUL terminated.
+ *
+ * @param trie      trie to search
+ * @param key       what key is wanted
+ * @param key_len   length of the key in bytes
+ * @param buf       where to store the value
+ * @param buf_len   size of the buffer
+ * @return          length of the value or -1 if the key is not present
+ */
+ssize_t trie_lookup_into(Trie *trie, const char *key, size_t key_len,
+                         char *buf, size_t buf_len);
+
+/**
+ * Look up all values stored under a key without joining them. Values can
+ * contain any bytes including newlines and NUL.
+ *
+ * When a value is stored in the file as it is, `data` points directly into
+ * the mapped file and nothing is copied. Values that have to be decoded
+ * (because they share a prefix with the key or are stored in blocks) are
+ * copied into `buf`. If a value does not fit into the buffer, its `data` is
+ * NULL, but `len` is still set. The views are valid until the trie is freed
+ * or the buffer reused.
+ *
+ * At most `max_values` values are filled in, but the return value is always
+ * the total number of values. A trie without content has a single value
+ * `Found`.
+ *
+ * @param trie          trie to search
+ * @param key           what key is wanted
+ * @param key_len       length of the key in bytes
+ * @param values        (out) array for the values
+ * @param max_values    length of the array
+ * @param buf           storage for decoded values
+ * @param buf_len       size of the buffer
+ * @return              number of values or -1 if the key is not present
+ */
+ssize_t trie_lookup_values(Trie *trie, const char *key, size_t key_len,
+                           TrieValue *values, size_t max_values,
+                           char *buf, size_t buf_len);
+
+/**
+ * Look up multiple keys at once. This is equivalent to calling `trie_lookup()`
+ * on each key, but the keys are walked through the trie in an interleaved
+ * fashion so that waiting for memory of one key overlaps with work on the
+ * others. Each non-NULL result must be freed with `trie_result_free()`.
+ *
+ * @param trie      trie to search
+ * @param keys      array of `n` keys to be looked up
+ * @param n         number of keys
+ * @param results   (out) array of `n` results, NULL for missing keys
+ */
+void trie_lookup_batch(Trie *trie, const char **keys, size_t n,
+                       const char **results);
+
+/**
+ * Look up multiple keys at once with the interleaved walk of
+ * `trie_lookup_batch()`, but write the values into a caller provided buffer
+ * like `trie_lookup_into()`. The keys are given with explicit lengths. The
+ * values of all found keys are stored one after another without any
+ * separator or NUL terminator.
+ *
+ * The return value is the total length of the values. If it is bigger than
+ * `buf_len`, the output was truncated and the lookup should be repeated with
+ * a bigger buffer.
+ *
+ * @param trie      trie to search
+ * @param keys      array of `n` keys to be looked up
+ * @param key_lens  length of each key in bytes
+ * @param n         number of keys
+ * @param buf       where to store the values
+ * @param buf_len   size of the buffer
+ * @param lens      (out) length of the value of each key, -1 for missing keys
+ * @return          total length of the values or -1 on error
+ */
+ssize_t trie_lookup_batch_into(Trie *trie, const char *const *keys,
+                               const size_t *key_lens, size_t n,
+                               char *buf, size_t buf_len, ssize_t *lens);
+
+/**
+ * Function called by `trie_fuzzy_search()` for every key close enough to the
+ * searched one. The key is NUL terminated. The values are as returned by
+ * `trie_lookup_values()`, but all of them are filled in. The key and values
+ * are only valid during the call. A non-zero return value stops the search.
+ */
+typedef int (*TrieFuzzyCallback)(const char *key, size_t key_len,
+                                 unsigned edits, const TrieValue *values,
+                                 size_t num_values, void *arg);
+
+/**
+ * Find all keys that differ from `key` by at most `max_edits` inserted,
+ * deleted or replaced bytes (Levenshtein distance). The trie is walked once,
+ * computing one row of the distance table for each byte of the path, and a
+ * subtree is skipped as soon as every entry of its row exceeds `max_edits`.
+ * Keys are reported in sorted order.
+ *
+ * @param trie      loaded trie
+ * @param key       what key is wanted
+ * @param key_len   length of the key in bytes
+ * @param max_edits largest distance of reported keys
+ * @param callback  function called for each found key
+ * @param arg       passed to the callback
+ * @return          number of reported keys, -1 if the trie is not loaded
+ *                  from a file or memory ran out
+ */
+ssize_t trie_fuzzy_search(Trie *trie, const char *key, size_t key_len,
+                          unsigned max_edits, TrieFuzzyCallback callback,
+                          void *arg);
+
+/**
+ * Iterator over the keys with a given prefix.
+ */
+typedef struct trie_iter TrieIter;
+
+/**
+ * Start iterating over all keys that begin with `prefix`, in sorted order.
+ * The trie is walked depth first as `trie_iter_next()` is called, and the
+ * buffers of the iterator are reused for all keys.
+ *
+ * To continue an iteration later, for example with the next page of
+ * completions, pass the last returned key as `after`. Only keys that sort
+ * after it are returned then. The key works as a continuation token even if
+ * the trie has been reloaded in the meantime.
+ *
+ * @param trie          loaded trie
+ * @param prefix        common prefix of returned keys
+ * @param prefix_len    length of the prefix in bytes
+ * @param after         key to continue after or NULL to start at the first
+ * @param after_len     length of `after` in bytes
+ * @return              the iterator, NULL if the trie is not loaded from a
+ *                      file or memory ran out
+ */
+TrieIter *
+trie_iter_prefix(Trie *trie, const char *prefix, size_t prefix_len,
+                 const char *after, size_t after_len);
+
+/**
+ * Start a new iteration with an existing iterator, as if it was created by
+ * `trie_iter_prefix()` with the same arguments. No memory is allocated unless
+ * the prefix is longer than any key seen by the iterator so far.
+ *
+ * @return  0 on success, -1 if memory ran out
+ */
+int trie_iter_restart(TrieIter *iter, const char *prefix, size_t prefix_len,
+                      const char *after, size_t after_len);
+
+/**
+ * Get the next key of an iteration. The key is NUL terminated. The values
+ * are as returned by `trie_lookup_values()`, but all of them are filled in.
+ * Both are valid until the iterator is used again. To stop after a number of
+ * keys, just stop calling this function.
+ *
+ * @param iter          the iterator
+ * @param key           (out) the key
+ * @param key_len       (out) length of the key
+ * @param values        (out) values of the key, may be NULL if they are not
+ *                      needed, which is faster
+ * @param num_values    (out) number of values
+ * @return              1 if a key was found, 0 at the end and -1 if memory
+ *                      ran out
+ */
+int trie_iter_next(TrieIter *iter, const char **key, size_t *key_len,
+                   const TrieValue **values, size_t *num_values);
+
+/**
+ * Free an iterator. It must be freed before its trie.
+ */
+void trie_iter_free(TrieIter *iter);
+
+/**
+ * Function called for keys found in a longer input by
+ * `trie_common_prefix_search()` and `trie_segment()`. The key is the part of
+ * the input of `len` bytes at `offset`. The values are as returned by
+ * `trie_lookup_values()`, but all of them are filled in, and they are only
+ * valid during the call. `num_values` is -1 for parts of the input that are
+ * not keys. A non-zero return value stops the search.
+ */
+typedef int (*TrieMatchCallback)(size_t offset, size_t len,
+                                 const TrieValue *values, ssize_t num_values,
+                                 void *arg);
+
+/**
+ * Find all keys that are prefixes of `key`, including the key itself. The key
+ * is walked from the root once and every node with data on the way is
+ * reported, shortest first. The offset passed to the callback is always 0.
+ *
+ * @param trie      loaded trie
+ * @param key       input to search
+ * @param key_len   length of the input in bytes
+ * @param callback  function called for each found key
+ * @param arg       passed to the callback
+ * @return          number of reported keys, -1 if the trie is not loaded
+ *                  from a file or memory ran out
+ */
+ssize_t trie_common_prefix_search(Trie *trie, const char *key, size_t key_len,
+                                  TrieMatchCallback callback, void *arg);
+
+/**
+ * Find the longest key that is a prefix of `key` and get its values like
+ * `trie_lookup_values()` does.
+ *
+ * @param trie          loaded trie
+ * @param key           input to search
+ * @param key_len       length of the input in bytes
+ * @param prefix_len    (out) length of the found key
+ * @param values        (out) array for the values
+ * @param max_values    length of the array
+ * @param buf           storage for decoded values
+ * @param buf_len       size of the buffer
+ * @return              number of values or -1 if no key is a prefix
+ */
+ssize_t trie_longest_prefix(Trie *trie, const char *key, size_t key_len,
+                            size_t *prefix_len, TrieValue *values,
+                            size_t max_values, char *buf, size_t buf_len);
+
+/**
+ * Split a text into keys, always taking the longest key that starts at the
+ * current position (greedy longest match). Bytes where no key starts are
+ * collected until the next key and reported with `num_values` -1. All parts
+ * are reported in order and together they cover the whole text.
+ *
+ * @param trie      loaded trie
+ * @param text      input to split
+ * @param text_len  length of the input in bytes
+ * @param callback  function called for each part
+ * @param arg       passed to the callback
+ * @return          number of reported parts, -1 if the trie is not loaded
+ *                  from a file or memory ran out
+ */
+ssize_t trie_segment(Trie *trie, const char *text, size_t text_len,
+                     TrieMatchCallback callback, void *arg);
+
+/**
+ * Get the number of a key: how many keys of the trie sort before it. The keys
+ * are thus numbered from 0 without gaps and the number can index arrays kept
+ * next to the trie. It takes one step per byte of the key, using the counts
+ * stored with `TRIE_BUILD_KEY_COUNTS`.
+ *
+ * @param trie      loaded trie built with `TRIE_BUILD_KEY_COUNTS`
+ * @param key       what key is wanted
+ * @param key_len   length of the key in bytes
+ * @return          number of the key or -1 if the key is not present or the
+ *                  trie has no key counts
+ */
+ssize_t trie_lookup_id(Trie *trie, const char *key, size_t key_len);
+
+/**
+ * Get the key with a number returned by `trie_lookup_id()`. Like with
+ * `trie_lookup_into()`, the return value is the full length of the key, and
+ * if it is not smaller than `buf_len`, the key was truncated. Unless
+ * `buf_len` is zero, the buffer is always NUL terminated.
+ *
+ * @param trie      loaded trie built with `TRIE_BUILD_KEY_COUNTS`
+ * @param id        number of the key
+ * @param buf       where to store the key
+ * @param buf_len   size of the buffer
+ * @return          length of the key or -1 if the number is not smaller than
+ *                  the number of keys or the trie has no key counts
+ */
+ssize_t trie_key_by_id(Trie *trie, size_t id, char *buf, size_t buf_len);
+
+/**
+ * Count the keys starting with a prefix in one step per byte of the prefix.
+ * The keys have consecutive numbers, so together with `trie_lookup_id()` of
+ * the first of them (see `trie_iter_prefix()`) this gives their range. The
+ * empty prefix counts all keys.
+ *
+ * @param trie          loaded trie built with `TRIE_BUILD_KEY_COUNTS`
+ * @param prefix        common prefix of counted keys
+ * @param prefix_len    length of the prefix in bytes
+ * @return              number of keys or -1 if the trie has no key counts
+ */
+ssize_t trie_count_prefix(Trie *trie, const char *prefix, size_t prefix_len);
+
 /**
  * Free looked up data.
  *
@@ -72,6 +450,17 @@ void trie_result_free(Trie *trie, const char *data);
  */
 void trie_serialize(Trie *trie, const char *filename);
 
+/**
+ * Get the size of the table for the first two bytes of keys. The table is
+ * only stored when the root has many children, so that the two top levels of
+ * the trie can be skipped. Call this on a loaded trie or after
+ * `trie_serialize()`.
+ *
+ * @param trie  trie to inspect
+ * @return      size of the table in bytes, 0 if the trie does not have it
+ */
+size_t trie_root_table_size(Trie *trie);
+
 /**
  * Load the trie from given file. The file must have been created by calling
  * to `trie_serialize()`. Free the result with `trie_free()` when no longer
@@ -82,6 +471,334 @@ void trie_serialize(Trie *trie, const char *filename);
  */
 Trie * trie_load(const char *filename);
 
+/**
+ * Flags controlling how the file is brought into memory by `trie_load_ex()`.
+ * They trade longer start up for fewer page faults during lookups.
+ */
+enum {
+    /** Read the whole file into memory while mapping it. */
+    TRIE_LOAD_POPULATE = 1 << 0,
+    /** Lock the file in memory so that it is never paged out. */
+    TRIE_LOAD_LOCK = 1 << 1,
+    /** Tell the kernel not to read ahead when a page is faulted in. */
+    TRIE_LOAD_RANDOM = 1 << 2,
+    /** Start reading the whole file in the background. */
+    TRIE_LOAD_WILLNEED = 1 << 3,
+    /**
+     * Copy the file into anonymous memory backed by transparent huge pages
+     * instead of mapping it. This uses fewer TLB entries, but the memory is
+     * not shared with other processes using the same file.
+     */
+    TRIE_LOAD_HUGEPAGES = 1 << 4,
+};
+
+/**
+ * Load the trie from given file like `trie_load()`, with control over how the
+ * file is brought into memory. The `flags` argument is a combination of
+ * `TRIE_LOAD_*` flags.
+ *
+ * @param filename  file to be loaded
+ * @param flags     how to load the file
+ * @return          loaded trie or NULL
+ */
+Trie * trie_load_ex(const char *filename, unsigned flags);
+
+/**
+ * Bring the top `levels` levels of a loaded trie into memory by reading them.
+ * Lookups of the most common prefixes then do not cause page faults, while
+ * the rest of the file is only read when needed.
+ *
+ * @param trie      loaded trie
+ * @param levels    how many levels below the root to read
+ * @return          number of nodes that were read, 0 if the trie was not
+ *                  loaded from a file
+ */
+size_t trie_prewarm(Trie *trie, unsigned levels);
+
+/**
+ * Opaque type for a loaded trie that can be replaced by a new version of the
+ * file while other threads look up keys in it. Readers get the current trie
+ * with `trie_handle_acquire()` and give it back with `trie_handle_release()`.
+ * Neither takes a lock, so lookups are as fast as with a plain trie.
+ */
+typedef struct trie_handle TrieHandle;
+
+/**
+ * Load a trie into a new handle. The `flags` and `prewarm` levels are used
+ * for this file and all files loaded by `trie_handle_reload()`, see
+ * `trie_load_ex()` and `trie_prewarm()`. Close with `trie_handle_close()`.
+ *
+ * @param filename  file to be loaded
+ * @param flags     how to load the file
+ * @param prewarm   how many levels to read before the trie is used
+ * @return          new handle or NULL
+ */
+TrieHandle * trie_handle_open(const char *filename, unsigned flags,
+                              unsigned prewarm);
+
+/**
+ * Get the current trie of the handle for lookups. The trie stays valid until
+ * the calling thread calls `trie_handle_release()`, even if it is replaced by
+ * a reload in the meantime. Calls can be nested, inner calls return the same
+ * trie as the outermost one.
+ *
+ * @param handle    handle to read
+ * @return          the trie, NULL if out of memory
+ */
+Trie * trie_handle_acquire(TrieHandle *handle);
+
+/**
+ * Stop using the trie returned by `trie_handle_acquire()`. Values found in
+ * the trie must not be used afterwards.
+ *
+ * @param handle    handle the trie was acquired from
+ */
+void trie_handle_release(TrieHandle *handle);
+
+/**
+ * Load a file and replace the trie of the handle with it. The file is loaded
+ * and prewarmed in the calling thread while readers keep using the old trie.
+ * New readers then get the new trie and the old one is freed as soon as all
+ * threads that acquired it released it. Reloads wait for each other. If
+ * counting is enabled for the old trie, it is enabled for the new one.
+ *
+ * The calling thread must not hold the trie of the handle, or it would wait
+ * for itself.
+ *
+ * @param handle    handle to reload
+ * @param filename  file to load, NULL to load the last file again
+ * @return          0 on success, -1 if the file could not be loaded, in
+ *                  which case the old trie is kept
+ */
+int trie_handle_reload(TrieHandle *handle, const char *filename);
+
+/**
+ * Free the handle and its trie. No thread may be using the trie.
+ *
+ * @param handle    handle to be closed
+ */
+void trie_handle_close(TrieHandle *handle);
+
+/**
+ * Opaque type for changes layered over a loaded trie. Keys can be inserted
+ * and removed without rebuilding the file, and lookups see both the file and
+ * the changes. `trie_merge()` writes them into a new file.
+ */
+typedef struct trie_delta TrieDelta;
+
+/**
+ * Create an empty delta over a loaded trie. The trie must not be freed
+ * before the delta. Free with `trie_delta_free()`.
+ *
+ * @param base  loaded trie
+ * @return      new delta or NULL on failure
+ */
+TrieDelta * trie_delta_new(Trie *base);
+
+/**
+ * Free the delta and all changes in it.
+ *
+ * @param delta delta to be freed
+ */
+void trie_delta_free(TrieDelta *delta);
+
+/**
+ * Add a value to a key. Like with `trie_insert()`, the values of a key
+ * accumulate: the value is added after the values already in the base trie
+ * and in the delta. For a trie without content, `value` is ignored.
+ *
+ * @param delta delta to insert into
+ * @param key   under which key to insert the data
+ * @param value data to be inserted
+ * @return      0 on success, -1 on failure
+ */
+int trie_delta_insert(TrieDelta *delta, const char *key, const char *value);
+
+/**
+ * Remove a key with all its values, both from the base trie and from
+ * previous insertions into the delta. Values inserted later are kept, so a
+ * key can be replaced by removing and inserting it.
+ *
+ * @param delta delta to remove from
+ * @param key   which key to remove
+ * @return      0 on success, -1 on failure
+ */
+int trie_delta_remove(TrieDelta *delta, const char *key);
+
+/**
+ * Look up all values of a key in the base trie with the changes of the delta
+ * applied. The arguments and result are the same as with
+ * `trie_lookup_values()`. Values inserted into the delta are never copied.
+ *
+ * @param delta         delta to search
+ * @param key           what key is wanted
+ * @param key_len       length of the key in bytes
+ * @param values        (out) array for the values
+ * @param max_values    length of the array
+ * @param buf           storage for decoded values
+ * @param buf_len       size of the buffer
+ * @return              number of values or -1 if the key is not present
+ */
+ssize_t trie_delta_lookup_values(TrieDelta *delta, const char *key,
+                                 size_t key_len, TrieValue *values,
+                                 size_t max_values, char *buf, size_t buf_len);
+
+/**
+ * Write a loaded trie with the changes of a delta applied into a new file.
+ * The keys of the trie are read in sorted order and merged with the sorted
+ * keys of the delta, so the new file is built with `TRIE_BUILD_SORTED` in a
+ * single pass and the memory used does not depend on the size of the trie.
+ *
+ * The new file keeps the content, compression, `TRIE_BUILD_RADIX` and
+ * `TRIE_BUILD_KEY_COUNTS` of the trie. `TRIE_BUILD_MINIMIZE` and `TRIE_BUILD_BLOCK_VALUES` can not be used
+ * with sorted input, so they are not kept.
+ *
+ * @param base      loaded trie
+ * @param delta     changes created over `base` or NULL to only rewrite it
+ * @param filename  where to write the new trie
+ * @return          0 on success, -1 on failure
+ */
+int trie_merge(Trie *base, TrieDelta *delta, const char *filename);
+
+/**
+ * Keys longer than this are counted in the last bucket of the depth
+ * histogram in `TrieStats`.
+ */
+#define TRIE_STATS_MAX_DEPTH 64
+
+/**
+ * Most sections a file can have, see `TrieStats`.
+ */
+#define TRIE_STATS_MAX_SECTIONS 11
+
+/**
+ * Size of one section of the file.
+ */
+typedef struct {
+    const char *name;   /**< Static name of the section. */
+    size_t bytes;       /**< Size without the alignment padding. */
+} TrieSectionStats;
+
+/**
+ * Description of the structure of a loaded trie, filled in by `trie_stats()`.
+ */
+typedef struct {
+    unsigned flags;             /**< `TRIE_BUILD_*` flags of the file. */
+    int with_content;           /**< Whether the trie stores data. */
+    int use_compress;           /**< Whether values share prefixes with keys. */
+
+    size_t nodes;               /**< Number of nodes without the invalid one. */
+    size_t chunks;              /**< Number of edges between nodes. */
+    size_t keys;                /**< Number of keys, paths through shared
+                                     nodes of minimized tries are counted
+                                     once for each key. */
+    size_t values;              /**< Number of values of all keys. */
+    size_t fanout[257];         /**< Number of nodes by number of children. */
+    size_t depth[TRIE_STATS_MAX_DEPTH + 1]; /**< Number of keys by length. */
+    size_t max_depth;           /**< Length of the longest key. */
+    size_t chains;              /**< Chains of nodes with a single child and
+                                     no data. */
+    size_t chain_nodes;         /**< Number of nodes in all chains. */
+    size_t labels;              /**< Nodes with a label (radix tries). */
+    size_t label_bytes;         /**< Keys stored in labels. */
+
+    size_t key_bytes;           /**< Total length of all keys. */
+    size_t value_bytes;         /**< Total length of the values of all keys,
+                                     before deduplication and compression. */
+    size_t stored_value_bytes;  /**< Size of the stored unique values. */
+    size_t input_bytes;         /**< Size of the keys and values as lines of
+                                     input for `list-compile`. */
+
+    size_t file_bytes;          /**< Size of the whole file. */
+    size_t padding_bytes;       /**< Alignment between sections. */
+    size_t num_sections;        /**< Number of sections in the file. */
+    TrieSectionStats sections[TRIE_STATS_MAX_SECTIONS];
+} TrieStats;
+
+/**
+ * Walk a loaded trie and describe its structure. Every node and value is
+ * read, so this takes about as long as looking up all keys.
+ *
+ * @param trie      loaded trie
+ * @param stats     (out) the description
+ * @return          0 on success, -1 if the trie is not loaded from a file
+ */
+int trie_stats(Trie *trie, TrieStats *stats);
+
+/**
+ * Print statistics from `trie_stats()` in human readable form.
+ *
+ * @param stats     statistics to print
+ * @param fh        where to print them
+ */
+void trie_stats_print(const TrieStats *stats, FILE *fh);
+
+/**
+ * Number of buckets of the latency histogram in `TrieCounters`.
+ */
+#define TRIE_LATENCY_BUCKETS 32
+
+/**
+ * What lookups of a trie did since the counters were enabled or reset, see
+ * `trie_get_counters()`. All counters are summed over all lookup functions.
+ */
+typedef struct {
+    uint64_t lookups;       /**< Number of looked up keys. */
+    uint64_t hits;          /**< Keys that were found. */
+    uint64_t misses;        /**< Keys that were not found. */
+    uint64_t nodes;         /**< Nodes visited, without the root. */
+    uint64_t chunks;        /**< Chunk keys compared while searching nodes. */
+    uint64_t decoded_bytes; /**< Bytes of values that had to be decoded
+                                 instead of read from the file directly. */
+    uint64_t allocations;   /**< Results allocated for the caller. */
+    /**
+     * Number of lookups by latency. Bucket `i` counts lookups that took at
+     * least 2^i and less than 2^(i+1) nanoseconds, the last one all slower
+     * lookups. Keys looked up with `trie_lookup_batch()` are each counted
+     * with the average time of the batch.
+     */
+    uint64_t latency[TRIE_LATENCY_BUCKETS];
+} TrieCounters;
+
+/**
+ * Start or stop counting what lookups of a loaded trie do. Counting is off by
+ * default. When it is on, each thread updates its own counters without
+ * locking. The nodes are counted while the key is walked, so the cost of
+ * counting is reading the clock before and after each lookup (each batch for
+ * `trie_lookup_batch()`), reading the table of value lengths of a found key
+ * and updating the counters of the calling thread. It may be called by
+ * several threads at once, also while others are looking up keys.
+ *
+ * @param trie      loaded trie
+ * @param enabled   whether to count
+ * @return          0 on success, -1 if the trie is not loaded from a file
+ */
+int trie_set_counters(Trie *trie, int enabled);
+
+/**
+ * Sum the counters of all threads that looked up keys in the trie. This can
+ * be called while other threads are doing lookups.
+ *
+ * @param trie      loaded trie
+ * @param counters  (out) the sum, all zero if counting was never enabled
+ */
+void trie_get_counters(Trie *trie, TrieCounters *counters);
+
+/**
+ * Set all counters of the trie back to zero.
+ *
+ * @param trie      loaded trie
+ */
+void trie_reset_counters(Trie *trie);
+
+/**
+ * Print counters from `trie_get_counters()` in human readable form.
+ *
+ * @param counters  counters to print
+ * @param fh        where to print them
+ */
+void trie_counters_print(const TrieCounters *counters, FILE *fh);
+
 /**
  * If some function failed, use this function to get user-friendly error
  * message. The result is a static string that should not be free'd.
@@ -0,0 +1,38 @@
+#!/bin/bash -e
+
+. $(dirname $0)/helper.sh
+
+COUNT=3000
+LONG=$(printf 'p%.0s' $(seq 1 300))
+
+for n in $(seq 1 $COUNT); do
+    echo "key-$n:value-$((n % 700))-of-key-$n"
+done | $SHUF | compile_input
+cat >>$COMPILE_INPUT <<EOF
+twice:first
+twice:second
+${LONG}a:${LONG}value
+${LONG}b:${LONG}
+EOF
+echo "Inserted $((COUNT + 4)) items" | compile_output
+
+head -n $COUNT $COMPILE_INPUT | cut -d: -f1 | query_input
+head -n $COUNT $COMPILE_INPUT | cut -d: -f2 | query_output
+cat >>$QUERY_INPUT <<EOF
+twice
+${LONG}a
+${LONG}b
+key-0
+EOF
+cat >>$QUERY_OUTPUT <<EOF
+first
+second
+${LONG}value
+${LONG}
+Not found
+EOF
+
+runtest ""
+runtest "-b"
+runtest "-b -u"
+runtest "-b -r -m"
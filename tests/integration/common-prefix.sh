@@ -0,0 +1,86 @@
+#!/bin/bash -e
+
+. $(dirname $0)/helper.sh
+
+COUNT=300
+
+# Keys from a small alphabet, so that longer inputs contain many of them.
+awk -v count=$COUNT 'BEGIN {
+    srand(7)
+    for (i = 0; i < count; ++i) {
+        n = 1 + int(rand() * 6)
+        key = ""
+        for (j = 0; j < n; ++j) {
+            key = key substr("abcde", 1 + int(rand() * 5), 1)
+        }
+        print key ":value-" i
+    }
+}' | $SHUF | compile_input
+echo "abc:second" >>$COMPILE_INPUT
+
+awk 'BEGIN {
+    srand(11)
+    for (i = 0; i < 200; ++i) {
+        n = int(rand() * 30)
+        key = ""
+        for (j = 0; j < n; ++j) {
+            key = key substr("abcdefx", 1 + int(rand() * 7), 1)
+        }
+        print key
+    }
+}' | query_input
+
+# Print what `list-query` prints for each input with `--common-prefixes`, or
+# with `--segment` if the argument is "segment".
+expected()
+{
+    awk -F: -v mode=$1 '
+        function print_key(key, part,    i) {
+            for (i = 1; i <= nvalues[key]; ++i) {
+                print part "\t" values[key, i]
+            }
+        }
+        NR == FNR { values[$1, ++nvalues[$1]] = $2; next }
+        mode != "segment" {
+            for (len = 0; len <= length($0); ++len) {
+                prefix = substr($0, 1, len)
+                if (prefix in nvalues) print_key(prefix, prefix)
+            }
+        }
+        mode == "segment" {
+            rest = $0; unknown = ""
+            while (rest != "") {
+                best = 0
+                for (len = 1; len <= length(rest); ++len) {
+                    if (substr(rest, 1, len) in nvalues) best = len
+                }
+                if (best == 0) {
+                    unknown = unknown substr(rest, 1, 1)
+                    rest = substr(rest, 2)
+                    continue
+                }
+                if (unknown != "") print unknown "\tNot found"
+                unknown = ""
+                print_key(substr(rest, 1, best), substr(rest, 1, best))
+                rest = substr(rest, best + 1)
+            }
+            if (unknown != "") print unknown "\tNot found"
+        }
+        { print "" }' $COMPILE_INPUT $QUERY_INPUT
+}
+
+for args in "" "-u" "-r" "-m" "-b" "-r -m -b"; do
+    ./list-compile $args $COMPILE_INPUT $TRIE >/dev/null
+    expected common >$QUERY_OUTPUT
+    ./list-query -c $TRIE <$QUERY_INPUT >$TEMP
+    if ! diff $QUERY_OUTPUT $TEMP >&2; then
+        echo "Common prefix search with <$args> differs" >&2
+        exit 1
+    fi
+    expected segment >$QUERY_OUTPUT
+    ./list-query -g $TRIE <$QUERY_INPUT >$TEMP
+    if ! diff $QUERY_OUTPUT $TEMP >&2; then
+        echo "Segmentation with <$args> differs" >&2
+        exit 1
+    fi
+done
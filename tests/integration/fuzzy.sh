@@ -0,0 +1,77 @@
+#!/bin/bash -e
+
+. $(dirname $0)/helper.sh
+
+COUNT=500
+
+# Short keys from a small alphabet, so that many of them are close.
+awk -v count=$COUNT 'BEGIN {
+    srand(3)
+    for (i = 0; i < count; ++i) {
+        n = 1 + int(rand() * 6)
+        key = ""
+        for (j = 0; j < n; ++j) {
+            key = key substr("abcde", 1 + int(rand() * 5), 1)
+        }
+        print key ":value-" i
+    }
+}' | $SHUF | compile_input
+echo "abc:second" >>$COMPILE_INPUT
+
+(cut -d: -f1 $COMPILE_INPUT | head -n 20; echo abcdeabcde; echo zz) | query_input
+
+# Print the expected matches of each query key by comparing it with every
+# key of the input, in the format of `list-query --fuzzy`.
+expected()
+{
+    awk -F: -v max=$1 '
+        function distance(a, b,    i, j, n, m, prev, row, cost, d) {
+            n = length(a); m = length(b)
+            for (j = 0; j <= m; ++j) prev[j] = j
+            for (i = 1; i <= n; ++i) {
+                row[0] = i
+                for (j = 1; j <= m; ++j) {
+                    cost = substr(a, i, 1) != substr(b, j, 1)
+                    d = prev[j - 1] + cost
+                    if (prev[j] + 1 < d) d = prev[j] + 1
+                    if (row[j - 1] + 1 < d) d = row[j - 1] + 1
+                    row[j] = d
+                }
+                for (j = 0; j <= m; ++j) prev[j] = row[j]
+            }
+            return prev[m]
+        }
+        NR == FNR { keys[NR] = $1; values[NR] = $2; count = NR; next }
+        {
+            for (i = 1; i <= count; ++i) {
+                d = distance($0, keys[i])
+                if (d <= max) print keys[i] "\t" d "\t" values[i]
+            }
+            print ""
+        }' $COMPILE_INPUT $QUERY_INPUT
+}
+
+# The matches of a query are sorted by key, values in input order.
+sort_matches()
+{
+    awk 'BEGIN { sort = "LC_ALL=C sort -s -t \"\t\" -k1,1" }
+        $0 == "" { close(sort); print ""; fflush(); next }
+        { print | sort }'
+}
+
+for args in "" "-u" "-r" "-m" "-b" "-r -m -b"; do
+    ./list-compile $args $COMPILE_INPUT $TRIE >/dev/null
+    for edits in 0 1 2; do
+        expected $edits | sort_matches >$QUERY_OUTPUT
+        ./list-query -f $edits $TRIE <$QUERY_INPUT >$TEMP
+        if ! diff $QUERY_OUTPUT $TEMP >&2; then
+            echo "Fuzzy search with <$args> and $edits edits differs" >&2
+            exit 1
+        fi
+    done
+done
+
+# Keys without data report the usual placeholder.
+./list-compile -e $COMPILE_INPUT $TRIE >/dev/null
+echo "abc:second" | ./list-query -f 0 $TRIE >$TEMP
+printf 'abc:second\t0\tFound\n\n' | diff - $TEMP
@@ -39,6 +39,22 @@ query_output()
     cat >$QUERY_OUTPUT
 }
 
+# Put the Python sources and the built modules together into package
+# `libtrie` in directory $1. Fails if there is no shared library or Python.
+python_package()
+{
+    if [ -z "$PYTHON" ] || ! [ -f .libs/libtrie.so ]; then
+        return 1
+    fi
+    mkdir $1/libtrie
+    cp $(dirname $0)/../../python/libtrie/__init__.py \
+       $(dirname $0)/../../python/libtrie/client.py $1/libtrie
+    echo "LIB_PATH = '$PWD/.libs/libtrie.so'" >$1/libtrie/config.py
+    if [ -f python/libtrie/.libs/_libtrie.so ]; then
+        cp python/libtrie/.libs/_libtrie.so $1/libtrie
+    fi
+}
+
 run()
 {
     ACTION=$1
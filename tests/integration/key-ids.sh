@@ -0,0 +1,85 @@
+#!/bin/bash -e
+
+. $(dirname $0)/helper.sh
+
+COUNT=3000
+KEYS=$(mktemp)
+trap 'cleanup; rm -f $KEYS' EXIT
+
+# Keys from a small alphabet share many prefixes and subtrees.
+awk -v count=$COUNT 'BEGIN {
+    srand(13)
+    for (i = 0; i < count; ++i) {
+        n = 1 + int(rand() * 8)
+        key = ""
+        for (j = 0; j < n; ++j) {
+            key = key substr("abcd", 1 + int(rand() * 4), 1)
+        }
+        print key ":value-" (i % 7)
+    }
+}' | LC_ALL=C sort -s -t: -k1,1 | compile_input
+cut -d: -f1 $COMPILE_INPUT | uniq >$KEYS
+TOTAL=$(wc -l <$KEYS)
+
+(echo; echo a; echo abc; echo dcba; echo abcdabcdabcd; echo e) | query_input
+
+# Print the number of keys starting with each query.
+expected_counts()
+{
+    awk 'NR == FNR { keys[NR] = $0; count = NR; next }
+        {
+            n = 0
+            for (i = 1; i <= count; ++i) {
+                if (substr(keys[i], 1, length($0)) == $0) ++n
+            }
+            print n
+        }' $KEYS $QUERY_INPUT
+}
+
+check()
+{
+    # Keys are numbered by their sorted order.
+    seq 0 $((TOTAL - 1)) >$QUERY_OUTPUT
+    ./list-query -i $TRIE <$KEYS >$TEMP
+    if ! diff $QUERY_OUTPUT $TEMP >&2; then
+        echo "Key numbers with <$1> differ" >&2
+        exit 1
+    fi
+    ./list-query -K $TRIE <$QUERY_OUTPUT >$TEMP
+    if ! diff $KEYS $TEMP >&2; then
+        echo "Keys by number with <$1> differ" >&2
+        exit 1
+    fi
+    expected_counts >$QUERY_OUTPUT
+    ./list-query -C $TRIE <$QUERY_INPUT >$TEMP
+    if ! diff $QUERY_OUTPUT $TEMP >&2; then
+        echo "Prefix counts with <$1> differ" >&2
+        exit 1
+    fi
+    printf 'abcdabcdabcd\nx\n' | ./list-query -i $TRIE >$TEMP
+    printf 'Not found\nNot found\n' | diff - $TEMP
+    printf '%s\n-1\nx\n' $TOTAL | ./list-query -K $TRIE >$TEMP
+    printf 'Not found\nNot found\nNot found\n' | diff - $TEMP
+}
+
+for args in "" "-u" "-r" "-m" "-b" "-s" "-r -s" "-r -m -b"; do
+    ./list-compile -k $args $COMPILE_INPUT $TRIE >/dev/null
+    check "$args"
+done
+
+# Merging keeps the counts.
+./list-compile -k -r $COMPILE_INPUT $TRIE >/dev/null
+echo "bbbbbbbbb:new" >$TEMP
+./list-merge -a $TEMP $TRIE $TRIE.merged >/dev/null
+mv $TRIE.merged $TRIE
+(cat $KEYS; echo bbbbbbbbb) | LC_ALL=C sort >$COMPILE_OUTPUT
+mv $COMPILE_OUTPUT $KEYS
+TOTAL=$((TOTAL + 1))
+check merged
+
+# Without the counts, numbers are not available.
+./list-compile $COMPILE_INPUT $TRIE >/dev/null
+if echo a | ./list-query -i $TRIE 2>/dev/null; then
+    echo "Numbering keys without counts succeeded" >&2
+    exit 1
+fi
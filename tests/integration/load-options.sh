@@ -0,0 +1,20 @@
+#!/bin/bash -e
+
+. $(dirname $0)/helper.sh
+
+COUNT=2000
+
+for n in $(seq 1 $COUNT); do
+    echo "key-$n:data-$n"
+done | $SHUF | compile_input
+echo "Inserted $COUNT items" | compile_output
+
+cut -d: -f1 $COMPILE_INPUT | query_input
+cut -d: -f2 $COMPILE_INPUT | query_output
+
+runtest "-r"
+
+for args in "-p" "-l" "-r" "-w" "-H" "--prewarm=2" "-p -r -W 100"; do
+    run query ./list-query $args $TRIE <$QUERY_INPUT >$TEMP
+    run query diff $TEMP $QUERY_OUTPUT
+done
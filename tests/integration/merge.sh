@@ -0,0 +1,53 @@
+#!/bin/bash -e
+
+. $(dirname $0)/helper.sh
+
+COUNT=3000
+REMOVE=$(mktemp)
+ADD=$(mktemp)
+EXPECTED=$(mktemp)
+trap 'cleanup; rm -f $REMOVE $ADD $EXPECTED' EXIT
+
+for n in $(seq 1 $COUNT); do
+    echo "key-$n:value-$n"
+done | $SHUF | compile_input
+echo "key-5:second" >>$COMPILE_INPUT
+
+for n in $(seq 100 300); do
+    echo "key-$n"
+done >$REMOVE
+echo "key-5" >>$REMOVE
+for n in $(seq 250 400); do
+    echo "key-$n:new-$n"
+done >$ADD
+cat >>$ADD <<EOF
+aaa:first
+key-1:another
+key-5:replaced
+zzz:last
+EOF
+
+# The same trie compiled from text with the changes applied.
+awk -F: 'NR == FNR { removed[$1] = 1; next } !($1 in removed)' $REMOVE $COMPILE_INPUT >$EXPECTED
+cat $ADD >>$EXPECTED
+(cut -d: -f1 $EXPECTED; cat $REMOVE; echo missing) | sort -u | query_input
+
+for args in "" "-u" "-r" "-m" "-b"; do
+    ./list-compile $args $COMPILE_INPUT $TRIE >/dev/null
+    ./list-merge -x $REMOVE -a $ADD $TRIE $TEMP >/dev/null
+    ./list-query $TEMP <$QUERY_INPUT >$COMPILE_OUTPUT
+    ./list-compile $args $EXPECTED $TRIE >/dev/null
+    ./list-query $TRIE <$QUERY_INPUT >$QUERY_OUTPUT
+    if ! diff $COMPILE_OUTPUT $QUERY_OUTPUT >&2; then
+        echo "Merged trie differs with <$args>" >&2
+        exit 1
+    fi
+done
+
+# Keys without data.
+./list-compile -e $COMPILE_INPUT $TRIE >/dev/null
+echo "key-1:value-1" >$REMOVE
+echo "new key" >$ADD
+./list-merge -e -x $REMOVE -a $ADD $TRIE $TEMP >/dev/null
+printf 'key-1:value-1\nnew key\nkey-2:value-2\n' | ./list-query $TEMP >$COMPILE_OUTPUT
+printf 'Not found\nFound\nFound\n' | diff - $COMPILE_OUTPUT
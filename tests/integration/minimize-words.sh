@@ -0,0 +1,15 @@
+#!/bin/bash -e
+
+. $(dirname $0)/helper.sh
+
+for stem in walk talk jump play climb; do
+    for suffix in "" s ed ing er ers; do
+        echo "$stem$suffix"
+    done
+done | compile_input
+echo "Inserted 30 items" | compile_output
+
+(cat $COMPILE_INPUT; sed 's/$/x/' $COMPILE_INPUT; echo wal; echo walke) | query_input
+(yes "Found" | head -n 30; yes "Not found" | head -n 32) | query_output
+
+runtest "-e -m"
@@ -0,0 +1,31 @@
+#!/bin/bash -e
+
+. $(dirname $0)/helper.sh
+
+COUNT=5000
+
+for n in $(seq 1 $COUNT); do
+    echo "$n-key-$n:data-$n"
+    echo "key-$n:$n"
+done | $SHUF | compile_input
+echo "Inserted $((COUNT * 2)) items" | compile_output
+
+cut -d: -f1 $COMPILE_INPUT | query_input
+cut -d: -f2 $COMPILE_INPUT | query_output
+
+runtest "-j 4"
+
+# The file must not depend on the number of threads.
+SINGLE=$(mktemp)
+trap "cleanup; rm -f $SINGLE" EXIT
+for args in "" "-r" "-m" "-e"; do
+    run compile ./list-compile $args $COMPILE_INPUT $SINGLE >/dev/null
+    run compile ./list-compile $args -j 3 $COMPILE_INPUT $TRIE >/dev/null
+    run compare cmp $SINGLE $TRIE
+done
+
+# There are no more shards than bytes.
+if ./list-compile -j 10000000 $COMPILE_INPUT $TRIE 2>/dev/null; then
+    echo "Compiling with too many jobs succeeded" >&2
+    exit 1
+fi
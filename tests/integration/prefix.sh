@@ -0,0 +1,82 @@
+#!/bin/bash -e
+
+. $(dirname $0)/helper.sh
+
+COUNT=2000
+
+# Keys from a small alphabet share many prefixes, some of them end inside
+# radix labels.
+awk -v count=$COUNT 'BEGIN {
+    srand(5)
+    for (i = 0; i < count; ++i) {
+        n = 1 + int(rand() * 8)
+        key = ""
+        for (j = 0; j < n; ++j) {
+            key = key substr("abcd", 1 + int(rand() * 4), 1)
+        }
+        print key ":value-" i
+    }
+}' | $SHUF | compile_input
+echo "abc:second" >>$COMPILE_INPUT
+
+(echo; echo a; echo abc; echo dcba; echo abcdabcdabcd; echo e) | query_input
+
+# Print the keys starting with each query and their values, in the format of
+# `list-query --prefix`, keeping at most `limit` keys and only those after
+# `after`.
+expected()
+{
+    LC_ALL=C sort -s -t: -k1,1 $COMPILE_INPUT | awk -F: -v limit=$1 -v after="$2" '
+        NR == FNR { keys[NR] = $1; values[NR] = $2; count = NR; next }
+        {
+            n = 0; last = ""
+            for (i = 1; i <= count; ++i) {
+                if (substr(keys[i], 1, length($0)) != $0) continue
+                if (after != "" && keys[i] <= after) continue
+                if (keys[i] != last) {
+                    if (limit > 0 && n == limit) continue
+                    ++n; last = keys[i]
+                }
+                print keys[i] "\t" values[i]
+            }
+            print ""
+        }' - $QUERY_INPUT
+}
+
+for args in "" "-u" "-r" "-m" "-b" "-r -m -b"; do
+    ./list-compile $args $COMPILE_INPUT $TRIE >/dev/null
+    for limit in 0 1 10; do
+        expected $limit >$QUERY_OUTPUT
+        ./list-query -P -L $limit $TRIE <$QUERY_INPUT >$TEMP
+        if ! diff $QUERY_OUTPUT $TEMP >&2; then
+            echo "Prefix search with <$args> and limit $limit differs" >&2
+            exit 1
+        fi
+    done
+    for after in a aa abc abcd ab abb b dddddddd e; do
+        expected 0 $after >$QUERY_OUTPUT
+        ./list-query -P -A $after $TRIE <$QUERY_INPUT >$TEMP
+        if ! diff $QUERY_OUTPUT $TEMP >&2; then
+            echo "Prefix search with <$args> after $after differs" >&2
+            exit 1
+        fi
+    done
+done
+
+# Paging with the last key of each page as continuation token gives all keys.
+echo a | ./list-query -P $TRIE | cut -f1 | uniq >$QUERY_OUTPUT
+: >$TEMP
+after=""
+while :; do
+    echo a | ./list-query -P -L 7 ${after:+-A $after} $TRIE | cut -f1 | uniq \
+        | grep . >$COMPILE_OUTPUT || break
+    cat $COMPILE_OUTPUT >>$TEMP
+    after=$(tail -n 1 $COMPILE_OUTPUT)
+done
+echo >>$TEMP
+diff $QUERY_OUTPUT $TEMP
+
+# Keys without data report the usual placeholder.
+./list-compile -e $COMPILE_INPUT $TRIE >/dev/null
+echo abc:sec | ./list-query -P $TRIE >$TEMP
+printf 'abc:second\tFound\n\n' | diff - $TEMP
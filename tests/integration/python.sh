@@ -0,0 +1,92 @@
+#!/bin/bash -e
+
+. $(dirname $0)/helper.sh
+
+PYDIR=$(mktemp -d)
+trap 'cleanup; rm -rf $PYDIR' EXIT
+
+# The bindings need the shared library and a Python interpreter.
+python_package $PYDIR || exit 77
+
+COUNT=2000
+
+for n in $(seq 1 $COUNT); do
+    echo "key-$n:value-$((n % 10))"
+done | $SHUF | compile_input
+echo "key-1:second" >>$COMPILE_INPUT
+echo "čaj:tea" >>$COMPILE_INPUT
+
+# Look up every key of the input with both classes. The compiled extension
+# is tested only when it was built.
+check()
+{
+    PYTHONPATH=$PYDIR $PYTHON - $TRIE $COMPILE_INPUT "$1" <<'EOF'
+# -*- coding: utf-8 -*-
+import io
+import sys
+
+import libtrie
+
+trie_file, input_file, args = sys.argv[1:]
+args = args.split()
+
+if libtrie.Trie is not libtrie.CtypesTrie and libtrie.LIBTRIE is not None:
+    sys.exit('ctypes library loaded although the extension is available')
+
+expected = {}
+with io.open(input_file, encoding='utf8') as f:
+    for line in f:
+        line = line.rstrip('\n')
+        if '-e' in args:
+            expected[line] = ['Found']
+        else:
+            key, value = line.split(':', 1)
+            expected.setdefault(key, []).append(value)
+keys = sorted(expected, key=lambda k: k.encode('utf8'))
+
+classes = [libtrie.CtypesTrie]
+if libtrie.Trie is not libtrie.CtypesTrie:
+    classes.append(libtrie.Trie)
+
+for cls in classes:
+    def fail(what):
+        sys.exit('%s with <%s>: %s' % (cls.__name__, ' '.join(args), what))
+
+    t = cls(trie_file)
+    for key in keys:
+        if t.lookup(key) != expected[key]:
+            fail('wrong values of %r' % key)
+    if t.lookup('missing') or t.lookup(''):
+        fail('found a missing key')
+    many = t.lookup_many(keys + ['missing'])
+    if many != [expected[key] for key in keys] + [[]]:
+        fail('wrong values of lookup_many()')
+
+    if '-k' in args:
+        for number, key in enumerate(keys):
+            if t.lookup_id(key) != number or t.key_by_id(number) != key:
+                fail('wrong number of %r' % key)
+        if t.lookup_id('missing') is not None:
+            fail('numbered a missing key')
+        try:
+            t.key_by_id(len(keys))
+            fail('found a key past the end')
+        except IndexError:
+            pass
+        prefixed = len([key for key in keys if key.startswith('key-1')])
+        if t.count_prefix('key-1') != prefixed:
+            fail('wrong count of keys with a prefix')
+EOF
+}
+
+for args in "" "-u" "-k" "-u -k" "-b -k"; do
+    ./list-compile $args $COMPILE_INPUT $TRIE >/dev/null
+    check "$args"
+done
+
+cut -d: -f1 $COMPILE_INPUT | sort -u >$TEMP
+mv $TEMP $COMPILE_INPUT
+for args in "-e" "-e -k"; do
+    ./list-compile $args $COMPILE_INPUT $TRIE >/dev/null
+    check "$args"
+done
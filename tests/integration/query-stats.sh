@@ -0,0 +1,42 @@
+#!/bin/bash -e
+
+. $(dirname $0)/helper.sh
+
+COUNT=5000
+
+for n in $(seq 1 $COUNT); do
+    echo "key-$n:value-$n"
+done | $SHUF | compile_input
+./list-compile $COMPILE_INPUT $TRIE >/dev/null
+
+(seq 1 $COUNT | sed 's/^/key-/'; seq 1 100 | sed 's/^/missing-/') | query_input
+
+for jobs in 1 4; do
+    ./list-query --stats -j $jobs $TRIE <$QUERY_INPUT 2>$TEMP >/dev/null
+    # A lookup is repeated when the value does not fit into the output
+    # buffer, so there may be a few more hits than keys.
+    read lookups hits misses < <(sed -n 's/^Lookups: \([0-9]*\) (\([0-9]*\) hits, \([0-9]*\) misses)$/\1 \2 \3/p' $TEMP)
+    if [ "$misses" != 100 ] || [ "$hits" -lt $COUNT ] || [ $((hits + misses)) != "$lookups" ]; then
+        echo "Wrong number of lookups with $jobs jobs" >&2
+        cat $TEMP >&2
+        exit 1
+    fi
+    latency=$(sed -n 's/^  < *[0-9]* ns: //p' $TEMP | awk '{ sum += $1 } END { print sum }')
+    if [ "$latency" != "$lookups" ]; then
+        echo "Latency histogram does not count all lookups with $jobs jobs" >&2
+        cat $TEMP >&2
+        exit 1
+    fi
+done
+
+# Without the option, nothing is printed.
+./list-query $TRIE <$QUERY_INPUT 2>$TEMP >/dev/null
+if [ -s $TEMP ]; then
+    echo "Counters printed without --stats" >&2
+    exit 1
+fi
+
+if ./list-query --stats -S /nonexistent 2>/dev/null </dev/null; then
+    echo "--stats was accepted with --server" >&2
+    exit 1
+fi
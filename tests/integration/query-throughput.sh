@@ -0,0 +1,29 @@
+#!/bin/bash -e
+
+. $(dirname $0)/helper.sh
+
+COUNT=50000
+
+for n in $(seq 1 $COUNT); do
+    echo "key-$n:data-$n"
+done | $SHUF | compile_input
+echo "Inserted $COUNT items" | compile_output
+
+cut -d: -f1 $COMPILE_INPUT | query_input
+cut -d: -f2 $COMPILE_INPUT | query_output
+
+runtest ""
+
+for jobs in 1 2 3 8; do
+    run query ./list-query -j $jobs $TRIE <$QUERY_INPUT >$TEMP
+    run query diff $TEMP $QUERY_OUTPUT
+done
+
+# Keys and results delimited by NUL.
+tr '\n' '\0' <$QUERY_INPUT | ./list-query -0 -j 2 $TRIE | tr '\0' '\n' >$TEMP
+run query diff $TEMP $QUERY_OUTPUT
+
+# Custom marker, missing trailing newline and a key longer than the block.
+printf 'key-1\nmissing\n%s\nkey-2' "$(head -c 3000000 /dev/zero | tr '\0' k)" \
+    | ./list-query --not-found=- $TRIE >$TEMP
+printf 'data-1\n-\n-\ndata-2\n' | run query diff $TEMP -
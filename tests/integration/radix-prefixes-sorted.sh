@@ -0,0 +1,52 @@
+#!/bin/bash -e
+
+. $(dirname $0)/helper.sh
+
+LONG=$(printf 'x%.0s' $(seq 1 600))
+
+compile_input <<EOF
+a:four
+abcd:two
+abcdefgh:one
+abcdxyz:three
+$LONG:long
+${LONG}y:longer
+EOF
+
+compile_output <<EOF
+Inserted 6 items
+EOF
+
+query_input <<EOF
+abcdefgh
+abcd
+abcdxyz
+a
+ab
+abcdef
+abcdefghi
+abcdxy
+abcdxyzz
+$LONG
+${LONG}y
+${LONG}z
+xxxx
+EOF
+
+query_output <<EOF
+one
+two
+three
+four
+Not found
+Not found
+Not found
+Not found
+Not found
+long
+longer
+Not found
+Not found
+EOF
+
+runtest "-r -s"
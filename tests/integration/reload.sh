@@ -0,0 +1,84 @@
+#!/bin/bash -e
+
+. $(dirname $0)/helper.sh
+
+COUNT=20000
+OLD=$(mktemp)
+NEW=$(mktemp)
+
+for n in $(seq 1 $COUNT); do
+    echo "key-$n:old-$n"
+done | $SHUF | compile_input
+./list-compile $COMPILE_INPUT $OLD >/dev/null
+sed 's/:old-/:new-/' $COMPILE_INPUT >$TEMP
+./list-compile $TEMP $NEW >/dev/null
+cp $OLD $TRIE
+
+cut -d: -f1 $COMPILE_INPUT | query_input
+
+SOCKET_DIR=$(mktemp -d)
+SOCKET=$SOCKET_DIR/socket
+
+./list-serve -j 2 -s $SOCKET $TRIE 2>$SOCKET_DIR/errors &
+SERVER=$!
+trap 'kill $SERVER; wait $SERVER || true; rm -rf $SOCKET_DIR $OLD $NEW; cleanup' EXIT
+
+for i in $(seq 1 50); do
+    [ -S $SOCKET ] && break
+    sleep 0.1
+done
+
+# Wait until all answers come from the trie with the given values.
+expect_values()
+{
+    for i in $(seq 1 50); do
+        ./list-query -S $SOCKET <$QUERY_INPUT >$QUERY_OUTPUT
+        if ! grep -qv "^$1-" $QUERY_OUTPUT; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    echo "Server does not answer with $1 values" >&2
+    exit 1
+}
+
+expect_values old
+
+# Files are replaced by renaming, the server keeps the old one mapped.
+cp $NEW $TRIE.tmp
+mv $TRIE.tmp $TRIE
+kill -HUP $SERVER
+expect_values new
+
+# Reload repeatedly while the keys are looked up. Every answer must come from
+# one of the versions.
+for i in $(seq 1 10); do
+    if [ $((i % 2)) = 0 ]; then cp $NEW $TRIE.tmp; else cp $OLD $TRIE.tmp; fi
+    mv $TRIE.tmp $TRIE
+    kill -HUP $SERVER
+    sleep 0.05
+done &
+RELOADS=$!
+for i in $(seq 1 3); do
+    ./list-query -S $SOCKET -j 2 <$QUERY_INPUT >$QUERY_OUTPUT
+    if paste -d: $QUERY_INPUT $QUERY_OUTPUT | grep -qvE '^key-([0-9]+):(old|new)-\1$'; then
+        echo "Wrong answer during reloads" >&2
+        exit 1
+    fi
+done
+wait $RELOADS
+expect_values new
+
+# A file that can not be loaded keeps the old trie.
+echo "not a trie" >$TRIE.tmp
+mv $TRIE.tmp $TRIE
+kill -HUP $SERVER
+for i in $(seq 1 50); do
+    grep -q "Failed to reload" $SOCKET_DIR/errors && break
+    sleep 0.1
+done
+if ! grep -q "Failed to reload" $SOCKET_DIR/errors; then
+    echo "Failed reload was not reported" >&2
+    exit 1
+fi
+expect_values new
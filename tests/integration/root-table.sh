@@ -0,0 +1,39 @@
+#!/bin/bash -e
+
+. $(dirname $0)/helper.sh
+
+# Many different first bytes and enough nodes for the root table to be built.
+COUNT=20000
+CHARS=abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ
+
+for n in $(seq 1 $COUNT); do
+    first=${CHARS:$((n % 52)):1}
+    second=${CHARS:$((n / 52 % 52)):1}
+    echo "$first$second-key-$n:data-$n"
+done | $SHUF | compile_input
+for n in $(seq 0 51); do
+    echo "${CHARS:$n:1}:short-$n"
+    echo "${CHARS:$n:1}z:two-$n"
+done >>$COMPILE_INPUT
+echo "Inserted $((COUNT + 104)) items" | compile_output
+
+cut -d: -f1 $COMPILE_INPUT | query_input
+cut -d: -f2 $COMPILE_INPUT | query_output
+cat >>$QUERY_INPUT <<EOF
+0
+00
+zz-missing
+z0
+EOF
+for n in 1 2 3 4; do
+    echo "Not found"
+done >>$QUERY_OUTPUT
+
+runtest ""
+runtest "-u"
+runtest "-r"
+
+if ! ./list-compile -v $COMPILE_INPUT $TRIE | grep -q "Root table: 262144 bytes"; then
+    echo "Root table was not built" >&2
+    exit 1
+fi
@@ -0,0 +1,81 @@
+#!/bin/bash -e
+
+. $(dirname $0)/helper.sh
+
+COUNT=20000
+
+for n in $(seq 1 $COUNT); do
+    echo "key-$n:data-$n"
+done | $SHUF | compile_input
+echo "Inserted $COUNT items" | compile_output
+
+(cut -d: -f1 $COMPILE_INPUT; echo missing) | query_input
+(cut -d: -f2 $COMPILE_INPUT; echo "Not found") | query_output
+
+runtest ""
+
+SOCKET_DIR=$(mktemp -d)
+SOCKET=$SOCKET_DIR/socket
+
+# The second trie has a value of 1 MiB.
+BIG=$SOCKET_DIR/big.trie
+(printf 'big:'; head -c $((1 << 20)) /dev/zero | tr '\0' x; echo) >$TEMP
+./list-compile $TEMP $BIG >/dev/null
+
+./list-serve -j 2 -s $SOCKET $TRIE $BIG &
+SERVER=$!
+trap 'kill $SERVER; wait $SERVER || true; rm -rf $SOCKET_DIR; cleanup' EXIT
+
+for i in $(seq 1 50); do
+    [ -S $SOCKET ] && break
+    sleep 0.1
+done
+
+for jobs in 1 3; do
+    run query ./list-query -S $SOCKET -j $jobs <$QUERY_INPUT >$TEMP
+    run query diff $TEMP $QUERY_OUTPUT
+done
+
+# There are only two tries.
+if echo key-1 | ./list-query -S $SOCKET -t 2 >$TEMP 2>&1; then
+    echo "Querying missing trie should fail" >&2
+    exit 1
+fi
+
+# An answer longer than the largest frame is refused, a shorter one is sent.
+if yes big | head -n 70 | ./list-query -S $SOCKET -t 1 >$TEMP 2>&1; then
+    echo "Too large answer should fail" >&2
+    exit 1
+fi
+if ! grep -q "status 4" $TEMP; then
+    echo "Too large answer failed with wrong status" >&2
+    cat $TEMP >&2
+    exit 1
+fi
+yes big | head -n 60 | ./list-query -S $SOCKET -t 1 >$TEMP
+if [ $(wc -c <$TEMP) != $((60 * ((1 << 20) + 1))) ]; then
+    echo "Wrong size of a large answer" >&2
+    exit 1
+fi
+
+# A large batch through the Python client must not stall the server, which
+# stops reading requests while responses are not read.
+PYDIR=$(mktemp -d)
+trap 'kill $SERVER; wait $SERVER || true; rm -rf $SOCKET_DIR $PYDIR; cleanup' EXIT
+if python_package $PYDIR; then
+    PYTHONPATH=$PYDIR timeout 60 $PYTHON - $SOCKET $COUNT <<'PYEOF'
+import sys
+
+from libtrie.client import Client
+
+socket_path, count = sys.argv[1], int(sys.argv[2])
+keys = ['key-%d' % (n % (count + 1)) for n in range(500000)]
+results = Client(socket_path).lookup_many(keys)
+for n, values in enumerate(results):
+    n %= count + 1
+    if values != (['data-%d' % n] if n else []):
+        sys.exit('wrong values of key-%d: %r' % (n, values))
+if len(results) != len(keys):
+    sys.exit('got %d results for %d keys' % (len(results), len(keys)))
+PYEOF
+fi
@@ -0,0 +1,71 @@
+#!/bin/bash -e
+
+. $(dirname $0)/helper.sh
+
+COUNT=2000
+
+for n in $(seq 1 $COUNT); do
+    echo "key-$n:value-$((n % 10))"
+done | $SHUF | compile_input
+echo "key-1:second" >>$COMPILE_INPUT
+echo "other:value-1" >>$COMPILE_INPUT
+
+# Print the value of a line of the statistics.
+field()
+{
+    sed -n "s/^$1: *\([0-9]*\).*/\1/p" $TEMP
+}
+
+for args in "" "-u" "-r" "-m" "-b" "-r -m -b"; do
+    ./list-compile $args $COMPILE_INPUT $TRIE >/dev/null
+    ./list-stats $TRIE >$TEMP
+
+    if [ "$(field Keys)" != $((COUNT + 1)) ] || [ "$(field Values)" != $((COUNT + 2)) ]; then
+        echo "Wrong number of keys or values with <$args>" >&2
+        cat $TEMP >&2
+        exit 1
+    fi
+    if [ "$(field 'File bytes')" != $(wc -c <$TRIE) ]; then
+        echo "Wrong file size with <$args>" >&2
+        exit 1
+    fi
+    sections=$(sed -n '/^Sections:/,/^Fanout/s/^  .* \([0-9][0-9]*\)  .*/\1/p' $TEMP \
+               | awk '{ sum += $1 } END { print sum }')
+    if [ "$sections" != $(wc -c <$TRIE) ]; then
+        echo "Sections do not add up to the file size with <$args>" >&2
+        cat $TEMP >&2
+        exit 1
+    fi
+    # Every key has the same length as its line without the value.
+    input=$(wc -c <$COMPILE_INPUT)
+    if ! grep -q "for $input bytes of input" $TEMP; then
+        echo "Wrong input size with <$args>" >&2
+        cat $TEMP >&2
+        exit 1
+    fi
+done
+
+# Compiling verbosely prints the same statistics.
+./list-compile -v $COMPILE_INPUT $TRIE >$COMPILE_OUTPUT
+./list-stats $TRIE >$TEMP
+if ! diff <(tail -n $(wc -l <$TEMP) $COMPILE_OUTPUT) $TEMP; then
+    echo "list-compile -v printed different statistics" >&2
+    exit 1
+fi
+
+# The root has one child, which has two.
+printf 'ab:1\nac:2\n' >$COMPILE_INPUT
+for args in "" "-u" "-m" "-b"; do
+    ./list-compile $args $COMPILE_INPUT $TRIE >/dev/null
+    ./list-stats $TRIE >$TEMP
+    if [ "$(field Nodes)" != 4 ] || [ "$(field Chunks)" != 3 ]; then
+        echo "Wrong number of nodes or chunks with <$args>" >&2
+        cat $TEMP >&2
+        exit 1
+    fi
+done
+
+if ./list-stats $COMPILE_INPUT 2>/dev/null; then
+    echo "list-stats accepted a file that is not a trie" >&2
+    exit 1
+fi
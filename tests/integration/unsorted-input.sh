@@ -0,0 +1,14 @@
+#!/bin/bash -e
+
+. $(dirname $0)/helper.sh
+
+compile_input <<EOF
+foo:bar
+baz:quux
+EOF
+
+if ./list-compile --sorted $COMPILE_INPUT $TRIE >$TEMP 2>&1; then
+    echo "Compiling unsorted input with --sorted succeeded" >&2
+    exit 1
+fi
+grep -q "Keys are not sorted" $TEMP
@@ -0,0 +1,27 @@
+#!/bin/bash -e
+
+. $(dirname $0)/helper.sh
+
+COUNT=10000
+
+for n in $(seq 1 $COUNT); do
+    echo "my-key-$n:my-data-$n"
+done | LC_ALL=C sort -t: -k1,1 | compile_input
+echo "Inserted $COUNT items" | compile_output
+
+cut -d: -f1 $COMPILE_INPUT | $SHUF >$TEMP
+cp $TEMP $QUERY_INPUT
+sed 's/^my-key-/my-data-/' $QUERY_INPUT | query_output
+
+runtest "--sorted"
+
+# Nodes with many children store a bitmap, the output must not depend on
+# anything but the input.
+awk 'BEGIN {
+    for (i = 0; i < 3000; ++i) {
+        printf "%c%c:value-%d\n", 65 + i % 60, 65 + int(i / 60), i
+    }
+}' | LC_ALL=C sort -t: -k1,1 | compile_input
+./list-compile --sorted $COMPILE_INPUT $TRIE >/dev/null
+./list-compile --sorted $COMPILE_INPUT $TEMP >/dev/null
+cmp $TRIE $TEMP